@@ -0,0 +1,438 @@
+/* Running simple recipe commands within GNU Make.
+Copyright (C) 2013 Free Software Foundation, Inc.
+This file is part of GNU Make.
+
+GNU Make is free software; you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation; either version 3 of the License, or (at your option) any later
+version.
+
+GNU Make is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "makeint.h"
+
+#ifdef MAKE_BUILTINS
+
+#ifdef HAVE_FCNTL_H
+# include <fcntl.h>
+#else
+# include <sys/file.h>
+#endif
+#include <utime.h>
+
+#include "job.h"
+
+/* Many recipe lines are nothing more than 'mkdir -p $(@D)' or 'touch $@',
+   and each one costs a new process running the utility.  With
+   --builtin-commands, make carries out these commands itself: echo,
+   mkdir [-p], touch, rm -f, and cp of one file.  Only lines that make would
+   run without a shell get here, so there is nothing to expand or redirect,
+   and only the forms of the commands that are handled completely below;
+   anything else is run as usual.
+
+   A command that fails before it has changed anything is run as usual
+   too, so that the real program reports the error.  After that it would
+   not be safe to run it again, and errors are reported here in the form
+   the GNU utilities use, with the same exit status.  */
+
+#define NOT_BUILTIN     (-1)
+
+/* How much cp reads and writes at a time.  */
+
+#define COPY_BUFSIZE    65536
+
+/* Write LEN bytes at BUF to FD.  Return 0, or the errno of the failure.  */
+
+static int
+write_all (int fd, const char *buf, size_t len)
+{
+  while (len > 0)
+    {
+      ssize_t n;
+
+      EINTRLOOP (n, write (fd, buf, len));
+      if (n < 0)
+        return errno;
+      buf += n;
+      len -= n;
+    }
+
+  return 0;
+}
+
+/* Report that CMD could not do WHAT to NAME because of ERR, on FD.
+   NAME may be null.  */
+
+static void
+builtin_error (int fd, const char *cmd, const char *what, const char *name,
+               int err)
+{
+  const char *msg = strerror (err);
+  char *buf = xmalloc (strlen (cmd) + strlen (what) + xstrlen (name)
+                       + strlen (msg) + 10);
+
+  if (name)
+    sprintf (buf, "%s: %s '%s': %s\n", cmd, what, name, msg);
+  else
+    sprintf (buf, "%s: %s: %s\n", cmd, what, msg);
+  write_all (fd, buf, strlen (buf));
+  free (buf);
+}
+
+/* Return nonzero if any of the words in ARGV looks like an option.  */
+
+static int
+any_options (char **argv)
+{
+  for (; *argv != 0; ++argv)
+    if ((*argv)[0] == '-')
+      return 1;
+  return 0;
+}
+
+/* echo [-n] WORDS...  */
+
+static int
+builtin_echo (char **argv, int outfd, int errfd)
+{
+  int newline = 1;
+  unsigned int len = 0;
+  char **ap;
+  char *buf;
+  char *p;
+  int err;
+
+  if (argv[0] && streq (argv[0], "-n"))
+    {
+      newline = 0;
+      ++argv;
+    }
+
+  /* The first word might be another option, and some echos interpret
+     backslashes.  */
+  if (argv[0] && argv[0][0] == '-')
+    return NOT_BUILTIN;
+  for (ap = argv; *ap != 0; ++ap)
+    {
+      if (strchr (*ap, '\\'))
+        return NOT_BUILTIN;
+      len += strlen (*ap) + 1;
+    }
+
+  p = buf = xmalloc (len + 1);
+  for (ap = argv; *ap != 0; ++ap)
+    {
+      size_t l = strlen (*ap);
+
+      if (ap != argv)
+        *(p++) = ' ';
+      memcpy (p, *ap, l);
+      p += l;
+    }
+  if (newline)
+    *(p++) = '\n';
+
+  err = write_all (outfd, buf, p - buf);
+  free (buf);
+
+  if (err == 0)
+    return 0;
+
+  /* We may have written part of it.  */
+  builtin_error (errfd, "echo", "write error", 0, err);
+  return 1;
+}
+
+/* Create the directory NAME, and with PARENTS any missing directories
+   above it.  Set *DONE if anything was created.  Return 0, or the errno of
+   the failure with the directory that could not be made left in NAME.  */
+
+static int
+make_dir (char *name, int parents, int *done)
+{
+  char *p = name;
+
+  if (!parents)
+    {
+      if (mkdir (name, 0777) != 0)
+        return errno;
+      *done = 1;
+      return 0;
+    }
+
+  while (*p == '/')
+    ++p;
+
+  while (1)
+    {
+      char c;
+
+      p += strcspn (p, "/");
+      c = *p;
+      *p = '\0';
+
+      if (mkdir (name, 0777) == 0)
+        *done = 1;
+      else
+        {
+          int err = errno;
+          struct stat st;
+
+          if (stat (name, &st) != 0 || !S_ISDIR (st.st_mode))
+            return err;
+        }
+
+      *p = c;
+      while (*p == '/')
+        ++p;
+      if (*p == '\0')
+        return 0;
+    }
+}
+
+/* mkdir [-p] DIRS...  */
+
+static int
+builtin_mkdir (char **argv, int errfd)
+{
+  int parents = 0;
+  int done = 0;
+  int status = 0;
+
+  if (argv[0] && streq (argv[0], "-p"))
+    {
+      parents = 1;
+      ++argv;
+    }
+  if (argv[0] == 0 || any_options (argv))
+    return NOT_BUILTIN;
+
+  for (; *argv != 0; ++argv)
+    {
+      char *name = xstrdup (*argv);
+      int err = make_dir (name, parents, &done);
+
+      if (err != 0)
+        {
+          if (!done)
+            {
+              free (name);
+              return NOT_BUILTIN;
+            }
+          builtin_error (errfd, "mkdir", "cannot create directory", name, err);
+          status = 1;
+        }
+      free (name);
+    }
+
+  return status;
+}
+
+/* touch FILES...  */
+
+static int
+builtin_touch (char **argv, int errfd)
+{
+  int done = 0;
+  int status = 0;
+
+  if (argv[0] == 0 || any_options (argv))
+    return NOT_BUILTIN;
+
+  for (; *argv != 0; ++argv)
+    {
+      int open_err = 0;
+      int fd;
+
+      EINTRLOOP (fd, open (*argv, O_WRONLY | O_CREAT | O_NONBLOCK | O_NOCTTY,
+                           0666));
+      if (fd < 0)
+        open_err = errno;
+      else
+        {
+          done = 1;
+          close (fd);
+        }
+
+      if (utime (*argv, 0) == 0)
+        done = 1;
+      else
+        {
+          int err = errno;
+
+          if (!done)
+            return NOT_BUILTIN;
+          if (open_err)
+            builtin_error (errfd, "touch", "cannot touch", *argv, open_err);
+          else
+            builtin_error (errfd, "touch", "setting times of", *argv, err);
+          status = 1;
+        }
+    }
+
+  return status;
+}
+
+/* rm -f FILES...  */
+
+static int
+builtin_rm (char **argv, int errfd)
+{
+  int done = 0;
+  int status = 0;
+
+  if (argv[0] == 0 || !streq (argv[0], "-f"))
+    return NOT_BUILTIN;
+  ++argv;
+  if (any_options (argv))
+    return NOT_BUILTIN;
+
+  for (; *argv != 0; ++argv)
+    {
+      if (unlink (*argv) == 0)
+        done = 1;
+      else if (errno != ENOENT)
+        {
+          if (!done)
+            return NOT_BUILTIN;
+          builtin_error (errfd, "rm", "cannot remove", *argv, errno);
+          status = 1;
+        }
+    }
+
+  return status;
+}
+
+/* cp SOURCE DEST, where SOURCE is a regular file.  */
+
+static int
+builtin_cp (char **argv, int errfd)
+{
+  const char *src = argv[0];
+  const char *dst;
+  char *target;
+  struct stat src_st, st;
+  int exists;
+  int in, out;
+  char *buf;
+  int status = 0;
+
+  if (src == 0 || argv[1] == 0 || argv[2] != 0 || any_options (argv))
+    return NOT_BUILTIN;
+  dst = argv[1];
+
+  if (stat (src, &src_st) != 0 || !S_ISREG (src_st.st_mode))
+    return NOT_BUILTIN;
+
+  /* Copying into a directory keeps the name of the file.  */
+  if (stat (dst, &st) == 0 && S_ISDIR (st.st_mode))
+    {
+      const char *base = strrchr (src, '/');
+      size_t dlen = strlen (dst);
+
+      base = base ? base + 1 : src;
+      target = xmalloc (dlen + 1 + strlen (base) + 1);
+      memcpy (target, dst, dlen);
+      if (dlen == 0 || dst[dlen - 1] != '/')
+        target[dlen++] = '/';
+      strcpy (target + dlen, base);
+    }
+  else if (dst[0] != '\0' && dst[strlen (dst) - 1] == '/')
+    return NOT_BUILTIN;
+  else
+    target = xstrdup (dst);
+
+  exists = stat (target, &st) == 0;
+  if (exists && (!S_ISREG (st.st_mode)
+                 || (st.st_dev == src_st.st_dev && st.st_ino == src_st.st_ino)))
+    {
+      free (target);
+      return NOT_BUILTIN;
+    }
+
+  EINTRLOOP (in, open (src, O_RDONLY));
+  if (in < 0)
+    {
+      free (target);
+      return NOT_BUILTIN;
+    }
+
+  if (exists)
+    EINTRLOOP (out, open (target, O_WRONLY | O_TRUNC));
+  else
+    EINTRLOOP (out, open (target, O_WRONLY | O_CREAT | O_EXCL,
+                          src_st.st_mode & 0777));
+  if (out < 0)
+    {
+      close (in);
+      free (target);
+      return NOT_BUILTIN;
+    }
+
+  buf = xmalloc (COPY_BUFSIZE);
+  while (1)
+    {
+      ssize_t n;
+      int err;
+
+      EINTRLOOP (n, read (in, buf, COPY_BUFSIZE));
+      if (n == 0)
+        break;
+      if (n < 0)
+        {
+          builtin_error (errfd, "cp", "error reading", src, errno);
+          status = 1;
+          break;
+        }
+
+      err = write_all (out, buf, n);
+      if (err != 0)
+        {
+          builtin_error (errfd, "cp", "error writing", target, err);
+          status = 1;
+          break;
+        }
+    }
+  free (buf);
+
+  close (in);
+  if (close (out) != 0 && status == 0)
+    {
+      builtin_error (errfd, "cp", "failed to close", target, errno);
+      status = 1;
+    }
+
+  free (target);
+  return status;
+}
+
+/* Carry out the command in ARGV, as made by construct_command_argv without
+   a shell, if it is one we know.  Its standard output is OUTFD and its
+   standard error ERRFD.  Return its exit status, or -1 if it must be run
+   as usual.  */
+
+int
+builtin_command (char **argv, int outfd, int errfd)
+{
+  const char *cmd = argv[0];
+
+  if (streq (cmd, "echo"))
+    return builtin_echo (argv + 1, outfd, errfd);
+  if (streq (cmd, "mkdir"))
+    return builtin_mkdir (argv + 1, errfd);
+  if (streq (cmd, "touch"))
+    return builtin_touch (argv + 1, errfd);
+  if (streq (cmd, "rm"))
+    return builtin_rm (argv + 1, errfd);
+  if (streq (cmd, "cp"))
+    return builtin_cp (argv + 1, errfd);
+
+  return NOT_BUILTIN;
+}
+
+#endif /* MAKE_BUILTINS */
@@ -540,7 +540,7 @@ fatal_error_signal (int sig)
     {
       struct child *c;
       for (c = children; c != 0; c = c->next)
-        if (!c->remote)
+        if (!c->remote && !c->builtin)
           (void) kill (c->pid, SIGTERM);
     }
 
@@ -581,6 +581,11 @@ fatal_error_signal (int sig)
 
   remove_intermediates (1);
 
+  /* Remove the jobserver FIFO, if we created one.  */
+
+  if (job_fifo_name)
+    unlink (job_fifo_name);
+
 #ifdef SIGQUIT
   if (sig == SIGQUIT)
     /* We don't want to send ourselves SIGQUIT, because it will
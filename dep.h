@@ -22,6 +22,7 @@ this program.  If not, see <http://www.gnu.org/licenses/>.  */
 #define RM_INCLUDED             (1 << 1) /* Search makefile search path.  */
 #define RM_DONTCARE             (1 << 2) /* No error if it doesn't exist.  */
 #define RM_NO_TILDE             (1 << 3) /* Don't expand ~ in file name.  */
+#define RM_DEPFILE              (1 << 4) /* Compiler-written dependencies.  */
 #define RM_NOFLAG               0
 
 /* Structure representing one dependency of a file.
@@ -80,13 +81,21 @@ struct nameseq *ar_glob (const char *arname, const char *member_pattern, unsigne
 
 #define dep_name(d)     ((d)->name == 0 ? (d)->file->name : (d)->name)
 
-#define alloc_dep()     (xcalloc (sizeof (struct dep)))
-#define free_ns(_n)     free (_n)
+/* The pool that struct dep and struct nameseq both come from.  Its objects
+   are the size of a struct dep, so a chain made by parse_file_seq can be
+   freed as either.  */
+extern struct objpool dep_pool;
+
+#define alloc_dep()     ((struct dep *) pool_alloc (&dep_pool))
+#define alloc_ns()      ((struct nameseq *) pool_alloc (&dep_pool))
+#define free_ns(_n)     pool_free (&dep_pool, (_n))
 #define free_dep(_d)    free_ns (_d)
 
 struct dep *copy_dep_chain (const struct dep *d);
 void free_dep_chain (struct dep *d);
 void free_ns_chain (struct nameseq *n);
 struct dep *read_all_makefiles (const char **makefiles);
+struct dep *readcache_load (const char **makefiles);
+void readcache_save (struct dep *read_files, const char **makefiles);
 void eval_buffer (char *buffer, const gmk_floc *floc);
 enum update_status update_goal_chain (struct dep *goals);
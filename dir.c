@@ -18,6 +18,7 @@ this program.  If not, see <http://www.gnu.org/licenses/>.  */
 #include "hash.h"
 #include "filedef.h"
 #include "dep.h"
+#include "debug.h"
 
 #ifdef  HAVE_DIRENT_H
 # include <dirent.h>
@@ -344,7 +345,7 @@ struct directory
 static unsigned long
 directory_hash_1 (const void *key)
 {
-  return_ISTRING_HASH_1 (((const struct directory *) key)->name);
+  return strcache_hash (((const struct directory *) key)->name);
 }
 
 static unsigned long
@@ -360,7 +361,8 @@ directory_hash_cmp (const void *x, const void *y)
                           ((const struct directory *) y)->name);
 }
 
-/* Table of directories hashed by name.  */
+/* Table of directories hashed by name.  Like the names of the files in
+   each directory, the names are always in the strcache.  */
 static struct hash_table directories;
 
 /* Never have more than this many directories open at once.  */
@@ -382,7 +384,7 @@ struct dirfile
 static unsigned long
 dirfile_hash_1 (const void *key)
 {
-  return_ISTRING_HASH_1 (((struct dirfile const *) key)->name);
+  return strcache_hash (((struct dirfile const *) key)->name);
 }
 
 static unsigned long
@@ -426,7 +428,7 @@ find_directory (const char *name)
     name = vmsify (name,1);
 #endif
 
-  dir_key.name = name;
+  dir_key.name = strcache_add (name);
   dir_slot = (struct directory **) hash_find_slot (&directories, &dir_key);
   dir = *dir_slot;
 
@@ -616,9 +618,9 @@ dir_contents_file_exists_p (struct directory_contents *dir,
           /* Checking if the directory exists.  */
           return 1;
         }
-      dirfile_key.name = filename;
       dirfile_key.length = strlen (filename);
-      df = hash_find_item (&dir->dirfiles, &dirfile_key);
+      dirfile_key.name = strcache_find_len (filename, dirfile_key.length);
+      df = dirfile_key.name ? hash_find_item (&dir->dirfiles, &dirfile_key) : 0;
       if (df)
         return !df->impossible;
     }
@@ -690,7 +692,11 @@ dir_contents_file_exists_p (struct directory_contents *dir,
         continue;
 
       len = NAMLEN (d);
-      dirfile_key.name = d->d_name;
+#if defined(HAVE_CASE_INSENSITIVE_FS) && defined(VMS)
+      dirfile_key.name = strcache_add_len (downcase (d->d_name), len);
+#else
+      dirfile_key.name = strcache_add_len (d->d_name, len);
+#endif
       dirfile_key.length = len;
       dirfile_slot = (struct dirfile **) hash_find_slot (&dir->dirfiles, &dirfile_key);
 #ifdef WINDOWS32
@@ -702,11 +708,7 @@ dir_contents_file_exists_p (struct directory_contents *dir,
 #endif
         {
           df = xmalloc (sizeof (struct dirfile));
-#if defined(HAVE_CASE_INSENSITIVE_FS) && defined(VMS)
-          df->name = strcache_add_len (downcase (d->d_name), len);
-#else
-          df->name = strcache_add_len (d->d_name, len);
-#endif
+          df->name = dirfile_key.name;
           df->length = len;
           df->impossible = 0;
           hash_insert_at (&dir->dirfiles, df, dirfile_slot);
@@ -958,8 +960,10 @@ file_impossible_p (const char *filename)
   filename = vmsify (filename, 1);
 #endif
 
-  dirfile_key.name = filename;
   dirfile_key.length = strlen (filename);
+  dirfile_key.name = strcache_find_len (filename, dirfile_key.length);
+  if (dirfile_key.name == 0)
+    return 0;
   dirfile = hash_find_item (&dir->dirfiles, &dirfile_key);
   if (dirfile)
     return dirfile->impossible;
@@ -967,6 +971,134 @@ file_impossible_p (const char *filename)
   return 0;
 }
 
+/* Verdicts of the implicit rule search about the names of prerequisites:
+   whether the name exists (as a file make knows about, on disk, or in the
+   VPATH) or not.  Each pattern rule tried for each target asks about its
+   prerequisites, and the same names come up again and again: on the second
+   pass over the rules for a target, and for other targets built from the
+   same sources.
+
+   A name that exists stays that way.  One that doesn't might appear, so that
+   verdict is only trusted while make has entered no new files and started
+   no commands.  Failed searches for intermediate files are remembered by
+   'file_impossible', above.  */
+
+struct file_verdict
+  {
+    const char *name;           /* Name of the prerequisite.  */
+    const char *vpath;          /* Where it was found in the VPATH, or nil.  */
+    unsigned long files;        /* The number of files...  */
+    unsigned int commands;      /* ... and commands when it was missing.  */
+    char exists;                /* Nonzero if it exists.  */
+  };
+
+static struct hash_table file_verdicts;
+
+/* How many times we were asked about a name, and how many of those
+   could be answered without looking.  */
+
+static unsigned long verdict_checks = 0;
+static unsigned long verdict_hits = 0;
+
+static unsigned long
+file_verdict_hash_1 (const void *key)
+{
+  return_STRING_HASH_1 (((const struct file_verdict *) key)->name);
+}
+
+static unsigned long
+file_verdict_hash_2 (const void *key)
+{
+  return_STRING_HASH_2 (((const struct file_verdict *) key)->name);
+}
+
+static int
+file_verdict_hash_cmp (const void *x, const void *y)
+{
+  return_STRING_COMPARE (((const struct file_verdict *) x)->name,
+                         ((const struct file_verdict *) y)->name);
+}
+
+/* Return the verdict on the prerequisite FILENAME: FV_IMPOSSIBLE,
+   FV_EXISTS (then *VPATH is set to where it was found in the VPATH, or
+   nil), FV_MISSING, or FV_UNKNOWN if it must be looked for.  */
+
+int
+file_verdict_p (const char *filename, const char **vpath)
+{
+  struct file_verdict key;
+  struct file_verdict *fv;
+
+  ++verdict_checks;
+
+  if (file_impossible_p (filename))
+    {
+      ++verdict_hits;
+      return FV_IMPOSSIBLE;
+    }
+
+  if (file_verdicts.ht_vec == 0)
+    return FV_UNKNOWN;
+
+  key.name = filename;
+  fv = hash_find_item (&file_verdicts, &key);
+  if (fv == 0)
+    return FV_UNKNOWN;
+
+  if (!fv->exists
+      && (fv->files != files_entered () || fv->commands != commands_started))
+    return FV_UNKNOWN;
+
+  ++verdict_hits;
+  *vpath = fv->vpath;
+  return fv->exists ? FV_EXISTS : FV_MISSING;
+}
+
+/* Remember that FILENAME exists (found in the VPATH as VPATH, if that is
+   not nil) if EXISTS is nonzero, or that it couldn't be found.  */
+
+void
+file_verdict (const char *filename, int exists, const char *vpath)
+{
+  struct file_verdict key;
+  struct file_verdict **slot;
+  struct file_verdict *fv;
+
+  if (file_verdicts.ht_vec == 0)
+    hash_init (&file_verdicts, DIRFILE_BUCKETS, file_verdict_hash_1,
+               file_verdict_hash_2, file_verdict_hash_cmp);
+
+  key.name = filename;
+  slot = (struct file_verdict **) hash_find_slot (&file_verdicts, &key);
+  if (HASH_VACANT (*slot))
+    {
+      fv = xmalloc (sizeof (struct file_verdict));
+      fv->name = strcache_add (filename);
+      hash_insert_at (&file_verdicts, fv, slot);
+    }
+  else
+    fv = *slot;
+
+  fv->exists = exists != 0;
+  fv->vpath = vpath;
+  fv->files = files_entered ();
+  fv->commands = commands_started;
+}
+
+/* Tell how often the verdicts saved looking for a file.  */
+
+void
+print_file_verdict_stats (void)
+{
+  if (verdict_checks == 0)
+    return;
+
+  DB (DB_IMPLICIT,
+      (_("Implicit rule search: %lu of %lu prerequisite checks remembered (%lu%%).\n"),
+       verdict_hits, verdict_checks,
+       (verdict_hits * 100 + verdict_checks / 2) / verdict_checks));
+}
+
 /* Return the already allocated name in the
    directory hash table that matches DIR.  */
 
@@ -975,6 +1107,88 @@ dir_name (const char *dir)
 {
   return find_directory (dir)->name;
 }
+
+/* Read the rest of every directory we've started reading.  Afterwards no
+   directory streams are left open, so the tables can be used by forked
+   copies of make without sharing any stream positions.  */
+
+static void
+finish_directory (const void *item)
+{
+  struct directory_contents *dc = (struct directory_contents *) item;
+
+  if (dc->dirstream != 0)
+    dir_contents_file_exists_p (dc, 0);
+}
+
+void
+dir_load_all (void)
+{
+  hash_map (&directory_contents, finish_directory);
+}
+
+/* Update the tables after FILENAME in DIRNAME has been created (if EXISTS
+   is nonzero) or removed, instead of reading the directory again.  */
+
+void
+dir_note_change (const char *dirname, const char *filename, int exists)
+{
+  struct directory dir_key;
+  struct directory *dir;
+  struct directory_contents *dc;
+  struct dirfile dirfile_key;
+  struct dirfile **dirfile_slot;
+
+  /* Whatever the implicit rule search has found out may have changed.  */
+  if (file_verdicts.ht_vec != 0)
+    hash_free (&file_verdicts, 1);
+
+  /* If FILENAME is a directory we've looked at, forget about it entirely.
+     Its inode may be reused by whatever replaces it.  */
+  dir_key.name = streq (dirname, ".") ? filename
+                                      : concat (3, dirname, "/", filename);
+  dir_key.name = strcache_find_len (dir_key.name, strlen (dir_key.name));
+  dir = dir_key.name ? hash_find_item (&directories, &dir_key) : 0;
+  if (dir != 0)
+    {
+      hash_delete (&directories, dir);
+      if (dir->contents != 0)
+        hash_delete (&directory_contents, dir->contents);
+    }
+
+  dir_key.name = strcache_find_len (dirname, strlen (dirname));
+  dir = dir_key.name ? hash_find_item (&directories, &dir_key) : 0;
+  if (dir == 0 || dir->contents == 0 || dir->contents->dirfiles.ht_vec == 0)
+    return;
+  dc = dir->contents;
+
+  dirfile_key.length = strlen (filename);
+  dirfile_key.name = exists ? strcache_add_len (filename, dirfile_key.length)
+                            : strcache_find_len (filename, dirfile_key.length);
+  if (dirfile_key.name == 0)
+    return;
+  dirfile_slot = (struct dirfile **) hash_find_slot (&dc->dirfiles,
+                                                     &dirfile_key);
+  if (! HASH_VACANT (*dirfile_slot))
+    {
+      if (exists)
+        (*dirfile_slot)->impossible = 0;
+      else
+        {
+          struct dirfile *df = *dirfile_slot;
+          hash_delete_at (&dc->dirfiles, dirfile_slot);
+          free (df);
+        }
+    }
+  else if (exists)
+    {
+      struct dirfile *df = xmalloc (sizeof (struct dirfile));
+      df->name = dirfile_key.name;
+      df->length = dirfile_key.length;
+      df->impossible = 0;
+      hash_insert_at (&dc->dirfiles, df, dirfile_slot);
+    }
+}
 
 /* Print the data base of directories.  */
 
@@ -36,12 +36,13 @@ this program.  If not, see <http://www.gnu.org/licenses/>.  */
    only work on files which have not yet been snapped. */
 int snapped_deps = 0;
 
-/* Hash table of files the makefile knows how to make.  */
+/* Hash table of files the makefile knows how to make.  The names it is
+   keyed on are always in the strcache, which holds their hashes.  */
 
 static unsigned long
 file_hash_1 (const void *key)
 {
-  return_ISTRING_HASH_1 (((struct file const *) key)->hname);
+  return strcache_hash (((struct file const *) key)->hname);
 }
 
 static unsigned long
@@ -62,6 +63,9 @@ file_hash_cmp (const void *x, const void *y)
 #endif
 static struct hash_table files;
 
+/* Where the file records come from.  They are never freed.  */
+static struct objpool file_pool = OBJPOOL_INIT ("file", struct file);
+
 /* Whether or not .SECONDARY with no prerequisites was given.  */
 static int all_secondary = 0;
 
@@ -129,8 +133,10 @@ lookup_file (const char *name)
     name = "./";
 #endif
 
-  file_key.hname = name;
-  f = hash_find_item (&files, &file_key);
+  /* Every file's name is in the strcache, so a name that isn't can't be
+     a file's.  */
+  file_key.hname = strcache_find_len (name, strlen (name));
+  f = file_key.hname ? hash_find_item (&files, &file_key) : 0;
 #if defined(VMS) && !defined(WANT_CASE_SENSITIVE_TARGETS)
   if (*name != '.')
     free (lname);
@@ -139,6 +145,14 @@ lookup_file (const char *name)
   return f;
 }
 
+/* Return how many files have been entered.  */
+
+unsigned long
+files_entered (void)
+{
+  return files.ht_fill;
+}
+
 /* Look up a file record for file NAME and return it.
    Create a new record if one doesn't exist.  NAME will be stored in the
    new record so it should be constant or in the strcache etc.
@@ -171,7 +185,9 @@ enter_file (const char *name)
       name = strcache_add (lname);
       free (lname);
     }
+  else
 #endif
+    name = strcache_add (name);
 
   file_key.hname = name;
   file_slot = (struct file **) hash_find_slot (&files, &file_key);
@@ -182,7 +198,7 @@ enter_file (const char *name)
       return f;
     }
 
-  new = xcalloc (sizeof (struct file));
+  new = pool_alloc (&file_pool);
   new->name = new->hname = name;
   new->update_status = us_none;
 
@@ -217,6 +233,7 @@ rehash_file (struct file *from_file, const char *to_hname)
 
   /* If it's already that name, we're done.  */
   from_file->builtin = 0;
+  to_hname = strcache_add (to_hname);
   file_key.hname = to_hname;
   if (! file_hash_cmp (from_file, &file_key))
     return;
@@ -349,6 +366,15 @@ rename_file (struct file *from_file, const char *to_hname)
     }
 }
 
+static int
+file_name_cmp (const void *x, const void *y)
+{
+  const struct file *a = *(const struct file **) x;
+  const struct file *b = *(const struct file **) y;
+
+  return strcmp (a->name, b->name);
+}
+
 /* Remove all nonprecious intermediate files.
    If SIG is nonzero, this was caused by a fatal signal,
    meaning that a different message will be printed, and
@@ -359,6 +385,9 @@ remove_intermediates (int sig)
 {
   struct file **file_slot;
   struct file **file_end;
+  struct file **list;
+  unsigned int nremove = 0;
+  unsigned int i;
   int doneany = 0;
 
   /* If there's no way we will ever remove anything anyway, punt early.  */
@@ -368,60 +397,67 @@ remove_intermediates (int sig)
   if (sig && just_print_flag)
     return;
 
+  /* Find the files eligible for automatic deletion.  Yes, IFF: it's marked
+     intermediate, it's not secondary, it wasn't given on the command line,
+     it's either a -include makefile or it's not precious, and something
+     would have created it by now.  */
+  list = xmalloc (files.ht_fill * sizeof (struct file *));
   file_slot = (struct file **) files.ht_vec;
   file_end = file_slot + files.ht_size;
   for ( ; file_slot < file_end; file_slot++)
     if (! HASH_VACANT (*file_slot))
       {
         struct file *f = *file_slot;
-        /* Is this file eligible for automatic deletion?
-           Yes, IFF: it's marked intermediate, it's not secondary, it wasn't
-           given on the command line, and it's either a -include makefile or
-           it's not precious.  */
         if (f->intermediate && (f->dontcare || !f->precious)
-            && !f->secondary && !f->cmd_target)
-          {
-            int status;
-            if (f->update_status == us_none)
-              /* If nothing would have created this file yet,
-                 don't print an "rm" command for it.  */
-              continue;
-            if (just_print_flag)
-              status = 0;
-            else
-              {
-                status = unlink (f->name);
-                if (status < 0 && errno == ENOENT)
-                  continue;
-              }
-            if (!f->dontcare)
-              {
-                if (sig)
-                  OS (error, NILF,
-                      _("*** Deleting intermediate file '%s'"), f->name);
-                else
-                  {
-                    if (! doneany)
-                      DB (DB_BASIC, (_("Removing intermediate files...\n")));
-                    if (!silent_flag)
-                      {
-                        if (! doneany)
-                          {
-                            fputs ("rm ", stdout);
-                            doneany = 1;
-                          }
-                        else
-                          putchar (' ');
-                        fputs (f->name, stdout);
-                        fflush (stdout);
-                      }
-                  }
-                if (status < 0)
-                  perror_with_name ("unlink: ", f->name);
-              }
-          }
+            && !f->secondary && !f->cmd_target && f->update_status != us_none)
+          list[nremove++] = f;
       }
 
+  /* Remove them in name order, so that the order does not depend on where
+     the files landed in the hash table.  */
+  qsort (list, nremove, sizeof (struct file *), file_name_cmp);
+
+  for (i = 0; i < nremove; ++i)
+    {
+      struct file *f = list[i];
+      int status;
+      if (just_print_flag)
+        status = 0;
+      else
+        {
+          status = unlink (f->name);
+          if (status < 0 && errno == ENOENT)
+            continue;
+        }
+      if (!f->dontcare)
+        {
+          if (sig)
+            OS (error, NILF,
+                _("*** Deleting intermediate file '%s'"), f->name);
+          else
+            {
+              if (! doneany)
+                DB (DB_BASIC, (_("Removing intermediate files...\n")));
+              if (!silent_flag)
+                {
+                  if (! doneany)
+                    {
+                      fputs ("rm ", stdout);
+                      doneany = 1;
+                    }
+                  else
+                    putchar (' ');
+                  fputs (f->name, stdout);
+                  fflush (stdout);
+                }
+            }
+          if (status < 0)
+            perror_with_name ("unlink: ", f->name);
+        }
+    }
+
+  free (list);
+
   if (doneany && !sig)
     {
       putchar ('\n');
@@ -1038,6 +1074,14 @@ print_file (const void *item)
     print_file ((const void *) f->prev);
 }
 
+/* Call FUNC with ARG for the first entry of every file in the data base.  */
+
+void
+map_files (hash_map_arg_func_t func, void *arg)
+{
+  hash_map_arg (&files, func, arg);
+}
+
 void
 print_file_data_base (void)
 {
@@ -23,41 +23,26 @@ this program.  If not, see <http://www.gnu.org/licenses/>.  */
 
 struct file
   {
+    /* The members that update_file and friends look at for every file on
+       every pass over the goal chain come first, next to each other.  Keep
+       them together when adding members.  */
+
     const char *name;
-    const char *hname;          /* Hashed filename */
-    const char *vpath;          /* VPATH/vpath pathname */
     struct dep *deps;           /* all dependencies, including duplicates */
-    struct commands *cmds;      /* Commands to execute for this target.  */
-    const char *stem;           /* Implicit stem, if an implicit
-                                   rule has been used */
-    struct dep *also_make;      /* Targets that are made by making this.  */
-    struct file *prev;          /* Previous entry for same file name;
-                                   used when there are multiple double-colon
-                                   entries for the same file.  */
-    struct file *last;          /* Last entry for the same file name.  */
 
     /* File that this file was renamed to.  After any time that a
        file could be renamed, call 'check_renamed' (below).  */
     struct file *renamed;
 
-    /* List of variable sets used for this file.  */
-    struct variable_set_list *variables;
-
-    /* Pattern-specific variable reference for this target, or null if there
-       isn't one.  Also see the pat_searched flag, below.  */
-    struct variable_set_list *pat_variables;
-
-    /* Immediate dependent that caused this target to be remade,
-       or nil if there isn't one.  */
-    struct file *parent;
-
     /* For a double-colon entry, this is the first double-colon entry for
        the same file.  Otherwise this is null.  */
     struct file *double_colon;
 
+    struct file *prev;          /* Previous entry for same file name;
+                                   used when there are multiple double-colon
+                                   entries for the same file.  */
+    struct commands *cmds;      /* Commands to execute for this target.  */
     FILE_TIMESTAMP last_mtime;  /* File's modtime, if already known.  */
-    FILE_TIMESTAMP mtime_before_update; /* File's modtime before any updating
-                                           has been performed.  */
     int command_flags;          /* Flags OR'd in for cmds; see commands.h.  */
     enum update_status          /* Status of the last attempt to update.  */
       {
@@ -100,6 +85,33 @@ struct file
                                    considered on current scan of goal chain */
     unsigned int no_diag:1;     /* True if the file failed to update and no
                                    diagnostics has been issued (dontcare). */
+    unsigned int weighed:1;     /* Nonzero if our deps' weights include ours.  */
+    unsigned int weighing:1;    /* Nonzero while passing on our weight.  */
+
+    /* The rest are needed less often.  */
+
+    FILE_TIMESTAMP mtime_before_update; /* File's modtime before any updating
+                                           has been performed.  */
+
+    /* Immediate dependent that caused this target to be remade,
+       or nil if there isn't one.  */
+    struct file *parent;
+
+    struct dep *also_make;      /* Targets that are made by making this.  */
+    unsigned long weight;       /* Estimated time in ms from starting the
+                                   recipe until the goals are done.  */
+    const char *hname;          /* Hashed filename */
+    const char *vpath;          /* VPATH/vpath pathname */
+    const char *stem;           /* Implicit stem, if an implicit
+                                   rule has been used */
+    struct file *last;          /* Last entry for the same file name.  */
+
+    /* List of variable sets used for this file.  */
+    struct variable_set_list *variables;
+
+    /* Pattern-specific variable reference for this target, or null if there
+       isn't one.  Also see the pat_searched flag, above.  */
+    struct variable_set_list *pat_variables;
   };
 
 
@@ -108,6 +120,7 @@ extern struct file *suffix_file, *default_file;
 
 struct file *lookup_file (const char *name);
 struct file *enter_file (const char *name);
+unsigned long files_entered (void);
 struct dep *split_prereqs (char *prereqstr);
 struct dep *enter_prereqs (struct dep *prereqs, const char *stem);
 void remove_intermediates (int sig);
@@ -120,6 +133,7 @@ void init_hash_files (void);
 char *build_target_list (char *old_list);
 void print_prereqs (const struct dep *deps);
 void print_file_data_base (void);
+void map_files (hash_map_arg_func_t func, void *arg);
 
 #if FILE_TIMESTAMP_HI_RES
 # define FILE_TIMESTAMP_STAT_MODTIME(fname, st) \
@@ -176,6 +190,36 @@ FILE_TIMESTAMP f_mtime (struct file *file, int search);
 #define file_mtime_1(f, v) \
   ((f)->last_mtime == UNKNOWN_MTIME ? f_mtime ((f), v) : (f)->last_mtime)
 
+/* Modification times known to the make server (see serve.c).  */
+int serve_mtime (const char *name, FILE_TIMESTAMP *mtime);
+void serve_forget_mtime (const char *name);
+
+/* Modification times looked up ahead of time (see prefetch.c).  */
+void prefetch_mtimes (unsigned int threads);
+int prefetch_mtime (const char *name, FILE_TIMESTAMP *mtime);
+void prefetch_forget_mtime (const char *name);
+
+/* Recipe history and profiling (see history.c).  */
+struct recipe_usage;
+void history_init (const char *file);
+double history_clock (void);
+unsigned long history_cost (const struct file *file);
+void history_record (const struct file *file, double start, double end,
+                     const struct recipe_usage *usage);
+void history_save (void);
+void profile_init (const char *file, int restarted);
+void profile_close (void);
+
+/* Content hashes of targets and their prerequisites (see hashdb.c).  */
+void hashdb_init (const char *file, int contents, int recipes);
+int hashdb_unchanged (struct file *file);
+void hashdb_touch (struct file *file);
+int hashdb_recipe_changed (struct file *file);
+void hashdb_start (struct file *file);
+void hashdb_record (struct file *file, int ok);
+int hashdb_digest (const char *name, uintmax_t *digestp);
+void hashdb_save (void);
+
 /* Special timestamp values.  */
 
 /* The file's timestamp is not yet known.  */
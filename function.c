@@ -26,6 +26,10 @@ this program.  If not, see <http://www.gnu.org/licenses/>.  */
 #include "amiga.h"
 #endif
 
+#ifdef MAKE_PARALLEL_SHELL
+# include <sys/wait.h>
+#endif
+
 
 struct function_table_entry
   {
@@ -386,7 +390,7 @@ string_glob (char *line)
 
       /* Because we used PARSEFS_NOCACHE above, we have to free() NAME.  */
       free ((char *)chain->name);
-      free (chain);
+      free_ns (chain);
       chain = next;
     }
 
@@ -1406,6 +1410,11 @@ fold_newlines (char *buffer, unsigned int *length, int trim_newlines)
 
 int shell_function_pid = 0, shell_function_completed;
 
+/* The exit status of the last $(shell ...) command, or 128 plus the
+   signal number if it was killed.  */
+
+int shell_function_status;
+
 
 #ifdef WINDOWS32
 /*untested*/
@@ -1615,6 +1624,7 @@ func_shell_base (char *o, char **argv, int trim_newlines)
 }
 
 #define func_shell 0
+#define func_shell_cached 0
 
 #else
 #ifndef _AMIGA
@@ -1719,6 +1729,17 @@ func_shell_base (char *o, char **argv, int trim_newlines)
   if (pid < 0)
     perror_with_name (error_prefix, "spawn");
 # else /* ! __EMX__ */
+#  ifdef MAKE_SPAWN
+  {
+    int close_fds[2];
+
+    close_fds[0] = pipedes[0];
+    close_fds[1] = -1;
+    pid = child_spawn_job (FD_STDIN, pipedes[1], errfd, close_fds,
+                           command_argv, envp);
+  }
+  if (pid < 0)
+#  endif
   pid = fork ();
   if (pid < 0)
     perror_with_name (error_prefix, "fork");
@@ -1915,8 +1936,285 @@ func_shell_base (char *o, char **argv, int trim_newlines)
 char *
 func_shell (char *o, char **argv, const char *funcname UNUSED)
 {
+  readcache_taint ("$(shell ...)");
   return func_shell_base (o, argv, 1);
 }
+
+/* $(shell-cached COMMAND[,FILES]) is $(shell COMMAND), remembered from one
+   make to the next for as long as FILES are unchanged (see shellcache.c).  */
+
+static char *
+func_shell_cached (char *o, char **argv, const char *funcname UNUSED)
+{
+  readcache_taint ("$(shell-cached ...)");
+  return shell_cache_expand (o, argv);
+}
+
+#ifdef MAKE_PARALLEL_SHELL
+
+/* With --parallel-shell, an assignment "VAR := $(shell COMMAND)" read from
+   a makefile only starts COMMAND, and marks VAR pending.  VAR gets its
+   value when it is first looked up, so COMMAND runs alongside the rest of
+   the makefile and other such commands, up to a limit set by -j.  COMMAND
+   itself is expanded at once, as it would have been.  Commands still
+   running when all the makefiles have been read are waited for then.  */
+
+struct pending_shell
+  {
+    struct pending_shell *next;
+    struct variable *v;         /* The variable to set, or null if none.  */
+    pid_t pid;                  /* The shell running the command.  */
+    int fd;                     /* Where we read its output, or -1.  */
+  };
+
+/* The commands that are running, the oldest first.  */
+
+static struct pending_shell *pending_shells = 0;
+static struct pending_shell **pending_tail = &pending_shells;
+static unsigned int pending_count = 0;
+
+/* How many may run at once.  Below 2, none are started this way.  */
+
+static unsigned int max_pending_shells = 0;
+
+/* Wait for the command P to finish and set its variable to its output.  */
+
+static void
+finish_shell (struct pending_shell *p)
+{
+  struct pending_shell **pp;
+  unsigned int maxlen = 200;
+  unsigned int i = 0;
+  char *buffer = xmalloc (maxlen + 1);
+
+  if (p->fd >= 0)
+    {
+      pid_t pid;
+      int status;
+      int cc;
+
+      for (;; i += cc)
+        {
+          if (i == maxlen)
+            {
+              maxlen += 512;
+              buffer = xrealloc (buffer, maxlen + 1);
+            }
+
+          EINTRLOOP (cc, read (p->fd, &buffer[i], maxlen - i));
+          if (cc <= 0)
+            break;
+        }
+      close (p->fd);
+
+      /* A $(shell ...) that ran meanwhile may have reaped it; then we
+         can't tell whether it could be run.  */
+      EINTRLOOP (pid, waitpid (p->pid, &status, 0));
+      if (pid == p->pid && WIFEXITED (status) && WEXITSTATUS (status) == 127)
+        {
+          /* Most likely the exec failed, and this is its error message.  */
+          buffer[i] = '\0';
+          fputs (buffer, stderr);
+          fflush (stderr);
+          i = 0;
+        }
+    }
+
+  buffer[i] = '\0';
+  fold_newlines (buffer, &i, 1);
+
+  if (p->v)
+    {
+      free (p->v->value);
+      p->v->value = buffer;
+      p->v->pending = 0;
+    }
+  else
+    free (buffer);
+
+  for (pp = &pending_shells; *pp != p; pp = &(*pp)->next)
+    ;
+  *pp = p->next;
+  if (pending_tail == &p->next)
+    pending_tail = pp;
+  --pending_count;
+  free (p);
+}
+
+/* If VALUE, the value of a simple assignment, is nothing but a call to
+   $(shell ...), start its command and return it, for shell_defer_to.
+   Otherwise return null, and the value is expanded as usual.  */
+
+struct pending_shell *
+shell_defer (const char *value)
+{
+  struct pending_shell *p;
+  char openparen, closeparen;
+  const char *beg;
+  const char *end;
+  char *command;
+  char **command_argv;
+  char *batch_filename = NULL;
+  const char *error_prefix;
+  int errfd;
+  int pipedes[2];
+  int count = 0;
+
+  if (max_pending_shells < 2 || value[0] != '$'
+      || (value[1] != '(' && value[1] != '{')
+      || !strneq (value + 2, "shell", 5)
+      || !isblank ((unsigned char) value[7]))
+    return 0;
+
+  openparen = value[1];
+  closeparen = openparen == '(' ? ')' : '}';
+  beg = next_token (value + 7);
+  for (end = beg; *end != '\0'; ++end)
+    if (*end == openparen)
+      ++count;
+    else if (*end == closeparen && --count < 0)
+      break;
+  if (*end == '\0' || end[1] != '\0')
+    return 0;
+
+  readcache_taint ("$(shell ...)");
+
+  /* Expanding the command may finish other commands, or start some.  */
+  command = expand_argument (beg, end);
+
+  /* Make room for this one.  */
+  while (pending_count >= max_pending_shells)
+    finish_shell (pending_shells);
+
+  p = xmalloc (sizeof (struct pending_shell));
+  p->next = 0;
+  p->v = 0;
+  p->pid = 0;
+  p->fd = -1;
+  *pending_tail = p;
+  pending_tail = &p->next;
+  ++pending_count;
+
+  command_argv = construct_command_argv (command, NULL, NULL, 0,
+                                         &batch_filename);
+  free (command);
+  if (command_argv == 0)
+    return p;
+
+  if (reading_file && reading_file->filenm)
+    {
+      char *ep = alloca (strlen (reading_file->filenm)+11+4);
+      sprintf (ep, "%s:%lu: ", reading_file->filenm, reading_file->lineno);
+      error_prefix = ep;
+    }
+  else
+    error_prefix = "";
+
+  output_start ();
+
+  errfd = (output_context && output_context->err >= 0
+           ? output_context->err : FD_STDERR);
+
+  if (pipe (pipedes) < 0)
+    {
+      perror_with_name (error_prefix, "pipe");
+      free (command_argv[0]);
+      free (command_argv);
+      return p;
+    }
+
+  /* Other commands started before this one finishes mustn't hold its
+     pipe open.  */
+  CLOSE_ON_EXEC (pipedes[0]);
+  CLOSE_ON_EXEC (pipedes[1]);
+
+#ifdef MAKE_SPAWN
+  {
+    int close_fds[2];
+
+    close_fds[0] = pipedes[0];
+    close_fds[1] = -1;
+    p->pid = child_spawn_job (FD_STDIN, pipedes[1], errfd, close_fds,
+                              command_argv, environ);
+  }
+  if (p->pid < 0)
+#endif
+  p->pid = fork ();
+  if (p->pid < 0)
+    {
+      perror_with_name (error_prefix, "fork");
+      close (pipedes[0]);
+    }
+  else if (p->pid == 0)
+    {
+#ifdef SET_STACK_SIZE
+      /* Reset limits, if necessary.  */
+      if (stack_limit.rlim_cur)
+       setrlimit (RLIMIT_STACK, &stack_limit);
+#endif
+      child_execute_job (FD_STDIN, pipedes[1], errfd, command_argv, environ);
+    }
+  else
+    p->fd = pipedes[0];
+
+  close (pipedes[1]);
+  free (command_argv[0]);
+  free (command_argv);
+  return p;
+}
+
+/* Give the output of the command P to the variable V when it finishes.
+   If V is null, the assignment didn't happen, and the output is thrown
+   away.  */
+
+void
+shell_defer_to (struct pending_shell *p, struct variable *v)
+{
+  if (v == 0)
+    return;
+
+  p->v = v;
+  v->pending = 1;
+
+  /* Make reads special variables directly.  */
+  if (v->special)
+    finish_shell (p);
+}
+
+/* Wait for the command whose output is the value of V.  */
+
+void
+shell_finish_pending (struct variable *v)
+{
+  struct pending_shell *p;
+
+  for (p = pending_shells; p != 0; p = p->next)
+    if (p->v == v)
+      {
+        finish_shell (p);
+        return;
+      }
+}
+
+/* Start running the commands of up to MAX assignments at once.  */
+
+void
+parallel_shells_start (unsigned int max)
+{
+  max_pending_shells = max;
+}
+
+/* Wait for all the commands, and stop starting them.  */
+
+void
+parallel_shells_finish (void)
+{
+  while (pending_shells != 0)
+    finish_shell (pending_shells);
+  max_pending_shells = 0;
+}
+
+#endif /* MAKE_PARALLEL_SHELL */
 #endif  /* !VMS */
 
 #ifdef EXPERIMENTAL
@@ -2090,6 +2388,9 @@ func_realpath (char *o, char **argv, const char *funcname UNUSED)
   int doneany = 0;
   unsigned int len = 0;
 
+  /* The result depends on symbolic links anywhere along the path.  */
+  readcache_taint ("$(realpath ...)");
+
   while ((path = find_next_token (&p, &len)) != 0)
     {
       if (len < GET_PATH_MAX)
@@ -2134,6 +2435,8 @@ func_file (char *o, char **argv, const char *funcname UNUSED)
 {
   char *fn = argv[0];
 
+  readcache_taint ("$(file ...)");
+
   if (fn[0] == '>')
     {
       FILE *fp;
@@ -2246,6 +2549,7 @@ static struct function_table_entry function_table_init[] =
   FT_ENTRY ("patsubst",      3,  3,  1,  func_patsubst),
   FT_ENTRY ("realpath",      0,  1,  1,  func_realpath),
   FT_ENTRY ("shell",         0,  1,  1,  func_shell),
+  FT_ENTRY ("shell-cached",  1,  2,  1,  func_shell_cached),
   FT_ENTRY ("sort",          0,  1,  1,  func_sort),
   FT_ENTRY ("strip",         0,  1,  1,  func_strip),
   FT_ENTRY ("wildcard",      0,  1,  1,  func_wildcard),
@@ -122,6 +122,8 @@ func_guile (const char *funcname UNUSED, unsigned int argc UNUSED, char **argv)
 {
   static int init = 0;
 
+  readcache_taint ("$(guile ...)");
+
   if (! init)
     {
       /* Initialize the Guile interpreter.  */
@@ -22,18 +22,95 @@ this program.  If not, see <http://www.gnu.org/licenses/>.  */
 #define REALLOC(o, t, n) ((t *) xrealloc ((o), sizeof (t) * (n)))
 #define CLONE(o, t, n) ((t *) memcpy (MALLOC (t, (n)), (o), sizeof (t) * (n)))
 
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
 static void hash_rehash __P((struct hash_table* ht));
 static unsigned long round_up_2 __P((unsigned long rough));
 
-/* Implement double hashing with open addressing.  The table size is
-   always a power of two.  The secondary ('increment') hash function
-   is forced to return an odd-value, in order to be relatively prime
-   to the table size.  This guarantees that the increment can
-   potentially hit every slot in the table during collision
-   resolution.  */
+/* Implement open addressing with a byte of metadata for each slot, kept
+   in HT_CTRL alongside HT_VEC.  A full slot's byte holds seven bits of
+   its item's hash (the fingerprint); otherwise it says whether the slot
+   is empty or deleted.  The slots are probed a group of HASH_GROUP at a
+   time: the bytes of a whole group are compared with the fingerprint at
+   once (with SSE2 where we have it), and the comparison function is only
+   called for the slots whose fingerprints match.  The groups are visited
+   in triangular order, which reaches every group of a table whose size
+   is a power of two.
+
+   Only the primary hash function is used: the fingerprint and the probe
+   sequence both come from it.  The secondary one is still taken by
+   hash_init, so that its callers need not change, but never called.
+   HT_VEC is laid out as it always was, so callers may still walk it and
+   test its items with HASH_VACANT.  */
 
 void *hash_deleted_item = &hash_deleted_item;
 
+#define HASH_GROUP      16
+#define HASH_EMPTY      0x80
+#define HASH_DELETED    0xfe
+
+/* Spread the bits of a hash function's result, as they are often weak.  */
+
+static unsigned long
+hash_mix (unsigned long h)
+{
+  h ^= h >> 16;
+  h *= 0x45d9f3bUL;
+  h ^= h >> 16;
+  h *= 0x45d9f3bUL;
+  h ^= h >> 16;
+  return h;
+}
+
+#define HASH_FINGERPRINT(h)     ((unsigned char) ((h) & 0x7f))
+
+/* Return a mask with a bit set for each byte of the group at CTRL that
+   equals BYTE.  */
+
+static unsigned int
+group_match (const unsigned char *ctrl, unsigned char byte)
+{
+#ifdef __SSE2__
+  __m128i group = _mm_loadu_si128 ((const __m128i *) ctrl);
+  return _mm_movemask_epi8 (_mm_cmpeq_epi8 (group, _mm_set1_epi8 (byte)));
+#else
+  unsigned int bits = 0;
+  unsigned int i;
+  for (i = 0; i < HASH_GROUP; ++i)
+    if (ctrl[i] == byte)
+      bits |= 1U << i;
+  return bits;
+#endif
+}
+
+/* Return the index of the lowest bit set in BITS, which is not 0.  */
+
+#if defined(__GNUC__) && __GNUC__ >= 4
+# define first_bit(bits) ((unsigned int) __builtin_ctz (bits))
+#else
+static unsigned int
+first_bit (unsigned int bits)
+{
+  unsigned int i = 0;
+  while (!(bits & 1))
+    {
+      bits >>= 1;
+      ++i;
+    }
+  return i;
+}
+#endif
+
+static void
+alloc_slots (struct hash_table *ht)
+{
+  ht->ht_vec = (void**) CALLOC (struct token *, ht->ht_size);
+  ht->ht_ctrl = MALLOC (unsigned char, ht->ht_size);
+  memset (ht->ht_ctrl, HASH_EMPTY, ht->ht_size);
+}
+
 /* Force the table size to be a power of two, possibly rounding up the
    given size.  */
 
@@ -42,16 +119,12 @@ hash_init (struct hash_table *ht, unsigned long size,
            hash_func_t hash_1, hash_func_t hash_2, hash_cmp_func_t hash_cmp)
 {
   ht->ht_size = round_up_2 (size);
+  if (ht->ht_size < HASH_GROUP)
+    ht->ht_size = HASH_GROUP;
   ht->ht_empty_slots = ht->ht_size;
-  ht->ht_vec = (void**) CALLOC (struct token *, ht->ht_size);
-  if (ht->ht_vec == 0)
-    {
-      fprintf (stderr, _("can't allocate %lu bytes for hash table: memory exhausted"),
-	       ht->ht_size * (unsigned long) sizeof (struct token *));
-      exit (1);
-    }
+  alloc_slots (ht);
 
-  ht->ht_capacity = ht->ht_size - (ht->ht_size / 16); /* 93.75% loading factor */
+  ht->ht_capacity = ht->ht_size - (ht->ht_size / 8); /* 87.5% loading factor */
   ht->ht_fill = 0;
   ht->ht_collisions = 0;
   ht->ht_lookups = 0;
@@ -83,36 +156,50 @@ hash_load (struct hash_table *ht, void *item_table,
 void **
 hash_find_slot (struct hash_table *ht, const void *key)
 {
-  void **slot;
+  unsigned long hash = hash_mix ((*ht->ht_hash_1) (key));
+  unsigned char fingerprint = HASH_FINGERPRINT (hash);
+  unsigned long mask = ht->ht_size / HASH_GROUP - 1;
+  unsigned long group = (hash >> 7) & mask;
+  unsigned long step = 0;
   void **deleted_slot = 0;
-  unsigned int hash_2 = 0;
-  unsigned int hash_1 = (*ht->ht_hash_1) (key);
+  void **slot;
 
   ht->ht_lookups++;
   for (;;)
     {
-      hash_1 &= (ht->ht_size - 1);
-      slot = &ht->ht_vec[hash_1];
-
-      if (*slot == 0)
-	return (deleted_slot ? deleted_slot : slot);
-      if (*slot == hash_deleted_item)
-	{
-	  if (deleted_slot == 0)
-	    deleted_slot = slot;
-	}
-      else
-	{
-	  if (key == *slot)
-	    return slot;
-	  if ((*ht->ht_compare) (key, *slot) == 0)
-	    return slot;
-	  ht->ht_collisions++;
-	}
-      if (!hash_2)
-	  hash_2 = (*ht->ht_hash_2) (key) | 1;
-      hash_1 += hash_2;
+      unsigned long base = group * HASH_GROUP;
+      const unsigned char *ctrl = &ht->ht_ctrl[base];
+      unsigned int bits = group_match (ctrl, fingerprint);
+
+      while (bits)
+        {
+          slot = &ht->ht_vec[base + first_bit (bits)];
+          if (key == *slot || (*ht->ht_compare) (key, *slot) == 0)
+            goto found;
+          ht->ht_collisions++;
+          bits &= bits - 1;
+        }
+
+      if (deleted_slot == 0)
+        {
+          bits = group_match (ctrl, HASH_DELETED);
+          if (bits)
+            deleted_slot = &ht->ht_vec[base + first_bit (bits)];
+        }
+
+      bits = group_match (ctrl, HASH_EMPTY);
+      if (bits)
+        {
+          slot = deleted_slot ? deleted_slot
+                              : &ht->ht_vec[base + first_bit (bits)];
+          goto found;
+        }
+
+      group = (group + ++step) & mask;
     }
+
+ found:
+  return slot;
 }
 
 void *
@@ -135,13 +222,16 @@ void *
 hash_insert_at (struct hash_table *ht, const void *item, const void *slot)
 {
   const void *old_item = *(void **) slot;
+  unsigned long i = (void **) slot - ht->ht_vec;
+
   if (HASH_VACANT (old_item))
     {
       ht->ht_fill++;
-      if (old_item == 0)
+      if (ht->ht_ctrl[i] == HASH_EMPTY)
 	ht->ht_empty_slots--;
       old_item = item;
     }
+  ht->ht_ctrl[i] = HASH_FINGERPRINT (hash_mix ((*ht->ht_hash_1) (item)));
   *(void const **) slot = item;
   if (ht->ht_empty_slots < ht->ht_size - ht->ht_capacity)
     {
@@ -165,7 +255,21 @@ hash_delete_at (struct hash_table *ht, const void *slot)
   void *item = *(void **) slot;
   if (!HASH_VACANT (item))
     {
-      *(void const **) slot = hash_deleted_item;
+      unsigned long i = (void **) slot - ht->ht_vec;
+
+      /* If the slot's group has an empty slot, it has never been full,
+         so no search has gone on past it: the slot can be emptied.  */
+      if (group_match (&ht->ht_ctrl[i & ~(HASH_GROUP - 1UL)], HASH_EMPTY))
+        {
+          ht->ht_ctrl[i] = HASH_EMPTY;
+          *(void const **) slot = 0;
+          ht->ht_empty_slots++;
+        }
+      else
+        {
+          ht->ht_ctrl[i] = HASH_DELETED;
+          *(void const **) slot = hash_deleted_item;
+        }
       ht->ht_fill--;
       return item;
     }
@@ -185,6 +289,7 @@ hash_free_items (struct hash_table *ht)
 	free (item);
       *vec = 0;
     }
+  memset (ht->ht_ctrl, HASH_EMPTY, ht->ht_size);
   ht->ht_fill = 0;
   ht->ht_empty_slots = ht->ht_size;
 }
@@ -196,6 +301,7 @@ hash_delete_items (struct hash_table *ht)
   void **end = &vec[ht->ht_size];
   for (; vec < end; vec++)
     *vec = 0;
+  memset (ht->ht_ctrl, HASH_EMPTY, ht->ht_size);
   ht->ht_fill = 0;
   ht->ht_collisions = 0;
   ht->ht_lookups = 0;
@@ -214,7 +320,9 @@ hash_free (struct hash_table *ht, int free_items)
       ht->ht_empty_slots = ht->ht_size;
     }
   free (ht->ht_vec);
+  free (ht->ht_ctrl);
   ht->ht_vec = 0;
+  ht->ht_ctrl = 0;
   ht->ht_capacity = 0;
 }
 
@@ -251,26 +359,42 @@ hash_rehash (struct hash_table *ht)
 {
   unsigned long old_ht_size = ht->ht_size;
   void **old_vec = ht->ht_vec;
+  unsigned char *old_ctrl = ht->ht_ctrl;
+  unsigned long mask;
   void **ovp;
 
   if (ht->ht_fill >= ht->ht_capacity)
     {
       ht->ht_size *= 2;
-      ht->ht_capacity = ht->ht_size - (ht->ht_size >> 4);
+      ht->ht_capacity = ht->ht_size - (ht->ht_size >> 3);
     }
   ht->ht_rehashes++;
-  ht->ht_vec = (void **) CALLOC (struct token *, ht->ht_size);
+  alloc_slots (ht);
+  mask = ht->ht_size / HASH_GROUP - 1;
 
+  /* The items are all different, so each just goes in the first empty
+     slot along its probe sequence.  */
   for (ovp = old_vec; ovp < &old_vec[old_ht_size]; ovp++)
     {
       if (! HASH_VACANT (*ovp))
 	{
-	  void **slot = hash_find_slot (ht, *ovp);
-	  *slot = *ovp;
+          unsigned long hash = hash_mix ((*ht->ht_hash_1) (*ovp));
+          unsigned long group = (hash >> 7) & mask;
+          unsigned long step = 0;
+          unsigned int bits;
+
+          while (!(bits = group_match (&ht->ht_ctrl[group * HASH_GROUP],
+                                       HASH_EMPTY)))
+            group = (group + ++step) & mask;
+
+          group = group * HASH_GROUP + first_bit (bits);
+          ht->ht_ctrl[group] = HASH_FINGERPRINT (hash);
+          ht->ht_vec[group] = *ovp;
 	}
     }
   ht->ht_empty_slots = ht->ht_size - ht->ht_fill;
   free (old_vec);
+  free (old_ctrl);
 }
 
 void
@@ -328,3 +452,314 @@ round_up_2 (unsigned long n)
 
   return n + 1;
 }
+
+/* 64-bit FNV-1a.  This is not a cryptographic hash: it only has to tell
+   apart the states a single user's build tree goes through.  */
+
+uintmax_t
+fnv_add (uintmax_t h, const void *buf, size_t len)
+{
+  const unsigned char *p = buf;
+  const unsigned char *end = p + len;
+
+  for (; p < end; ++p)
+    {
+      h ^= *p;
+      h *= FNV_PRIME;
+    }
+
+  return h;
+}
+
+uintmax_t
+fnv_add_str (uintmax_t h, const char *str)
+{
+  /* Include the terminating nul so "ab" "c" differs from "a" "bc".  */
+  return fnv_add (h, str, strlen (str) + 1);
+}
+
+#ifdef BENCH
+
+/* A microbenchmark for the hash tables, built as 'hashbench' by
+   'make bench-hash'.  It reads the data base printed by 'make -p' and
+   replays the lookups make does for the names in it: the targets and
+   prerequisites in a table of files, the variables defined and referred
+   to in a table of variables, and every word in a table of strings, as
+   the strcache would.  Each name looked up is a copy, so the comparison
+   function can't stop at equal pointers.  */
+
+#include <time.h>
+
+void *
+xmalloc (unsigned int size)
+{
+  void *result = malloc (size ? size : 1);
+  if (result == 0)
+    {
+      perror ("malloc");
+      exit (1);
+    }
+  return result;
+}
+
+void *
+xcalloc (unsigned int size)
+{
+  void *result = calloc (size ? size : 1, 1);
+  if (result == 0)
+    {
+      perror ("calloc");
+      exit (1);
+    }
+  return result;
+}
+
+void *
+xrealloc (void *ptr, unsigned int size)
+{
+  void *result = ptr ? realloc (ptr, size ? size : 1) : malloc (size ? size : 1);
+  if (result == 0)
+    {
+      perror ("realloc");
+      exit (1);
+    }
+  return result;
+}
+
+static unsigned long
+bench_hash_1 (const void *key)
+{
+  return_STRING_HASH_1 ((const char *) key);
+}
+
+static unsigned long
+bench_hash_2 (const void *key)
+{
+  return_STRING_HASH_2 ((const char *) key);
+}
+
+static int
+bench_hash_cmp (const void *x, const void *y)
+{
+  return_STRING_COMPARE ((const char *) x, (const char *) y);
+}
+
+#define BENCH_FILES     0
+#define BENCH_VARIABLES 1
+#define BENCH_STRINGS   2
+#define BENCH_TABLES    3
+
+static const char *const bench_table_names[BENCH_TABLES] =
+  { "files", "variables", "strings" };
+
+/* One lookup: of NAME in table TABLE, entering it if ENTER.  */
+
+struct bench_op
+  {
+    char *name;
+    unsigned char table;
+    unsigned char enter;
+  };
+
+static struct bench_op *ops = 0;
+static unsigned long nops = 0;
+static unsigned long max_ops = 0;
+
+static void
+add_op (int table, const char *name, unsigned int len, int enter)
+{
+  struct bench_op *op;
+
+  if (len == 0)
+    return;
+
+  if (nops == max_ops)
+    {
+      max_ops = max_ops ? max_ops * 2 : 4096;
+      ops = xrealloc (ops, max_ops * sizeof (struct bench_op));
+    }
+
+  op = &ops[nops++];
+  op->name = xmalloc (len + 1);
+  memcpy (op->name, name, len);
+  op->name[len] = '\0';
+  op->table = table;
+  op->enter = enter;
+}
+
+/* Add the words of P, up to END, to the strings, and to TABLE if that is
+   not negative.  */
+
+static void
+add_words (const char *p, const char *end, int table, int enter)
+{
+  while (p < end)
+    {
+      const char *w;
+
+      while (p < end && isspace ((unsigned char) *p))
+        ++p;
+      w = p;
+      while (p < end && !isspace ((unsigned char) *p))
+        ++p;
+      if (p > w && *w != '|')
+        {
+          add_op (BENCH_STRINGS, w, p - w, 1);
+          if (table >= 0)
+            add_op (table, w, p - w, enter);
+        }
+    }
+}
+
+/* Add the variables referred to in P.  */
+
+static void
+add_references (const char *p)
+{
+  while ((p = strchr (p, '$')) != 0)
+    {
+      const char *end;
+      char close;
+
+      ++p;
+      if (*p != '(' && *p != '{')
+        continue;
+      close = *p == '(' ? ')' : '}';
+      ++p;
+      end = p;
+      while (*end != '\0' && *end != close && *end != ':'
+             && !isspace ((unsigned char) *end) && *end != '$')
+        ++end;
+      if (*end == close || *end == ':')
+        add_op (BENCH_VARIABLES, p, end - p, 0);
+    }
+}
+
+static void
+read_data_base (FILE *in)
+{
+  char line[8192];
+
+  while (fgets (line, sizeof (line), in) != 0)
+    {
+      char *p = line + strlen (line);
+      char *op;
+
+      while (p > line && (p[-1] == '\n' || p[-1] == '\r'))
+        *--p = '\0';
+
+      if (line[0] == '\0' || line[0] == '#' || line[0] == '\t')
+        {
+          if (line[0] == '\t')
+            add_references (line);
+          continue;
+        }
+
+      /* A variable: NAME = VALUE, NAME := VALUE, and so on.  */
+      op = strstr (line, " = ");
+      if (op == 0)
+        op = strstr (line, " := ");
+      if (op != 0)
+        {
+          char *name = line;
+          char *end = op;
+
+          if (strneq (name, "define ", 7))
+            name += 7;
+          if (end > name && (end[-1] == '+' || end[-1] == '?'
+                             || end[-1] == '!' || end[-1] == ':'))
+            --end;
+          add_op (BENCH_STRINGS, name, end - name, 1);
+          add_op (BENCH_VARIABLES, name, end - name, 1);
+          add_references (op);
+          continue;
+        }
+
+      /* A rule: TARGETS: PREREQUISITES.  */
+      op = strchr (line, ':');
+      if (op != 0)
+        {
+          add_words (line, op, BENCH_FILES, 1);
+          add_words (op + 1, op + strlen (op), BENCH_FILES, 1);
+          add_references (op + 1);
+        }
+    }
+}
+
+/* Replay the lookups in OPS into TABLES.  */
+
+static void
+replay (struct hash_table *tables)
+{
+  unsigned long i;
+
+  for (i = 0; i < BENCH_TABLES; ++i)
+    hash_init (&tables[i], 1000, bench_hash_1, bench_hash_2, bench_hash_cmp);
+
+  for (i = 0; i < nops; ++i)
+    {
+      struct hash_table *ht = &tables[ops[i].table];
+      void **slot = hash_find_slot (ht, ops[i].name);
+
+      if (HASH_VACANT (*slot) && ops[i].enter)
+        hash_insert_at (ht, ops[i].name, slot);
+    }
+}
+
+int
+main (int argc, char **argv)
+{
+  struct hash_table tables[BENCH_TABLES];
+  unsigned int rounds = 100;
+  unsigned int r;
+  clock_t start;
+  double secs;
+  FILE *in;
+  int i;
+
+  if (argc < 2 || argc > 3)
+    {
+      fprintf (stderr, "Usage: %s DATABASE [ROUNDS]\n", argv[0]);
+      return 2;
+    }
+
+  in = fopen (argv[1], "r");
+  if (in == 0)
+    {
+      perror (argv[1]);
+      return 1;
+    }
+  read_data_base (in);
+  fclose (in);
+
+  if (argc > 2)
+    rounds = atoi (argv[2]);
+  if (rounds == 0 || nops == 0)
+    {
+      fprintf (stderr, "%s: nothing to do\n", argv[0]);
+      return 1;
+    }
+
+  start = clock ();
+  for (r = 0; r < rounds; ++r)
+    {
+      replay (tables);
+      if (r + 1 < rounds)
+        for (i = 0; i < BENCH_TABLES; ++i)
+          hash_free (&tables[i], 0);
+    }
+  secs = (double) (clock () - start) / CLOCKS_PER_SEC;
+
+  printf ("%lu lookups, %u rounds: %.3f s, %.1f ns per lookup\n",
+          nops, rounds, secs, secs * 1e9 / ((double) nops * rounds));
+  for (i = 0; i < BENCH_TABLES; ++i)
+    {
+      printf ("%-10s ", bench_table_names[i]);
+      hash_print_stats (&tables[i], stdout);
+      putchar ('\n');
+    }
+
+  return 0;
+}
+
+#endif /* BENCH */
@@ -41,8 +41,10 @@ typedef void (*hash_map_arg_func_t) __P((void const *item, void *arg));
 struct hash_table
 {
   void **ht_vec;
+  unsigned char *ht_ctrl;	/* fingerprint or state of each slot */
   hash_func_t ht_hash_1;	/* primary hash function */
-  hash_func_t ht_hash_2;	/* secondary hash function */
+  hash_func_t ht_hash_2;	/* secondary hash function; kept for the
+				   callers of hash_init, but never used */
   hash_cmp_func_t ht_compare;	/* comparison function */
   unsigned long ht_size;	/* total number of slots (power of 2) */
   unsigned long ht_capacity;	/* usable slots, limited by loading-factor */
@@ -73,6 +75,14 @@ void hash_map_arg __P((struct hash_table *ht, hash_map_arg_func_t map, void *arg
 void hash_print_stats __P((struct hash_table *ht, FILE *out_FILE));
 void **hash_dump __P((struct hash_table *ht, void **vector_0, qsort_cmp_t compare));
 
+/* 64-bit FNV-1a digests of arbitrary data.  */
+
+#define FNV_OFFSET	((((uintmax_t) 0xcbf29ce4) << 32) | 0x84222325)
+#define FNV_PRIME	((((uintmax_t) 0x100) << 32) | 0x1b3)
+
+uintmax_t fnv_add __P((uintmax_t h, void const *buf, size_t len));
+uintmax_t fnv_add_str __P((uintmax_t h, char const *str));
+
 extern void *hash_deleted_item;
 #define HASH_VACANT(item) ((item) == 0 || (void *) (item) == hash_deleted_item)
 
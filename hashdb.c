@@ -0,0 +1,778 @@
+/* Content hashes of targets and prerequisites for GNU Make.
+Copyright (C) 2013 Free Software Foundation, Inc.
+This file is part of GNU Make.
+
+GNU Make is free software; you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation; either version 3 of the License, or (at your option) any later
+version.
+
+GNU Make is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "makeint.h"
+#include "filedef.h"
+#include "dep.h"
+#include "variable.h"
+#include "job.h"
+#include "commands.h"
+#include "debug.h"
+#include "hash.h"
+
+#include <utime.h>
+
+/* With --content-hash, make remembers for each target it makes a digest
+   of the target, of each of its prerequisites and of its expanded recipe.
+   When a prerequisite turns out to be newer than the target, the target is
+   still considered up to date if none of these have changed since.  This
+   lets a tree whose time stamps were reset by a checkout or a restore
+   from backup be built without remaking everything.
+
+   Digests of files are cached along with the time stamp and size the file
+   had when it was read, so that a file is only read again when those
+   change.
+
+   With --recipe-signatures, make remembers the signature of the recipe
+   each target was made with, and remakes the target when the signature
+   changes, even if it is newer than its prerequisites.  This needs no
+   file digests.
+
+   The database is a text file: a header line, then lines of the forms
+
+     F DIGEST MTIME MTIME_NS SIZE NAME
+     T DIGEST RECIPE NDEPS NAME
+     D DIGEST NAME
+     R RECIPE NAME
+
+   where the numbers are in hexadecimal.  An F line gives the digest of a
+   file, a T line what a target was made from, and is followed by a D line
+   for each of its prerequisites.  An R line gives just the recipe a target
+   was made with; a RECIPE of 0 means it is unknown, because the recipe
+   failed.  Anything that can't be parsed is ignored, so a damaged database
+   just makes more things out of date.  */
+
+#define HASHDB_HEADER   "# GNU make content hashes 1"
+
+/* What we know about the contents of a file.  */
+
+struct hash_file
+  {
+    const char *name;           /* Name of the file (strcache'd).  */
+    uintmax_t digest;           /* Digest of its contents...  */
+    uintmax_t mtime;            /* ... when it had this time stamp...  */
+    uintmax_t mtime_ns;
+    uintmax_t size;             /* ... and this size.  */
+    unsigned int saved:1;       /* Written to the database already.  */
+  };
+
+/* A prerequisite a target was made from.  */
+
+struct hash_dep
+  {
+    const char *name;
+    uintmax_t digest;
+  };
+
+/* What a target was made from.  */
+
+struct hash_target
+  {
+    const char *name;           /* Name of the target (strcache'd).  */
+    uintmax_t digest;           /* Digest of the target as it was made.  */
+    uintmax_t recipe;           /* Signature of the recipe that made it.  */
+    unsigned int ndeps;
+    struct hash_dep *deps;      /* Its prerequisites, in order.  */
+    uintmax_t new_recipe;       /* Signature of the recipe this time.  */
+    unsigned int have_new_recipe:1;
+    unsigned int recorded:1;    /* RECIPE describes the target...  */
+    unsigned int contents:1;    /* ... and so do the digests.  */
+    unsigned int started:1;     /* Its recipe is being run...  */
+    unsigned int hashed:1;      /* ... and DEPS are the digests for it.  */
+  };
+
+static struct hash_table hash_files;
+static struct hash_table hash_targets;
+
+/* The file we read the database from and write it back to.  */
+
+static const char *hashdb_file = 0;
+
+/* Nonzero if anything was recorded since the database was read.  */
+
+static int hashdb_changed = 0;
+
+/* Nonzero if we compare the contents of files (--content-hash), and if we
+   compare recipes of targets that are up to date (--recipe-signatures).  */
+
+static int hash_contents = 0;
+static int hash_recipes = 0;
+
+/* Both tables are keyed on the name, which comes first.  */
+
+static unsigned long
+name_hash_1 (const void *key)
+{
+  return_STRING_HASH_1 (*(const char *const *) key);
+}
+
+static unsigned long
+name_hash_2 (const void *key)
+{
+  return_STRING_HASH_2 (*(const char *const *) key);
+}
+
+static int
+name_hash_cmp (const void *x, const void *y)
+{
+  return_STRING_COMPARE (*(const char *const *) x,
+                         *(const char *const *) y);
+}
+
+/* Return the entry for NAME in TABLE, making an empty one of SIZE bytes
+   if there isn't one.  */
+
+static void *
+enter_name (struct hash_table *table, const char *name, unsigned int size)
+{
+  void **slot = hash_find_slot (table, &name);
+  const char **item = *slot;
+
+  if (HASH_VACANT (item))
+    {
+      item = xcalloc (size);
+      *item = strcache_add (name);
+      hash_insert_at (table, item, slot);
+    }
+
+  return item;
+}
+
+static void
+forget_target (struct hash_target *t)
+{
+  hash_delete (&hash_targets, t);
+  free (t->deps);
+  free (t);
+}
+
+/* Write N to FP in hexadecimal, followed by a space.  */
+
+static void
+put_hex (FILE *fp, uintmax_t n)
+{
+  char buf[sizeof (uintmax_t) * 2 + 1];
+  char *p = buf + sizeof buf - 1;
+
+  *p = '\0';
+  do
+    {
+      *--p = "0123456789abcdef"[n & 0xf];
+      n >>= 4;
+    }
+  while (n != 0);
+
+  fputs (p, fp);
+  putc (' ', fp);
+}
+
+/* Parse a hexadecimal number followed by a space at *PP, and move *PP past
+   both.  Return zero if there isn't one.  */
+
+static int
+get_hex (char **pp, uintmax_t *np)
+{
+  char *p = *pp;
+  uintmax_t n = 0;
+
+  if (!isxdigit ((unsigned char) *p))
+    return 0;
+
+  for (; isxdigit ((unsigned char) *p); ++p)
+    n = (n << 4) | (isdigit ((unsigned char) *p)
+                    ? *p - '0' : tolower ((unsigned char) *p) - 'a' + 10);
+
+  if (*p != ' ')
+    return 0;
+
+  *pp = p + 1;
+  *np = n;
+  return 1;
+}
+
+/* Read one line from FP into *BUFP, growing it as needed.
+   Return zero at EOF.  */
+
+static int
+read_line (FILE *fp, char **bufp, unsigned int *sizep)
+{
+  unsigned int len = 0;
+  int c;
+
+  while ((c = getc (fp)) != EOF && c != '\n')
+    {
+      if (len + 1 >= *sizep)
+        {
+          *sizep = *sizep ? *sizep * 2 : 200;
+          *bufp = xrealloc (*bufp, *sizep);
+        }
+      (*bufp)[len++] = c;
+    }
+
+  if (c == EOF && len == 0)
+    return 0;
+
+  if (*sizep == 0)
+    {
+      *sizep = 200;
+      *bufp = xmalloc (*sizep);
+    }
+  (*bufp)[len] = '\0';
+  return 1;
+}
+
+/* Start keeping content hashes in FILE, reading what it already holds.
+   CONTENTS and RECIPES say which of the checks above to make.  */
+
+void
+hashdb_init (const char *file, int contents, int recipes)
+{
+  FILE *fp;
+  char *buf = 0;
+  unsigned int size = 0;
+  struct hash_target *t = 0;
+  unsigned int ndeps = 0;
+
+  hash_init (&hash_files, 1000, name_hash_1, name_hash_2, name_hash_cmp);
+  hash_init (&hash_targets, 1000, name_hash_1, name_hash_2, name_hash_cmp);
+  hashdb_file = file;
+  hash_contents = contents;
+  hash_recipes = recipes;
+
+  fp = fopen (file, "r");
+  if (fp == 0)
+    {
+      if (errno != ENOENT)
+        perror_with_name (_("content hashes: "), file);
+      return;
+    }
+
+  if (!read_line (fp, &buf, &size) || !streq (buf, HASHDB_HEADER))
+    {
+      DB (DB_BASIC,
+          (_("Ignoring content hash file '%s' in an unknown format\n"), file));
+      fclose (fp);
+      free (buf);
+      return;
+    }
+
+  while (read_line (fp, &buf, &size))
+    {
+      char *p = buf + 2;
+      uintmax_t n[4];
+
+      if (buf[0] == 'D' && buf[1] == ' ' && t != 0 && get_hex (&p, &n[0]))
+        {
+          t->deps[ndeps].name = strcache_add (p);
+          t->deps[ndeps].digest = n[0];
+          if (++ndeps == t->ndeps)
+            {
+              t->recorded = t->contents = 1;
+              t = 0;
+            }
+          continue;
+        }
+
+      /* A target with missing prerequisites is no use.  */
+      if (t != 0)
+        forget_target (t);
+      t = 0;
+
+      if (buf[0] == 'F' && buf[1] == ' '
+          && get_hex (&p, &n[0]) && get_hex (&p, &n[1])
+          && get_hex (&p, &n[2]) && get_hex (&p, &n[3]) && *p != '\0')
+        {
+          struct hash_file *f = enter_name (&hash_files, p,
+                                            sizeof (struct hash_file));
+          f->digest = n[0];
+          f->mtime = n[1];
+          f->mtime_ns = n[2];
+          f->size = n[3];
+        }
+      else if (buf[0] == 'T' && buf[1] == ' '
+               && get_hex (&p, &n[0]) && get_hex (&p, &n[1])
+               && get_hex (&p, &n[2]) && *p != '\0'
+               && n[2] <= UINT_MAX / sizeof (struct hash_dep))
+        {
+          t = enter_name (&hash_targets, p, sizeof (struct hash_target));
+          free (t->deps);
+          t->digest = n[0];
+          t->recipe = n[1];
+          t->ndeps = (unsigned int) n[2];
+          t->deps = t->ndeps
+                    ? xmalloc (t->ndeps * sizeof (struct hash_dep)) : 0;
+          ndeps = 0;
+          if (t->ndeps == 0)
+            {
+              t->recorded = t->contents = 1;
+              t = 0;
+            }
+        }
+      else if (buf[0] == 'R' && buf[1] == ' '
+               && get_hex (&p, &n[0]) && *p != '\0')
+        {
+          struct hash_target *r;
+
+          r = enter_name (&hash_targets, p, sizeof (struct hash_target));
+          free (r->deps);
+          r->deps = 0;
+          r->ndeps = 0;
+          r->recipe = n[0];
+          r->recorded = 1;
+          r->contents = 0;
+        }
+    }
+
+  if (t != 0)
+    forget_target (t);
+
+  fclose (fp);
+  free (buf);
+
+  DB (DB_VERBOSE, (_("Read the content hashes of %lu targets from '%s'\n"),
+                   hash_targets.ht_fill, file));
+}
+
+/* Set *DIGESTP to the digest of the contents of the file NAME, reading it
+   only if its time stamp or size differ from when we last did.  Return
+   zero if it can't be read, or isn't a regular file.  This is also used
+   by the output cache, with or without a database.  */
+
+int
+hashdb_digest (const char *name, uintmax_t *digestp)
+{
+  struct stat st;
+  struct hash_file *f;
+  uintmax_t mtime_ns = 0;
+  uintmax_t digest;
+  FILE *fp;
+  char buf[65536];
+  size_t len;
+  int e;
+
+  EINTRLOOP (e, stat (name, &st));
+  if (e != 0 || !S_ISREG (st.st_mode))
+    return 0;
+
+  if (hash_files.ht_vec == 0)
+    hash_init (&hash_files, 1000, name_hash_1, name_hash_2, name_hash_cmp);
+
+#ifdef ST_MTIM_NSEC
+  mtime_ns = (uintmax_t) st.ST_MTIM_NSEC;
+#endif
+
+  f = enter_name (&hash_files, name, sizeof (struct hash_file));
+  if (f->mtime == (uintmax_t) st.st_mtime && f->mtime_ns == mtime_ns
+      && f->size == (uintmax_t) st.st_size && f->mtime != 0)
+    {
+      *digestp = f->digest;
+      return 1;
+    }
+
+  fp = fopen (name, "rb");
+  if (fp == 0)
+    return 0;
+
+  DB (DB_VERBOSE, (_("Computing the content hash of '%s'.\n"), name));
+
+  digest = FNV_OFFSET;
+  while ((len = fread (buf, 1, sizeof buf, fp)) > 0)
+    digest = fnv_add (digest, buf, len);
+
+  e = ferror (fp);
+  fclose (fp);
+  if (e)
+    return 0;
+
+  f->digest = digest;
+  f->mtime = (uintmax_t) st.st_mtime;
+  f->mtime_ns = mtime_ns;
+  f->size = (uintmax_t) st.st_size;
+  hashdb_changed = 1;
+
+  *digestp = digest;
+  return 1;
+}
+
+/* Return the signature of the recipe of FILE: a digest of its command
+   lines, expanded as they would be to run it.  */
+
+static uintmax_t
+recipe_signature (struct file *file)
+{
+  struct commands *cmds = file->cmds;
+  uintmax_t sig = FNV_OFFSET;
+  char *changed;
+  struct dep *d;
+  unsigned int i;
+
+  /* $? depends on which prerequisites are newer than the target, which
+     varies from one run to the next.  Compute the signature as if all of
+     them were, so that the same recipe always gets the same signature.  */
+  for (i = 0, d = file->deps; d != 0; d = d->next)
+    ++i;
+  changed = xmalloc (i + 1);
+  for (i = 0, d = file->deps; d != 0; d = d->next, ++i)
+    {
+      changed[i] = d->changed;
+      d->changed = 1;
+    }
+
+  chop_commands (cmds);
+  initialize_file_variables (file, 0);
+  set_file_variables (file);
+
+  for (i = 0; i < cmds->ncommand_lines; ++i)
+    {
+      char *line = expand_command_line (file, i);
+      sig = fnv_add_str (sig, line);
+      free (line);
+    }
+
+  for (i = 0, d = file->deps; d != 0; d = d->next, ++i)
+    d->changed = changed[i];
+  free (changed);
+
+  return sig;
+}
+
+/* Return nonzero if FILE, its prerequisites and its recipe are all the same
+   as when FILE was last made, so that it need not be made again even if
+   their time stamps say otherwise.  */
+
+int
+hashdb_unchanged (struct file *file)
+{
+  struct hash_target *t;
+  struct dep *d;
+  uintmax_t digest;
+  unsigned int i = 0;
+
+  if (!hash_contents)
+    return 0;
+
+  t = hash_find_item (&hash_targets, &file->name);
+  if (t == 0 || !t->recorded || !t->contents)
+    {
+      DB (DB_VERBOSE, (_("No content hashes recorded for '%s'.\n"),
+                       file->name));
+      return 0;
+    }
+
+  if (!hashdb_digest (file->name, &digest) || digest != t->digest)
+    {
+      DB (DB_VERBOSE, (_("Target '%s' has changed since it was made.\n"),
+                       file->name));
+      return 0;
+    }
+
+  for (d = file->deps; d != 0; d = d->next)
+    {
+      if (d->ignore_mtime)
+        continue;
+
+      if (i == t->ndeps || !streq (d->file->name, t->deps[i].name))
+        {
+          DB (DB_VERBOSE, (_("Prerequisites of '%s' have changed.\n"),
+                           file->name));
+          return 0;
+        }
+
+      if (d->file->phony || !hashdb_digest (d->file->name, &digest)
+          || digest != t->deps[i].digest)
+        {
+          DB (DB_VERBOSE,
+              (_("Contents of prerequisite '%s' of '%s' have changed.\n"),
+               d->file->name, file->name));
+          return 0;
+        }
+
+      ++i;
+    }
+
+  if (i != t->ndeps)
+    {
+      DB (DB_VERBOSE, (_("Prerequisites of '%s' have changed.\n"),
+                       file->name));
+      return 0;
+    }
+
+  if (!t->have_new_recipe)
+    {
+      t->new_recipe = recipe_signature (file);
+      t->have_new_recipe = 1;
+    }
+
+  if (t->new_recipe != t->recipe)
+    {
+      DB (DB_VERBOSE, (_("Recipe for '%s' has changed.\n"), file->name));
+      return 0;
+    }
+
+  return 1;
+}
+
+/* Give FILE, which hashdb_unchanged found needs no remaking, the current
+   time, so that the next make can tell it is up to date from the time
+   stamps alone and need not look at what it was made from again.  */
+
+void
+hashdb_touch (struct file *file)
+{
+  if (just_print_flag || question_flag || touch_flag)
+    return;
+
+#ifndef NO_ARCHIVES
+  if (ar_name (file->hname))
+    return;
+#endif
+
+  /* If we can't, it is only looked at again next time.  */
+  if (utime (file->hname, 0) != 0)
+    return;
+
+  DB (DB_VERBOSE, (_("Updated the time stamp of '%s'.\n"), file->hname));
+
+  if (file->mtime_before_update == UNKNOWN_MTIME)
+    file->mtime_before_update = file->last_mtime;
+  file->last_mtime = UNKNOWN_MTIME;
+}
+
+/* Return nonzero if the recipe of FILE has changed since FILE was made.
+   The first time we see FILE, we assume it was made with its current
+   recipe.  */
+
+int
+hashdb_recipe_changed (struct file *file)
+{
+  struct hash_target *t;
+
+  if (!hash_recipes)
+    return 0;
+
+  t = enter_name (&hash_targets, file->name, sizeof (struct hash_target));
+  if (!t->have_new_recipe)
+    {
+      t->new_recipe = recipe_signature (file);
+      t->have_new_recipe = 1;
+    }
+
+  if (!t->recorded)
+    {
+      t->recipe = t->new_recipe;
+      t->recorded = 1;
+      hashdb_changed = 1;
+    }
+
+  return t->new_recipe != t->recipe;
+}
+
+/* Note that the recipe for FILE is about to be run, and take the digests
+   of what it is made from.  */
+
+void
+hashdb_start (struct file *file)
+{
+  struct hash_target *t;
+  struct dep *d;
+  unsigned int ndeps;
+
+  /* Double-colon rules share their target's name, so we can't tell them
+     apart in the database.  */
+  if (hashdb_file == 0 || file->phony || file->double_colon)
+    return;
+
+  /* Until the recipe succeeds we don't know what the target was made
+     with, which for --recipe-signatures is different from not knowing
+     anything about it.  */
+  t = enter_name (&hash_targets, file->name, sizeof (struct hash_target));
+  t->recorded = hash_recipes;
+  t->contents = 0;
+  t->recipe = 0;
+  t->started = 1;
+  t->hashed = 0;
+  hashdb_changed = 1;
+
+  if (!t->have_new_recipe)
+    {
+      t->new_recipe = recipe_signature (file);
+      t->have_new_recipe = 1;
+    }
+
+  free (t->deps);
+  t->deps = 0;
+  t->ndeps = 0;
+  if (!hash_contents)
+    return;
+
+  ndeps = 0;
+  for (d = file->deps; d != 0; d = d->next)
+    if (!d->ignore_mtime)
+      ++ndeps;
+
+  t->deps = ndeps ? xmalloc (ndeps * sizeof (struct hash_dep)) : 0;
+
+  for (d = file->deps; d != 0; d = d->next)
+    if (!d->ignore_mtime)
+      {
+        if (d->file->phony
+            || !hashdb_digest (d->file->name, &t->deps[t->ndeps].digest))
+          return;
+        t->deps[t->ndeps].name = d->file->name;
+        ++t->ndeps;
+      }
+
+  t->hashed = 1;
+}
+
+/* Note that the recipe for FILE has finished, successfully if OK is
+   nonzero.  */
+
+void
+hashdb_record (struct file *file, int ok)
+{
+  struct hash_target *t;
+
+  if (hashdb_file == 0)
+    return;
+
+  t = hash_find_item (&hash_targets, &file->name);
+  if (t == 0 || !t->started)
+    return;
+  t->started = 0;
+
+  if (!ok)
+    return;
+
+  t->recipe = t->new_recipe;
+  t->recorded = 1;
+  hashdb_changed = 1;
+
+  /* If the recipe didn't make the target, we have no digest for it.  */
+  if (t->hashed && hashdb_digest (file->name, &t->digest))
+    t->contents = 1;
+}
+
+/* Write the digest of the file NAME, if we know it, to FP.  */
+
+static void
+write_file (FILE *fp, const char *name)
+{
+  struct hash_file *f = hash_find_item (&hash_files, &name);
+
+  if (f == 0 || f->saved || f->mtime == 0)
+    return;
+  f->saved = 1;
+
+  fputs ("F ", fp);
+  put_hex (fp, f->digest);
+  put_hex (fp, f->mtime);
+  put_hex (fp, f->mtime_ns);
+  put_hex (fp, f->size);
+  fprintf (fp, "%s\n", f->name);
+}
+
+/* Write target T to FP, with the digests of the files it refers to.  Names
+   with newlines in them can't be written.  */
+
+static void
+write_target (const void *item, void *arg)
+{
+  const struct hash_target *t = item;
+  FILE *fp = arg;
+  unsigned int i;
+
+  if (!t->recorded || strchr (t->name, '\n') != 0)
+    return;
+
+  if (!t->contents)
+    {
+      fputs ("R ", fp);
+      put_hex (fp, t->recipe);
+      fprintf (fp, "%s\n", t->name);
+      return;
+    }
+
+  for (i = 0; i < t->ndeps; ++i)
+    if (strchr (t->deps[i].name, '\n') != 0)
+      return;
+
+  write_file (fp, t->name);
+  for (i = 0; i < t->ndeps; ++i)
+    write_file (fp, t->deps[i].name);
+
+  fputs ("T ", fp);
+  put_hex (fp, t->digest);
+  put_hex (fp, t->recipe);
+  put_hex (fp, t->ndeps);
+  fprintf (fp, "%s\n", t->name);
+
+  for (i = 0; i < t->ndeps; ++i)
+    {
+      fputs ("D ", fp);
+      put_hex (fp, t->deps[i].digest);
+      fprintf (fp, "%s\n", t->deps[i].name);
+    }
+}
+
+static void
+clear_saved (const void *item)
+{
+  ((struct hash_file *) item)->saved = 0;
+}
+
+/* Write the database back to its file, if anything has changed.  Only the
+   digests of files that some target refers to are kept.  */
+
+void
+hashdb_save (void)
+{
+  char *tmp;
+  FILE *fp;
+
+  if (hashdb_file == 0 || !hashdb_changed)
+    return;
+  hashdb_changed = 0;
+
+  DB (DB_BASIC, (_("Updating content hash file '%s'...\n"), hashdb_file));
+
+  /* Write to a temporary file and rename it into place, so that concurrent
+     makes never see a partially written database.  */
+  tmp = xmalloc (strlen (hashdb_file) + INTSTR_LENGTH + CSTRLEN (".tmp") + 2);
+  sprintf (tmp, "%s.%lu.tmp", hashdb_file, (unsigned long) getpid ());
+
+  fp = fopen (tmp, "w");
+  if (fp == 0)
+    perror_with_name (_("content hashes: "), tmp);
+  else
+    {
+      int ok;
+
+      fputs (HASHDB_HEADER "\n", fp);
+      hash_map_arg (&hash_targets, write_target, fp);
+      hash_map (&hash_files, clear_saved);
+      ok = !ferror (fp);
+      if (fclose (fp) != 0)
+        ok = 0;
+      if (!ok || rename (tmp, hashdb_file) != 0)
+        {
+          perror_with_name (_("content hashes: "), tmp);
+          unlink (tmp);
+        }
+    }
+
+  free (tmp);
+}
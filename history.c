@@ -0,0 +1,425 @@
+/* Recipe history and profiling for GNU Make.
+Copyright (C) 2013 Free Software Foundation, Inc.
+This file is part of GNU Make.
+
+GNU Make is free software; you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation; either version 3 of the License, or (at your option) any later
+version.
+
+GNU Make is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "makeint.h"
+#include "filedef.h"
+#include "job.h"
+#include "debug.h"
+#include "hash.h"
+
+/* The history file (--history) remembers how the recipe of each target did
+   the last time it was run: how long it took, how much CPU time it used
+   and its exit status.  The --critical-path scheduler uses the time of the
+   last successful run to tell long-running targets from quick ones before
+   they run.
+
+   It is a text file: a header line, then one line per target holding the
+   elapsed and the CPU time in milliseconds, the exit status (128 plus the
+   signal number if the recipe was killed) and the name of the target,
+   separated by single spaces.  Lines that can't be parsed are ignored, so a
+   damaged file just loses its history.  */
+
+#define HISTORY_HEADER  "# GNU make history 2"
+
+struct history
+  {
+    const char *name;           /* Name of the target (strcache'd).  */
+    unsigned long ms;           /* Elapsed time of its last good recipe.  */
+    unsigned long cpu_ms;       /* CPU time of its last recipe.  */
+    int status;                 /* Exit status of its last recipe.  */
+  };
+
+static struct hash_table history;
+
+/* The file we read the history from and write it back to.  */
+
+static const char *history_file = 0;
+
+/* Nonzero if anything was recorded since the history was read.  */
+
+static int history_changed = 0;
+
+/* The total and number of the durations we know about: targets we have no
+   history for are assumed to take the average.  */
+
+static unsigned long history_total = 0;
+static unsigned long history_count = 0;
+
+/* The trace written for --profile, whether any event has been written to
+   it yet, and the time until which each lane of the trace is busy.  */
+
+static FILE *profile_fp = 0;
+static int profile_events = 0;
+static double *profile_lanes = 0;
+static unsigned int profile_nlanes = 0;
+
+static unsigned long
+history_hash_1 (const void *key)
+{
+  return_STRING_HASH_1 (((struct history const *) key)->name);
+}
+
+static unsigned long
+history_hash_2 (const void *key)
+{
+  return_STRING_HASH_2 (((struct history const *) key)->name);
+}
+
+static int
+history_hash_cmp (const void *x, const void *y)
+{
+  return_STRING_COMPARE (((struct history const *) x)->name,
+                         ((struct history const *) y)->name);
+}
+
+/* Set the history of NAME.  A failed recipe doesn't tell us how long a
+   good one takes, so in that case we keep the old time if there is one.  */
+
+static void
+history_set (const char *name, unsigned long ms, unsigned long cpu_ms,
+             int status)
+{
+  struct history key;
+  struct history **slot;
+  struct history *h;
+
+  key.name = name;
+  slot = (struct history **) hash_find_slot (&history, &key);
+  h = *slot;
+  if (HASH_VACANT (h))
+    {
+      h = xmalloc (sizeof (struct history));
+      h->name = strcache_add (name);
+      hash_insert_at (&history, h, slot);
+      ++history_count;
+    }
+  else
+    {
+      if (status != 0)
+        ms = h->ms;
+      history_total -= h->ms;
+    }
+
+  h->ms = ms;
+  h->cpu_ms = cpu_ms;
+  h->status = status;
+  history_total += ms;
+}
+
+/* Read one line from FP into *BUFP, growing it as needed.
+   Return zero at EOF.  */
+
+static int
+read_line (FILE *fp, char **bufp, unsigned int *sizep)
+{
+  unsigned int len = 0;
+  int c;
+
+  while ((c = getc (fp)) != EOF && c != '\n')
+    {
+      if (len + 1 >= *sizep)
+        {
+          *sizep = *sizep ? *sizep * 2 : 200;
+          *bufp = xrealloc (*bufp, *sizep);
+        }
+      (*bufp)[len++] = c;
+    }
+
+  if (c == EOF && len == 0)
+    return 0;
+
+  if (*sizep == 0)
+    {
+      *sizep = 200;
+      *bufp = xmalloc (*sizep);
+    }
+  (*bufp)[len] = '\0';
+  return 1;
+}
+
+/* Parse a number followed by a space at *PP, and move *PP past both.
+   Return zero if there isn't one.  */
+
+static int
+parse_field (char **pp, unsigned long *valp)
+{
+  char *end;
+
+  *valp = strtoul (*pp, &end, 10);
+  if (end == *pp || *end != ' ')
+    return 0;
+
+  *pp = end + 1;
+  return 1;
+}
+
+/* Start keeping history in FILE, reading what it already holds.  */
+
+void
+history_init (const char *file)
+{
+  FILE *fp;
+  char *buf = 0;
+  unsigned int size = 0;
+
+  hash_init (&history, 1000, history_hash_1, history_hash_2,
+             history_hash_cmp);
+  history_file = file;
+
+  fp = fopen (file, "r");
+  if (fp == 0)
+    {
+      if (errno != ENOENT)
+        perror_with_name (_("history: "), file);
+      return;
+    }
+
+  if (read_line (fp, &buf, &size) && streq (buf, HISTORY_HEADER))
+    while (read_line (fp, &buf, &size))
+      {
+        char *p = buf;
+        unsigned long ms, cpu_ms, status;
+
+        if (parse_field (&p, &ms) && parse_field (&p, &cpu_ms)
+            && parse_field (&p, &status) && *p != '\0')
+          history_set (p, ms, cpu_ms, (int) status);
+      }
+  else
+    DB (DB_BASIC, (_("Ignoring history file '%s' in an unknown format\n"),
+                   file));
+
+  fclose (fp);
+  free (buf);
+
+  DB (DB_VERBOSE, (_("Read the history of %lu targets from '%s'\n"),
+                   history_count, file));
+}
+
+/* Return the current time in microseconds, for timing recipes.  The clock
+   doesn't need to be related to the time of day, but it must be the same
+   for a make that re-executes itself.  */
+
+double
+history_clock (void)
+{
+#if HAVE_CLOCK_GETTIME && defined CLOCK_MONOTONIC
+  struct timespec ts;
+
+  if (clock_gettime (CLOCK_MONOTONIC, &ts) == 0)
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+#endif
+#if HAVE_GETTIMEOFDAY
+  {
+    struct timeval tv;
+
+    if (gettimeofday (&tv, 0) == 0)
+      return tv.tv_sec * 1e6 + tv.tv_usec;
+  }
+#endif
+  return time (0) * 1e6;
+}
+
+/* Return the expected duration of FILE's recipe, in milliseconds.  This is
+   never zero, so that every target adds to the length of a path.  */
+
+unsigned long
+history_cost (const struct file *file)
+{
+  unsigned long ms;
+
+  if (history_count == 0)
+    return 1;
+
+  {
+    struct history key;
+    struct history *h;
+
+    key.name = file->name;
+    h = hash_find_item (&history, &key);
+    ms = h ? h->ms : history_total / history_count;
+  }
+
+  return ms ? ms : 1;
+}
+
+/* Write STR to FP as a JSON string.  */
+
+static void
+json_string (FILE *fp, const char *str)
+{
+  putc ('"', fp);
+  for (; *str != '\0'; ++str)
+    {
+      unsigned char c = *str;
+
+      if (c == '"' || c == '\\')
+        fprintf (fp, "\\%c", c);
+      else if (c < 0x20)
+        fprintf (fp, "\\u%04x", c);
+      else
+        putc (c, fp);
+    }
+  putc ('"', fp);
+}
+
+/* Add the run of the recipe for FILE from START to END to the trace.
+   Recipes that ran at the same time are put in different lanes (threads,
+   to the trace viewer), using the first lane that is free by START.  */
+
+static void
+profile_recipe (const struct file *file, double start, double end,
+                const struct recipe_usage *usage)
+{
+  unsigned int lane;
+
+  for (lane = 0; lane < profile_nlanes; ++lane)
+    if (profile_lanes[lane] <= start)
+      break;
+
+  if (lane == profile_nlanes)
+    {
+      ++profile_nlanes;
+      profile_lanes = xrealloc (profile_lanes,
+                                profile_nlanes * sizeof (double));
+    }
+  profile_lanes[lane] = end;
+
+  fputs (profile_events ? ",\n" : "\n", profile_fp);
+  profile_events = 1;
+
+  fputs ("{\"name\":", profile_fp);
+  json_string (profile_fp, file->name);
+  fprintf (profile_fp,
+           ",\"cat\":\"recipe\",\"ph\":\"X\",\"ts\":%.0f,\"dur\":%.0f,"
+           "\"pid\":%lu,\"tid\":%u,\"args\":{\"status\":%d,"
+           "\"user_ms\":%lu,\"sys_ms\":%lu,\"maxrss_kb\":%lu}}",
+           start, end - start, (unsigned long) getpid (), lane + 1,
+           usage->status, usage->user_ms, usage->sys_ms, usage->maxrss_kb);
+}
+
+/* Note that the recipe for FILE ran from START to END, as returned by
+   history_clock(), using the resources in USAGE.  */
+
+void
+history_record (const struct file *file, double start, double end,
+                const struct recipe_usage *usage)
+{
+  if (profile_fp != 0)
+    profile_recipe (file, start, end, usage);
+
+  if (history_file != 0)
+    {
+      history_set (file->name, (unsigned long) ((end - start) / 1000),
+                   usage->user_ms + usage->sys_ms, usage->status);
+      history_changed = 1;
+    }
+}
+
+static void
+write_history (const void *item, void *arg)
+{
+  const struct history *h = item;
+
+  fprintf ((FILE *) arg, "%lu %lu %d %s\n",
+           h->ms, h->cpu_ms, h->status, h->name);
+}
+
+/* Write the history back to its file, if anything has changed.  */
+
+void
+history_save (void)
+{
+  char *tmp;
+  FILE *fp;
+
+  if (profile_fp != 0)
+    fflush (profile_fp);
+
+  if (history_file == 0 || !history_changed)
+    return;
+  history_changed = 0;
+
+  DB (DB_BASIC, (_("Updating history file '%s'...\n"), history_file));
+
+  /* Write to a temporary file and rename it into place, so that concurrent
+     makes never see a partially written history.  */
+  tmp = xmalloc (strlen (history_file) + INTSTR_LENGTH + CSTRLEN (".tmp") + 2);
+  sprintf (tmp, "%s.%lu.tmp", history_file, (unsigned long) getpid ());
+
+  fp = fopen (tmp, "w");
+  if (fp == 0)
+    perror_with_name (_("history: "), tmp);
+  else
+    {
+      int ok;
+
+      fputs (HISTORY_HEADER "\n", fp);
+      hash_map_arg (&history, write_history, fp);
+      ok = !ferror (fp);
+      if (fclose (fp) != 0)
+        ok = 0;
+      if (!ok || rename (tmp, history_file) != 0)
+        {
+          perror_with_name (_("history: "), tmp);
+          unlink (tmp);
+        }
+    }
+
+  free (tmp);
+}
+
+/* Start writing a trace of the recipes that are run to FILE, in the Trace
+   Event Format read by Chrome's about:tracing and similar viewers.  If
+   RESTARTED is nonzero, a make we were re-executed from has already
+   started the trace, and we add to it.  */
+
+void
+profile_init (const char *file, int restarted)
+{
+  profile_fp = fopen (file, restarted ? "a" : "w");
+  if (profile_fp == 0)
+    {
+      perror_with_name (_("profile: "), file);
+      return;
+    }
+
+  if (restarted && fseek (profile_fp, 0, SEEK_END) == 0)
+    {
+      long pos = ftell (profile_fp);
+
+      if (pos > 0)
+        {
+          profile_events = pos > 1;
+          return;
+        }
+    }
+
+  fputc ('[', profile_fp);
+}
+
+/* Finish the trace.  */
+
+void
+profile_close (void)
+{
+  if (profile_fp == 0)
+    return;
+
+  fputs ("\n]\n", profile_fp);
+  if (fclose (profile_fp) != 0)
+    perror_with_name (_("profile: "), "fclose");
+  profile_fp = 0;
+}
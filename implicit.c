@@ -229,9 +229,13 @@ pattern_search (struct file *file, int archive,
   unsigned int stemlen = 0;
   unsigned int fullstemlen = 0;
 
+  /* The targets of pattern rules that FILENAME might match, and how many.  */
+  struct rule_target *targets;
+  unsigned int ntargets;
+  unsigned int ci;
+
   /* Buffer in which we store all the rules that are possibly applicable.  */
-  struct tryrule *tryrules = xmalloc (num_pattern_rules * max_pattern_targets
-                                      * sizeof (struct tryrule));
+  struct tryrule *tryrules;
 
   /* Number of valid elements in TRYRULES.  */
   unsigned int nrules;
@@ -291,12 +295,21 @@ pattern_search (struct file *file, int archive,
   pathlen = lastslash - filename + 1;
 
   /* First see which pattern rules match this target and may be considered.
-     Put them in TRYRULES.  */
+     Put them in TRYRULES.  Only the targets whose suffixes match the end of
+     FILENAME are looked at.  */
+
+  targets = match_pattern_rules (filename, namelen, &ntargets);
+  tryrules = xmalloc (ntargets * sizeof (struct tryrule));
 
   nrules = 0;
-  for (rule = pattern_rules; rule != 0; rule = rule->next)
+  for (ci = 0; ci < ntargets; ++ci)
     {
-      unsigned int ti;
+      unsigned int ti = targets[ci].ti;
+      const char *target;
+      const char *suffix;
+      int check_lastslash;
+
+      rule = targets[ci].rule;
 
       /* If the pattern rule has deps but no commands, ignore it.
          Users cancel built-in rules by redefining them without commands.  */
@@ -307,101 +320,99 @@ pattern_search (struct file *file, int archive,
          don't use it here.  */
       if (rule->in_use)
         {
-          DBS (DB_IMPLICIT, (_("Avoiding implicit rule recursion.\n")));
+          if (ci == 0 || targets[ci - 1].rule != rule)
+            DBS (DB_IMPLICIT, (_("Avoiding implicit rule recursion.\n")));
           continue;
         }
 
-      for (ti = 0; ti < rule->num; ++ti)
-        {
-          const char *target = rule->targets[ti];
-          const char *suffix = rule->suffixes[ti];
-          int check_lastslash;
+      target = rule->targets[ti];
+      suffix = rule->suffixes[ti];
 
-          /* Rules that can match any filename and are not terminal
-             are ignored if we're recursing, so that they cannot be
-             intermediate files.  */
-          if (recursions > 0 && target[1] == '\0' && !rule->terminal)
-            continue;
+      /* Rules that can match any filename and are not terminal
+         are ignored if we're recursing, so that they cannot be
+         intermediate files.  */
+      if (recursions > 0 && target[1] == '\0' && !rule->terminal)
+        continue;
 
-          if (rule->lens[ti] > namelen)
-            /* It can't possibly match.  */
-            continue;
+      if (rule->lens[ti] > namelen)
+        /* It can't possibly match.  */
+        continue;
 
-          /* From the lengths of the filename and the pattern parts,
-             find the stem: the part of the filename that matches the %.  */
-          stem = filename + (suffix - target - 1);
-          stemlen = namelen - rule->lens[ti] + 1;
+      /* From the lengths of the filename and the pattern parts,
+         find the stem: the part of the filename that matches the %.  */
+      stem = filename + (suffix - target - 1);
+      stemlen = namelen - rule->lens[ti] + 1;
 
-          /* Set CHECK_LASTSLASH if FILENAME contains a directory
-             prefix and the target pattern does not contain a slash.  */
+      /* Set CHECK_LASTSLASH if FILENAME contains a directory
+         prefix and the target pattern does not contain a slash.  */
 
-          check_lastslash = 0;
-          if (lastslash)
-            {
+      check_lastslash = 0;
+      if (lastslash)
+        {
 #ifdef VMS
-              check_lastslash = (strchr (target, ']') == 0
-                                 && strchr (target, ':') == 0);
+          check_lastslash = (strchr (target, ']') == 0
+                             && strchr (target, ':') == 0);
 #else
-              check_lastslash = strchr (target, '/') == 0;
+          check_lastslash = strchr (target, '/') == 0;
 #ifdef HAVE_DOS_PATHS
-              /* Didn't find it yet: check for DOS-type directories.  */
-              if (check_lastslash)
-                {
-                  char *b = strchr (target, '\\');
-                  check_lastslash = !(b || (target[0] && target[1] == ':'));
-                }
-#endif
-#endif
-            }
-          if (check_lastslash)
-            {
-              /* If so, don't include the directory prefix in STEM here.  */
-              if (pathlen > stemlen)
-                continue;
-              stemlen -= pathlen;
-              stem += pathlen;
-            }
-
-          /* Check that the rule pattern matches the text before the stem.  */
+          /* Didn't find it yet: check for DOS-type directories.  */
           if (check_lastslash)
             {
-              if (stem > (lastslash + 1)
-                  && !strneq (target, lastslash + 1, stem - lastslash - 1))
-                continue;
+              char *b = strchr (target, '\\');
+              check_lastslash = !(b || (target[0] && target[1] == ':'));
             }
-          else if (stem > filename
-                   && !strneq (target, filename, stem - filename))
+#endif
+#endif
+        }
+      if (check_lastslash)
+        {
+          /* If so, don't include the directory prefix in STEM here.  */
+          if (pathlen > stemlen)
             continue;
+          stemlen -= pathlen;
+          stem += pathlen;
+        }
 
-          /* Check that the rule pattern matches the text after the stem.
-             We could test simply use streq, but this way we compare the
-             first two characters immediately.  This saves time in the very
-             common case where the first character matches because it is a
-             period.  */
-          if (*suffix != stem[stemlen]
-              || (*suffix != '\0' && !streq (&suffix[1], &stem[stemlen + 1])))
+      /* Check that the rule pattern matches the text before the stem.  */
+      if (check_lastslash)
+        {
+          if (stem > (lastslash + 1)
+              && !strneq (target, lastslash + 1, stem - lastslash - 1))
             continue;
+        }
+      else if (stem > filename
+               && !strneq (target, filename, stem - filename))
+        continue;
 
-          /* Record if we match a rule that not all filenames will match.  */
-          if (target[1] != '\0')
-            specific_rule_matched = 1;
+      /* Check that the rule pattern matches the text after the stem.
+         We could test simply use streq, but this way we compare the
+         first two characters immediately.  This saves time in the very
+         common case where the first character matches because it is a
+         period.  */
+      if (*suffix != stem[stemlen]
+          || (*suffix != '\0' && !streq (&suffix[1], &stem[stemlen + 1])))
+        continue;
 
-          /* A rule with no dependencies and no commands exists solely to set
-             specific_rule_matched when it matches.  Don't try to use it.  */
-          if (rule->deps == 0 && rule->cmds == 0)
-            continue;
+      /* Record if we match a rule that not all filenames will match.  */
+      if (target[1] != '\0')
+        specific_rule_matched = 1;
 
-          /* Record this rule in TRYRULES and the index of the matching
-             target in MATCHES.  If several targets of the same rule match,
-             that rule will be in TRYRULES more than once.  */
-          tryrules[nrules].rule = rule;
-          tryrules[nrules].matches = ti;
-          tryrules[nrules].stemlen = stemlen + (check_lastslash ? pathlen : 0);
-          tryrules[nrules].order = nrules;
-          tryrules[nrules].checked_lastslash = check_lastslash;
-          ++nrules;
-        }
+      /* A rule with no dependencies and no commands exists solely to set
+         specific_rule_matched when it matches.  Don't try to use it.  */
+      if (rule->deps == 0 && rule->cmds == 0)
+        continue;
+
+      /* Record this rule in TRYRULES and the index of the matching
+         target in MATCHES.  If several targets of the same rule match,
+         that rule will be in TRYRULES more than once.  */
+      tryrules[nrules].rule = rule;
+      tryrules[nrules].matches = ti;
+      tryrules[nrules].stemlen = stemlen + (check_lastslash ? pathlen : 0);
+      tryrules[nrules].order = nrules;
+      tryrules[nrules].checked_lastslash = check_lastslash;
+      ++nrules;
     }
+  rule = 0;
 
   /* Bail out early if we haven't found any rules. */
   if (nrules == 0)
@@ -686,8 +697,10 @@ pattern_search (struct file *file, int archive,
                 {
                   struct dep *expl_d;
                   int is_rule = d->name == dep_name (dep);
+                  const char *vname = 0;
+                  int verdict = file_verdict_p (d->name, &vname);
 
-                  if (file_impossible_p (d->name))
+                  if (verdict == FV_IMPOSSIBLE)
                     {
                       /* If this prereq has already been ruled "impossible",
                          then the rule fails.  Don't bother trying it on the
@@ -732,28 +745,32 @@ pattern_search (struct file *file, int archive,
                      FILENAME's directory), so it might actually exist.  */
 
                   /* @@ dep->changed check is disabled. */
-                  if (lookup_file (d->name) != 0
-                      /*|| ((!dep->changed || check_lastslash) && */
-                      || file_exists_p (d->name))
+                  if (verdict == FV_UNKNOWN)
                     {
-                      (pat++)->name = d->name;
-                      continue;
+                      if (lookup_file (d->name) != 0
+                          /*|| ((!dep->changed || check_lastslash) && */
+                          || file_exists_p (d->name))
+                        verdict = FV_EXISTS;
+                      else
+                        {
+                          /* This code, given FILENAME = "lib/foo.o",
+                             dependency name "lib/foo.c", and VPATH=src,
+                             searches for "src/lib/foo.c".  */
+                          vname = vpath_search (d->name, 0, NULL, NULL);
+                          verdict = vname ? FV_EXISTS : FV_MISSING;
+                        }
+                      file_verdict (d->name, verdict == FV_EXISTS, vname);
                     }
 
-                  /* This code, given FILENAME = "lib/foo.o", dependency name
-                     "lib/foo.c", and VPATH=src, searches for
-                     "src/lib/foo.c".  */
-                  {
-                    const char *vname = vpath_search (d->name, 0, NULL, NULL);
-                    if (vname)
-                      {
+                  if (verdict == FV_EXISTS)
+                    {
+                      if (vname)
                         DBS (DB_IMPLICIT,
                              (_("Found prerequisite '%s' as VPATH '%s'\n"),
                               d->name, vname));
-                        (pat++)->name = d->name;
-                        continue;
-                      }
-                  }
+                      (pat++)->name = d->name;
+                      continue;
+                    }
 
                   /* We could not find the file in any place we should look.
                      Try to make this dependency as an intermediate file, but
@@ -991,6 +1008,7 @@ pattern_search (struct file *file, int archive,
         }
 
  done:
+  free (targets);
   free (tryrules);
   free (deplist);
 
@@ -117,6 +117,26 @@ static void vmsWaitForChildren (int *);
 # include <sys/wait.h>
 #endif
 
+#ifdef HAVE_POLL_H
+# include <poll.h>
+#endif
+
+#ifdef MAKE_EPOLL
+# include <sys/epoll.h>
+# include <sys/syscall.h>
+#endif
+
+#ifdef MAKE_SPAWN
+# include <spawn.h>
+#endif
+
+/* With wait4() we can find out what resources each child used.  */
+#if defined (HAVE_WAIT4) && defined (HAVE_SYS_RESOURCE_H) \
+    && !defined (HAVE_UNION_WAIT)
+# include <sys/resource.h>
+# define WAIT_RUSAGE 1
+#endif
+
 #ifdef HAVE_WAITPID
 # define WAIT_NOHANG(status)    waitpid (-1, (status), WNOHANG)
 #else   /* Don't have waitpid.  */
@@ -210,10 +230,15 @@ int remote_status (int *exit_code_ptr, int *signal_ptr, int *coredump_ptr,
 
 RETSIGTYPE child_handler (int);
 static void free_child (struct child *);
+static void start_new_job (struct child *c);
 static void start_job_command (struct child *child);
 static int load_too_high (void);
 static int job_next_command (struct child *);
 static int start_waiting_job (struct child *);
+#ifdef MAKE_EPOLL
+static void watch_child (struct child *c);
+static void unwatch_child (struct child *c);
+#endif
 
 /* Chain of all live (or recently deceased) children.  */
 
@@ -231,6 +256,12 @@ static int good_stdin_used = 0;
 
 static struct child *waiting_jobs = 0;
 
+/* Chain of children waiting for a job slot, heaviest first.  Only used with
+   --critical-path; see new_job().  */
+
+static struct child *ready_jobs = 0;
+static struct child *ready_tail = 0;
+
 /* Non-zero if we use a *real* shell (always so on Unix).  */
 
 int unixy_shell = 1;
@@ -541,6 +572,24 @@ child_error (struct child *child,
 
 static unsigned int dead_children = 0;
 
+#ifdef MAKE_JOBSERVER_FIFO
+/* When the jobserver uses a FIFO we wait for tokens with poll(2) instead.
+   The handler writes a byte to this pipe, so a child that dies just before
+   we start waiting still wakes us up.  */
+static int child_pipe[2] = { -1, -1 };
+#endif
+
+#ifdef MAKE_EPOLL
+/* On Linux each local child also gets a pidfd, which becomes readable
+   when it exits, and we wait for it and the jobserver FIFO together with
+   epoll(7), so that no signal is involved.  CHILD_EPOLL_FD is -1 until it
+   is first needed.  If we fail to watch any child, it is closed and
+   CHILD_EPOLL_FAILED is set, and we go back to the pipe above, which
+   child_handler always writes to.  */
+static int child_epoll_fd = -1;
+static int child_epoll_failed = 0;
+#endif
+
 RETSIGTYPE
 child_handler (int sig UNUSED)
 {
@@ -552,6 +601,18 @@ child_handler (int sig UNUSED)
       job_rfd = -1;
     }
 
+#ifdef MAKE_JOBSERVER_FIFO
+  if (child_pipe[1] >= 0)
+    {
+      int saved_errno = errno;
+      char c = '.';
+      int r;
+
+      EINTRLOOP (r, write (child_pipe[1], &c, 1));
+      errno = saved_errno;
+    }
+#endif
+
 #ifdef __EMX__
   /* The signal handler must called only once! */
   signal (SIGCHLD, SIG_DFL);
@@ -563,6 +624,28 @@ child_handler (int sig UNUSED)
 }
 
 extern int shell_function_pid, shell_function_completed;
+extern int shell_function_status;
+
+#if defined (MAKE_JOBSERVER) && !defined (WINDOWS32)
+/* Return nonzero if a command that we ran ourselves, or that a pooled shell
+   ran, has finished but not been reaped.  Nothing tells us when that
+   happens, so look before waiting for anything else.  */
+static int
+children_finished (void)
+{
+  struct child *c;
+
+  for (c = children; c != 0; c = c->next)
+    if (c->builtin)
+      return 1;
+
+#ifdef MAKE_SHELL_POOL
+  return shell_pool_ready ();
+#else
+  return 0;
+#endif
+}
+#endif
 
 /* Reap all dead children, storing the returned status and the new command
    state ('cs_finished') in the 'file' member of the 'struct child' for the
@@ -576,6 +659,9 @@ reap_children (int block, int err)
 {
 #ifndef WINDOWS32
   WAIT_T status;
+#endif
+#ifdef WAIT_RUSAGE
+  struct rusage ru;
 #endif
   /* Initially, assume we have some.  */
   int reap_more = 1;
@@ -600,7 +686,7 @@ reap_children (int block, int err)
       int remote = 0;
       pid_t pid;
       int exit_code, exit_sig, coredump;
-      struct child *lastc, *c;
+      struct child *lastc, *c, *finished;
       int child_failed;
       int any_remote, any_local;
       int dontcare;
@@ -639,8 +725,11 @@ reap_children (int block, int err)
 
       any_remote = 0;
       any_local = shell_function_pid != 0;
+      finished = 0;
       for (c = children; c != 0; c = c->next)
         {
+          if (c->builtin && finished == 0)
+            finished = c;
           any_remote |= c->remote;
           any_local |= ! c->remote;
           DB (DB_JOBS, (_("Live child %p (%s) PID %s %s\n"),
@@ -651,13 +740,30 @@ reap_children (int block, int err)
 #endif
         }
 
-      /* First, check for remote children.  */
-      if (any_remote)
+      /* First, check for commands we ran ourselves, or that a pooled shell
+         has run: they are done.  */
+      if (finished)
+        exit_code = finished->builtin_status;
+#ifdef MAKE_SHELL_POOL
+      else
+        finished = shell_pool_reap (&exit_code);
+#endif
+      if (finished)
+        {
+          pid = finished->pid;
+          exit_sig = 0;
+          coredump = 0;
+        }
+      /* Then check for remote children.  */
+      else if (any_remote)
         pid = remote_status (&exit_code, &exit_sig, &coredump, 0);
       else
         pid = 0;
 
-      if (pid > 0)
+      if (finished)
+        /* There is nothing to wait for.  */
+        ;
+      else if (pid > 0)
         /* We got a remote child.  */
         remote = 1;
       else if (pid < 0)
@@ -675,13 +781,46 @@ reap_children (int block, int err)
 #ifdef VMS
               vmsWaitForChildren (&status);
               pid = c->pid;
+#else
+              int nohang = !block;
+#ifdef MAKE_SHELL_POOL
+              sigset_t chld_set, old_set;
+
+              /* Pooled shells don't exit when they finish a command, so
+                 while they are running one, wait for the SIGCHLD they send
+                 instead of blocking in wait().  */
+              if (block && shell_pool_busy ())
+                {
+                  sigemptyset (&chld_set);
+                  sigaddset (&chld_set, SIGCHLD);
+                  sigprocmask (SIG_BLOCK, &chld_set, &old_set);
+                  nohang = 1;
+                }
+#endif
+#ifdef WAIT_RUSAGE
+              if (nohang)
+                pid = wait4 (-1, &status, WNOHANG, &ru);
+              else
+                EINTRLOOP(pid, wait4 (-1, &status, 0, &ru));
 #else
 #ifdef WAIT_NOHANG
-              if (!block)
+              if (nohang)
                 pid = WAIT_NOHANG (&status);
               else
 #endif
                 EINTRLOOP(pid, wait (&status));
+#endif /* !WAIT_RUSAGE */
+#ifdef MAKE_SHELL_POOL
+              if (block && nohang)
+                {
+                  if (pid == 0 && !shell_pool_ready ())
+                    sigsuspend (&old_set);
+                  sigprocmask (SIG_SETMASK, &old_set, 0);
+                  if (pid == 0)
+                    /* Look for whatever woke us up.  */
+                    continue;
+                }
+#endif
 #endif /* !VMS */
             }
           else
@@ -699,6 +838,10 @@ reap_children (int block, int err)
               exit_sig = WIFSIGNALED (status) ? WTERMSIG (status) : 0;
               coredump = WCOREDUMP (status);
 
+#ifdef MAKE_SHELL_POOL
+              shell_pool_died (pid);
+#endif
+
               /* If we have started jobs in this second, remove one.  */
               if (job_counter)
                 --job_counter;
@@ -809,9 +952,10 @@ reap_children (int block, int err)
         }
 
       /* Check if this is the child of the 'shell' function.  */
-      if (!remote && pid == shell_function_pid)
+      if (!finished && !remote && pid == shell_function_pid)
         {
           /* It is.  Leave an indicator for the 'shell' function.  */
+          shell_function_status = exit_sig ? 128 + exit_sig : exit_code;
           if (exit_sig == 0 && exit_code == 127)
             shell_function_completed = -1;
           else
@@ -824,7 +968,8 @@ reap_children (int block, int err)
       /* Search for a child matching the deceased one.  */
       lastc = 0;
       for (c = children; c != 0; lastc = c, c = c->next)
-        if (c->pid == pid && c->remote == remote)
+        if (finished ? c == finished : (c->pid == pid && c->remote == remote
+                                        && !c->builtin))
           break;
 
       if (c == 0)
@@ -832,6 +977,24 @@ reap_children (int block, int err)
            Ignore it; it was inherited from our invoker.  */
         continue;
 
+#ifdef MAKE_EPOLL
+      unwatch_child (c);
+#endif
+
+      c->builtin = 0;
+
+#ifdef WAIT_RUSAGE
+      if (!remote && !finished)
+        {
+          c->usage.user_ms += (ru.ru_utime.tv_sec * 1000
+                               + ru.ru_utime.tv_usec / 1000);
+          c->usage.sys_ms += (ru.ru_stime.tv_sec * 1000
+                              + ru.ru_stime.tv_usec / 1000);
+          if ((unsigned long) ru.ru_maxrss > c->usage.maxrss_kb)
+            c->usage.maxrss_kb = ru.ru_maxrss;
+        }
+#endif
+
       DB (DB_JOBS, (child_failed
                     ? _("Reaping losing child %p PID %s %s\n")
                     : _("Reaping winning child %p PID %s %s\n"),
@@ -937,6 +1100,22 @@ reap_children (int block, int err)
 
       /* When we get here, all the commands for c->file are finished.  */
 
+      if (!just_print_flag)
+        {
+          if (c->file->update_status == us_success)
+            c->usage.status = 0;
+          else if (exit_sig != 0)
+            c->usage.status = 128 + exit_sig;
+          else
+            c->usage.status = exit_code ? exit_code : 1;
+
+          history_record (c->file, c->start_time, history_clock (),
+                          &c->usage);
+          hashdb_record (c->file, c->usage.status == 0);
+          if (c->usage.status == 0)
+            outcache_store (c);
+        }
+
 #ifndef NO_OUTPUT_SYNC
       /* Synchronize any remaining parallel output.  */
       output_dump (&c->output);
@@ -997,6 +1176,9 @@ static void
 free_child (struct child *child)
 {
   output_close (&child->output);
+#ifdef MAKE_EPOLL
+  unwatch_child (child);
+#endif
 
   if (!jobserver_tokens)
     ONS (fatal, NILF, "INTERNAL: Freeing child %p (%s) but no tokens left!\n",
@@ -1090,6 +1272,162 @@ RETSIGTYPE
 job_noop (int sig UNUSED)
 {
 }
+
+#ifdef MAKE_JOBSERVER_FIFO
+/* Forget about any SIGCHLD we've seen so far.  Call this before reaping
+   children, so that later deaths are noticed by jobserver_fifo_read().  */
+static void
+jobserver_fifo_reset (void)
+{
+  char buf[64];
+
+  if (child_pipe[0] < 0)
+    {
+      if (pipe (child_pipe) < 0)
+        pfatal_with_name (_("creating child pipe"));
+      CLOSE_ON_EXEC (child_pipe[0]);
+      CLOSE_ON_EXEC (child_pipe[1]);
+      fcntl (child_pipe[0], F_SETFL, O_NONBLOCK);
+      fcntl (child_pipe[1], F_SETFL, O_NONBLOCK);
+      return;
+    }
+
+  while (read (child_pipe[0], buf, sizeof buf) > 0)
+    ;
+}
+
+#ifdef MAKE_EPOLL
+/* Stop waiting for children with epoll.  */
+static void
+child_epoll_fail (const char *what)
+{
+  DB (DB_JOBS, (_("Can't watch children with epoll: %s: %s\n"),
+                what, strerror (errno)));
+  if (child_epoll_fd >= 0)
+    close (child_epoll_fd);
+  child_epoll_fd = -1;
+  child_epoll_failed = 1;
+}
+
+/* Start watching the child C, which has just been started, for its exit.  */
+static void
+watch_child (struct child *c)
+{
+  struct epoll_event ev;
+
+  c->pidfd = -1;
+  if (!job_fifo || child_epoll_failed || c->remote)
+    return;
+
+  if (child_epoll_fd < 0)
+    {
+      child_epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+      if (child_epoll_fd < 0)
+        {
+          child_epoll_fail ("epoll_create1");
+          return;
+        }
+
+      memset (&ev, '\0', sizeof ev);
+      ev.events = EPOLLIN;
+      ev.data.fd = job_fds[0];
+      if (epoll_ctl (child_epoll_fd, EPOLL_CTL_ADD, job_fds[0], &ev) < 0)
+        {
+          child_epoll_fail ("epoll_ctl");
+          return;
+        }
+    }
+
+  /* The pidfd is close-on-exec.  */
+  c->pidfd = syscall (SYS_pidfd_open, c->pid, 0);
+  if (c->pidfd < 0)
+    {
+      child_epoll_fail ("pidfd_open");
+      return;
+    }
+
+  memset (&ev, '\0', sizeof ev);
+  ev.events = EPOLLIN;
+  ev.data.fd = c->pidfd;
+  if (epoll_ctl (child_epoll_fd, EPOLL_CTL_ADD, c->pidfd, &ev) < 0)
+    child_epoll_fail ("epoll_ctl");
+}
+
+/* Stop watching the child C: it has been reaped.  Closing its pidfd
+   removes it from the epoll set.  */
+static void
+unwatch_child (struct child *c)
+{
+  if (c->pidfd >= 0)
+    close (c->pidfd);
+  c->pidfd = -1;
+}
+#endif /* MAKE_EPOLL */
+
+/* Wait until either a job token can be read from the jobserver FIFO, or a
+   child has died.  Return 1 and store the token in TOKEN if we got one.
+   Otherwise return -1 with errno set to EINTR: the caller should reap
+   children and try again.  If jobs are waiting for the load to drop, give
+   up after a second so they can be checked again.  */
+static int
+jobserver_fifo_read (char *token)
+{
+  struct pollfd fds[2];
+  int readable;
+  int r;
+
+#ifdef MAKE_EPOLL
+  /* A pooled shell that finishes a command only sends us SIGCHLD, which
+     the pipe below catches.  */
+  if (child_epoll_fd >= 0
+# ifdef MAKE_SHELL_POOL
+      && !shell_pool_busy ()
+# endif
+      )
+    {
+      struct epoll_event evs[16];
+      int i;
+
+      r = epoll_wait (child_epoll_fd, evs, 16,
+                      waiting_jobs != NULL ? 1000 : -1);
+      if (r < 0 && errno != EINTR)
+        pfatal_with_name ("epoll_wait");
+
+      readable = 0;
+      for (i = 0; i < r; ++i)
+        if (evs[i].data.fd == job_fds[0])
+          readable = 1;
+    }
+  else
+#endif
+    {
+      fds[0].fd = job_fds[0];
+      fds[0].events = POLLIN;
+      fds[1].fd = child_pipe[0];
+      fds[1].events = POLLIN;
+
+      r = poll (fds, 2, waiting_jobs != NULL ? 1000 : -1);
+      if (r < 0 && errno != EINTR)
+        pfatal_with_name ("poll");
+
+      readable = r > 0 && fds[0].revents;
+    }
+
+  if (readable)
+    {
+      /* Someone else may have taken the token first.  */
+      EINTRLOOP (r, read (job_fds[0], token, 1));
+      if (r == 1)
+        return 1;
+      if (r < 0 && errno != EAGAIN)
+        return -1;
+    }
+
+  errno = EINTR;
+  return -1;
+}
+#endif /* MAKE_JOBSERVER_FIFO */
+
 /* Set the child handler action flags to FLAGS.  */
 static void
 set_child_handler_action_flags (int set_handler, int set_alarm)
@@ -1354,6 +1692,40 @@ start_job_command (struct child *child)
   fflush (stdout);
   fflush (stderr);
 
+#if !defined(VMS) && !defined(NO_OUTPUT_SYNC)
+  /* Divert child output if output_sync in use.  */
+  if (child->output.syncout)
+    {
+      if (child->output.out >= 0)
+        outfd = child->output.out;
+      if (child->output.err >= 0)
+        errfd = child->output.err;
+    }
+#endif
+
+#ifdef MAKE_BUILTINS
+  /* With --builtin-commands, run the simplest commands ourselves.  The
+     child stays on the chain as if it were running, so that reap_children
+     deals with its exit status just as it does with others.  */
+  if (builtin_commands_flag && !child->remote)
+    {
+      int status = builtin_command (argv, outfd, errfd);
+
+      if (status >= 0)
+        {
+          free (argv[0]);
+          free (argv);
+          child->builtin = 1;
+          child->builtin_status = status;
+          child->pid = 0;
+          block_sigs ();
+          set_command_state (child->file, cs_running);
+          OUTPUT_UNSET();
+          return;
+        }
+    }
+#endif
+
 #ifndef VMS
 #if !defined(WINDOWS32) && !defined(_AMIGA) && !defined(__MSDOS__)
 
@@ -1434,6 +1806,15 @@ start_job_command (struct child *child)
 
       child->remote = 0;
 
+#ifdef MAKE_SHELL_POOL
+      /* With --shell-pool, give the command to a shell that is already
+         running, if we can.  Recursive makes need the jobserver, which the
+         pooled shells don't pass on.  */
+      if (shell_pool_flag && !(flags & COMMANDS_RECURSE)
+          && shell_pool_start (child, argv, outfd, errfd) == 0)
+        goto started;
+#endif
+
 #ifdef VMS
       if (!child_execute_job (argv, child))
         {
@@ -1446,16 +1827,6 @@ start_job_command (struct child *child)
 
       parent_environ = environ;
 
-#ifndef NO_OUTPUT_SYNC
-      /* Divert child output if output_sync in use.  */
-      if (child->output.syncout)
-        {
-          if (child->output.out >= 0)
-            outfd = child->output.out;
-          if (child->output.err >= 0)
-            errfd = child->output.err;
-        }
-#endif
 # ifdef __EMX__
       /* If we aren't running a recursive command and we have a jobserver
          pipe, close it before exec'ing.  */
@@ -1490,6 +1861,27 @@ start_job_command (struct child *child)
 
 #else  /* !__EMX__ */
 
+# ifdef MAKE_SPAWN
+      {
+        int close_fds[4];
+        int n = 0;
+
+        /* Close the same descriptors as the child does below.  */
+        if (!(flags & COMMANDS_RECURSE) && job_fds[0] >= 0)
+          {
+            close_fds[n++] = job_fds[0];
+            close_fds[n++] = job_fds[1];
+          }
+        if (job_rfd >= 0)
+          close_fds[n++] = job_rfd;
+        close_fds[n] = -1;
+
+        child->pid = child_spawn_job (child->good_stdin ? FD_STDIN : bad_stdin,
+                                      outfd, errfd, close_fds,
+                                      argv, child->environment);
+      }
+      if (child->pid < 0)
+# endif
       child->pid = fork ();
       environ = parent_environ; /* Restore value child may have clobbered.  */
       if (child->pid == 0)
@@ -1523,6 +1915,10 @@ start_job_command (struct child *child)
           goto error;
         }
 # endif  /* !__EMX__ */
+
+#ifdef MAKE_EPOLL
+      watch_child (child);
+#endif
 #endif /* !VMS */
     }
 
@@ -1637,6 +2033,9 @@ start_job_command (struct child *child)
 #endif /* WINDOWS32 */
 #endif  /* __MSDOS__ or Amiga or WINDOWS32 */
 
+#ifdef MAKE_SHELL_POOL
+ started:
+#endif
   /* Bump the number of jobs started in this second.  */
   ++job_counter;
 
@@ -1693,6 +2092,20 @@ start_waiting_job (struct child *c)
     }
 
   /* Start the first command; reap_children will run later command lines.  */
+  c->start_time = history_clock ();
+
+  /* If the output cache has the targets, there is nothing to run.  */
+  if (outcache_fetch (c))
+    {
+      ++commands_started;
+      set_command_state (f, cs_running);
+      f->update_status = us_success;
+      hashdb_record (f, 1);
+      notice_finished_file (f);
+      free_child (c);
+      return 1;
+    }
+
   start_job_command (c);
 
   switch (f->command_state)
@@ -1726,6 +2139,219 @@ start_waiting_job (struct child *c)
   return 1;
 }
 
+/* Return nonzero if jobs should wait in the ready_jobs queue.  That's only
+   worth it with --critical-path when jobs can run in parallel, but not
+   without limit.  */
+
+static int
+schedule_p (void)
+{
+  if (!critical_path_flag || not_parallel)
+    return 0;
+
+  if (job_slots != 0)
+    return job_slots > 1;
+
+#ifndef MAKE_JOBSERVER
+  return 0;
+#elif defined (WINDOWS32)
+  return has_jobserver_semaphore ();
+#else
+  return job_fds[0] >= 0;
+#endif
+}
+
+/* Return nonzero if a job could be started now without waiting.  */
+
+static int
+job_slot_free_p (void)
+{
+  if (job_slots != 0)
+    return job_slots_used < job_slots;
+
+  /* Everyone has one free token.  */
+  if (!jobserver_tokens)
+    return 1;
+
+#if defined (MAKE_JOBSERVER) && defined (HAVE_POLL_H) && !defined (WINDOWS32)
+  {
+    struct pollfd pfd;
+
+    pfd.fd = job_fds[0];
+    pfd.events = POLLIN;
+    return poll (&pfd, 1, 0) > 0;
+  }
+#else
+  return 0;
+#endif
+}
+
+/* Put child C on the ready_jobs chain.  Heavier jobs go first; jobs of the
+   same weight stay in the order they were found.  */
+
+static void
+queue_ready_job (struct child *c)
+{
+  struct child **cp;
+  unsigned long weight = c->file->weight;
+
+  if (ready_tail != 0 && ready_tail->file->weight >= weight)
+    cp = &ready_tail->next;
+  else
+    for (cp = &ready_jobs; *cp != 0; cp = &(*cp)->next)
+      if ((*cp)->file->weight < weight)
+        break;
+
+  c->next = *cp;
+  *cp = c;
+  if (c->next == 0)
+    ready_tail = c;
+
+  DB (DB_JOBS, (_("Queueing child %p (%s) with weight %lu.\n"),
+                c, c->file->name, weight));
+
+  /* As far as update_file is concerned, the commands are running.  */
+  set_command_state (c->file, cs_running);
+  ++commands_started;
+}
+
+/* Start the heaviest jobs on the ready_jobs chain, as long as there are job
+   slots free.  If BLOCK is nonzero and we use the jobserver, wait for a
+   token for the first job: other makes may give one back at any time.
+   Return nonzero if any job was started.  */
+
+int
+start_ready_jobs (int block)
+{
+  int started = 0;
+
+  while (ready_jobs != 0)
+    {
+      struct child *c = ready_jobs;
+
+      if (!job_slot_free_p () && (started || !block || job_slots != 0))
+        break;
+
+      ready_jobs = c->next;
+      if (ready_jobs == 0)
+        ready_tail = 0;
+
+      OUTPUT_SET (&c->output);
+      start_new_job (c);
+      OUTPUT_UNSET ();
+
+      started = 1;
+    }
+
+  return started;
+}
+
+/* Expand line I of the recipe of FILE, returning the result in a newly
+   allocated string.  */
+
+char *
+expand_command_line (struct file *file, unsigned int i)
+{
+  char *line = file->cmds->command_lines[i];
+  char *in, *out, *ref;
+
+  /* Collapse backslash-newline combinations that are inside variable
+     or function references.  These are left alone by the parser so
+     that they will appear in the echoing of commands (where they look
+     nice); and collapsed by construct_command_argv when it tokenizes.
+     But letting them survive inside function invocations loses because
+     we don't want the functions to see them as part of the text.  */
+
+  /* IN points to where in the line we are scanning.
+     OUT points to where in the line we are writing.
+     When we collapse a backslash-newline combination,
+     IN gets ahead of OUT.  */
+
+  in = out = line;
+  while ((ref = strchr (in, '$')) != 0)
+    {
+      ++ref;                /* Move past the $.  */
+
+      if (out != in)
+        /* Copy the text between the end of the last chunk
+           we processed (where IN points) and the new chunk
+           we are about to process (where REF points).  */
+        memmove (out, in, ref - in);
+
+      /* Move both pointers past the boring stuff.  */
+      out += ref - in;
+      in = ref;
+
+      if (*ref == '(' || *ref == '{')
+        {
+          char openparen = *ref;
+          char closeparen = openparen == '(' ? ')' : '}';
+          char *outref;
+          int count;
+          char *p;
+
+          *out++ = *in++;   /* Copy OPENPAREN.  */
+          outref = out;
+          /* IN now points past the opening paren or brace.
+             Count parens or braces until it is matched.  */
+          count = 0;
+          while (*in != '\0')
+            {
+              if (*in == closeparen && --count < 0)
+                break;
+              else if (*in == '\\' && in[1] == '\n')
+                {
+                  /* We have found a backslash-newline inside a
+                     variable or function reference.  Eat it and
+                     any following whitespace.  */
+
+                  int quoted = 0;
+                  for (p = in - 1; p > ref && *p == '\\'; --p)
+                    quoted = !quoted;
+
+                  if (quoted)
+                    /* There were two or more backslashes, so this is
+                       not really a continuation line.  We don't collapse
+                       the quoting backslashes here as is done in
+                       collapse_continuations, because the line will
+                       be collapsed again after expansion.  */
+                    *out++ = *in++;
+                  else
+                    {
+                      /* Skip the backslash, newline and
+                         any following whitespace.  */
+                      in = next_token (in + 2);
+
+                      /* Discard any preceding whitespace that has
+                         already been written to the output.  */
+                      while (out > outref
+                             && isblank ((unsigned char)out[-1]))
+                        --out;
+
+                      /* Replace it all with a single space.  */
+                      *out++ = ' ';
+                    }
+                }
+              else
+                {
+                  if (*in == openparen)
+                    ++count;
+
+                  *out++ = *in++;
+                }
+            }
+        }
+    }
+
+  /* There are no more references in this line to worry about.
+     Copy the remaining uninteresting text to the output.  */
+  if (out != in)
+    memmove (out, in, strlen (in) + 1);
+
+  /* Finally, expand the line.  */
+  return allocated_variable_expand_for_file (line, file);
+}
+
 /* Create a 'struct child' for FILE and start its commands running.  */
 
 void
@@ -1750,6 +2376,9 @@ new_job (struct file *file)
      'struct child', and add that to the chain.  */
 
   c = xcalloc (sizeof (struct child));
+#ifdef MAKE_EPOLL
+  c->pidfd = -1;
+#endif
   output_init (&c->output);
 
   c->file = file;
@@ -1765,111 +2394,31 @@ new_job (struct file *file)
   /* Expand the command lines and store the results in LINES.  */
   lines = xmalloc (cmds->ncommand_lines * sizeof (char *));
   for (i = 0; i < cmds->ncommand_lines; ++i)
-    {
-      /* Collapse backslash-newline combinations that are inside variable
-         or function references.  These are left alone by the parser so
-         that they will appear in the echoing of commands (where they look
-         nice); and collapsed by construct_command_argv when it tokenizes.
-         But letting them survive inside function invocations loses because
-         we don't want the functions to see them as part of the text.  */
-
-      char *in, *out, *ref;
-
-      /* IN points to where in the line we are scanning.
-         OUT points to where in the line we are writing.
-         When we collapse a backslash-newline combination,
-         IN gets ahead of OUT.  */
+    lines[i] = expand_command_line (file, i);
 
-      in = out = cmds->command_lines[i];
-      while ((ref = strchr (in, '$')) != 0)
-        {
-          ++ref;                /* Move past the $.  */
-
-          if (out != in)
-            /* Copy the text between the end of the last chunk
-               we processed (where IN points) and the new chunk
-               we are about to process (where REF points).  */
-            memmove (out, in, ref - in);
-
-          /* Move both pointers past the boring stuff.  */
-          out += ref - in;
-          in = ref;
-
-          if (*ref == '(' || *ref == '{')
-            {
-              char openparen = *ref;
-              char closeparen = openparen == '(' ? ')' : '}';
-              char *outref;
-              int count;
-              char *p;
-
-              *out++ = *in++;   /* Copy OPENPAREN.  */
-              outref = out;
-              /* IN now points past the opening paren or brace.
-                 Count parens or braces until it is matched.  */
-              count = 0;
-              while (*in != '\0')
-                {
-                  if (*in == closeparen && --count < 0)
-                    break;
-                  else if (*in == '\\' && in[1] == '\n')
-                    {
-                      /* We have found a backslash-newline inside a
-                         variable or function reference.  Eat it and
-                         any following whitespace.  */
-
-                      int quoted = 0;
-                      for (p = in - 1; p > ref && *p == '\\'; --p)
-                        quoted = !quoted;
-
-                      if (quoted)
-                        /* There were two or more backslashes, so this is
-                           not really a continuation line.  We don't collapse
-                           the quoting backslashes here as is done in
-                           collapse_continuations, because the line will
-                           be collapsed again after expansion.  */
-                        *out++ = *in++;
-                      else
-                        {
-                          /* Skip the backslash, newline and
-                             any following whitespace.  */
-                          in = next_token (in + 2);
-
-                          /* Discard any preceding whitespace that has
-                             already been written to the output.  */
-                          while (out > outref
-                                 && isblank ((unsigned char)out[-1]))
-                            --out;
-
-                          /* Replace it all with a single space.  */
-                          *out++ = ' ';
-                        }
-                    }
-                  else
-                    {
-                      if (*in == openparen)
-                        ++count;
+  c->command_lines = lines;
 
-                      *out++ = *in++;
-                    }
-                }
-            }
-        }
+  /* Fetch the first command line to be run.  */
+  job_next_command (c);
 
-      /* There are no more references in this line to worry about.
-         Copy the remaining uninteresting text to the output.  */
-      if (out != in)
-        memmove (out, in, strlen (in) + 1);
+  /* With --critical-path we don't wait for a job slot here.  The job is
+     queued instead, so that whenever a slot frees up it goes to the
+     heaviest job that is ready by then.  */
+  if (schedule_p ())
+    queue_ready_job (c);
+  else
+    start_new_job (c);
 
-      /* Finally, expand the line.  */
-      lines[i] = allocated_variable_expand_for_file (cmds->command_lines[i],
-                                                     file);
-    }
+  OUTPUT_UNSET ();
+}
 
-  c->command_lines = lines;
+/* Wait for a job slot for child C, then start it running.  */
 
-  /* Fetch the first command line to be run.  */
-  job_next_command (c);
+static void
+start_new_job (struct child *c)
+{
+  struct file *file = c->file;
+  struct commands *cmds = file->cmds;
 
   /* Wait for a job slot to be freed up.  If we allow an infinite number
      don't bother; also job_slots will == 0 if we're using the jobserver.  */
@@ -1934,6 +2483,13 @@ new_job (struct file *file)
            read(2) will be invoked with an invalid FD and will return
            immediately with EBADF.  */
 
+        /* With a FIFO we use poll(2) and a pipe written by the SIGCHLD
+           handler instead; see jobserver_fifo_read().  */
+#ifdef MAKE_JOBSERVER_FIFO
+        if (job_fifo)
+          jobserver_fifo_reset ();
+        else
+#endif
         /* Make sure we have a dup'd FD.  */
         if (job_rfd < 0)
           {
@@ -1959,6 +2515,14 @@ new_job (struct file *file)
         if (!children)
           O (fatal, NILF, "INTERNAL: no children as we go to sleep on read\n");
 
+#ifndef WINDOWS32
+        /* Starting the waiting jobs may have run commands that are done
+           already.  They hold tokens, and no SIGCHLD will wake us up to
+           give them back, so reap them before we go to sleep.  */
+        if (children_finished ())
+          continue;
+#endif
+
 #ifdef WINDOWS32
         /* On Windows we simply wait for the jobserver semaphore to become
          * signalled or one of our child processes to terminate.
@@ -1973,11 +2537,21 @@ new_job (struct file *file)
                  err, estr);
           }
 #else
-        /* Set interruptible system calls, and read() for a job token.  */
-        set_child_handler_action_flags (1, waiting_jobs != NULL);
-        got_token = read (job_rfd, &token, 1);
-        saved_errno = errno;
-        set_child_handler_action_flags (0, waiting_jobs != NULL);
+#ifdef MAKE_JOBSERVER_FIFO
+        if (job_fifo)
+          {
+            got_token = jobserver_fifo_read (&token);
+            saved_errno = errno;
+          }
+        else
+#endif
+          {
+            /* Set interruptible system calls, and read() for a job token.  */
+            set_child_handler_action_flags (1, waiting_jobs != NULL);
+            got_token = read (job_rfd, &token, 1);
+            saved_errno = errno;
+            set_child_handler_action_flags (0, waiting_jobs != NULL);
+          }
 #endif
 
         /* If we got one, we're done here.  */
@@ -2037,9 +2611,6 @@ new_job (struct file *file)
        Wait for the child to die, setting the state to 'cs_finished'.  */
     while (file->command_state == cs_running)
       reap_children (1, 0);
-
-  OUTPUT_UNSET ();
-  return;
 }
 
 /* Move CHILD's pointers to the next command for it to execute.
@@ -2313,6 +2884,87 @@ child_execute_job (int stdin_fd, int stdout_fd, int stderr_fd,
 }
 #endif /* !AMIGA && !__MSDOS__ && !VMS */
 #endif /* !WINDOWS32 */
+
+#ifdef MAKE_SPAWN
+/* Start a child running the command in ARGV with environment ENVP, as fork()
+   followed by child_execute_job() would, but without copying our address
+   space.  CLOSE_FDS is a list of descriptors, ended by -1, which the child
+   must not inherit.
+
+   Return the PID of the child, or -1 if it could not be started this way.
+   The caller should then fork: that includes commands which cannot be run,
+   so that they are diagnosed by exec_command() just as before.  */
+pid_t
+child_spawn_job (int stdin_fd, int stdout_fd, int stderr_fd,
+                 const int *close_fds, char **argv, char **envp)
+{
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t attr;
+  sigset_t empty;
+  char **parent_environ = environ;
+  pid_t pid = -1;
+  int r = 0;
+#ifdef SET_STACK_SIZE
+  struct rlimit rlim;
+
+  /* The child inherits our stack limit, but must run with the one we started
+     with, and posix_spawn() gives us no way to reset it in between.  If we
+     raised ours, fork instead.  */
+  if (stack_limit.rlim_cur
+      && (getrlimit (RLIMIT_STACK, &rlim) != 0
+          || rlim.rlim_cur != stack_limit.rlim_cur))
+    return -1;
+#endif
+
+  if (posix_spawn_file_actions_init (&actions) != 0)
+    return -1;
+  if (posix_spawnattr_init (&attr) != 0)
+    {
+      posix_spawn_file_actions_destroy (&actions);
+      return -1;
+    }
+
+  /* Redirect just as child_execute_job() does.  */
+  if (stdin_fd != FD_STDIN)
+    {
+      r |= posix_spawn_file_actions_adddup2 (&actions, stdin_fd, FD_STDIN);
+      r |= posix_spawn_file_actions_addclose (&actions, stdin_fd);
+    }
+
+  if (stdout_fd != FD_STDOUT)
+    r |= posix_spawn_file_actions_adddup2 (&actions, stdout_fd, FD_STDOUT);
+  if (stderr_fd != FD_STDERR)
+    r |= posix_spawn_file_actions_adddup2 (&actions, stderr_fd, FD_STDERR);
+
+  if (stdout_fd != FD_STDOUT)
+    r |= posix_spawn_file_actions_addclose (&actions, stdout_fd);
+  if (stderr_fd != FD_STDERR && stderr_fd != stdout_fd)
+    r |= posix_spawn_file_actions_addclose (&actions, stderr_fd);
+
+  for (; close_fds && *close_fds >= 0; ++close_fds)
+    r |= posix_spawn_file_actions_addclose (&actions, *close_fds);
+
+  /* The child starts with no signals blocked, as after unblock_sigs().  */
+  sigemptyset (&empty);
+  r |= posix_spawnattr_setsigmask (&attr, &empty);
+  r |= posix_spawnattr_setflags (&attr, POSIX_SPAWN_SETSIGMASK);
+
+  if (r == 0)
+    {
+      /* Search the child's PATH for the command, as execvp() does after
+         exec_command() sets environ.  */
+      environ = envp;
+      if (posix_spawnp (&pid, argv[0], &actions, &attr, argv, envp) != 0)
+        pid = -1;
+      environ = parent_environ;
+    }
+
+  posix_spawnattr_destroy (&attr);
+  posix_spawn_file_actions_destroy (&actions);
+
+  return pid;
+}
+#endif /* MAKE_SPAWN */
 
 #ifndef _AMIGA
 /* Replace the current process with one running the command in ARGV,
@@ -82,6 +82,16 @@ typedef int sync_handle_t;      /* file descriptor */
 # endif
 #endif  /* !NO_OUTPUT_SYNC */
 
+/* What running the recipe for a target took.  */
+
+struct recipe_usage
+  {
+    int status;                 /* Exit status, or 128 + signal number.  */
+    unsigned long user_ms;      /* CPU time used, in milliseconds.  */
+    unsigned long sys_ms;
+    unsigned long maxrss_kb;    /* Largest resident set size.  */
+  };
+
 /* Structure describing a running or dead child process.  */
 
 struct child
@@ -104,19 +114,50 @@ struct child
     unsigned int  command_line; /* Index into command_lines.  */
     struct output output;       /* Output for this child.  */
     pid_t         pid;          /* Child process's ID number.  */
+#ifdef MAKE_EPOLL
+    int           pidfd;        /* Becomes readable when it exits.  */
+#endif
+    double start_time;          /* When it was started; see history_clock.  */
+    struct recipe_usage usage;  /* Resources used by its commands.  */
+    uintmax_t cache_key;        /* Key of its outputs in the output cache.  */
     unsigned int  remote:1;     /* Nonzero if executing remotely.  */
     unsigned int  noerror:1;    /* Nonzero if commands contained a '-'.  */
     unsigned int  good_stdin:1; /* Nonzero if this child has a good stdin.  */
     unsigned int  deleted:1;    /* Nonzero if targets have been deleted.  */
     unsigned int  dontcare:1;   /* Saved dontcare flag.  */
+    unsigned int  cacheable:1;  /* Nonzero if CACHE_KEY is valid.  */
+    unsigned int  builtin:1;    /* Nonzero if make ran the command itself.  */
+    int builtin_status;         /* Then, the exit status of the command.  */
+#ifdef MAKE_SHELL_POOL
+    unsigned int  pooled:1;     /* Nonzero if a pooled shell runs it.  */
+#endif
   };
 
 extern struct child *children;
 
 int is_bourne_compatible_shell(const char *path);
+char *expand_command_line (struct file *file, unsigned int i);
 void new_job (struct file *file);
 void reap_children (int block, int err);
 void start_waiting_jobs (void);
+int start_ready_jobs (int block);
+
+/* Commands that make runs itself (see builtin.c).  */
+int builtin_command (char **argv, int outfd, int errfd);
+
+#ifdef MAKE_SHELL_POOL
+/* Shells that are kept running to run commands (see shellpool.c).  */
+int shell_pool_start (struct child *c, char **argv, int outfd, int errfd);
+struct child *shell_pool_reap (int *status);
+int shell_pool_ready (void);
+unsigned int shell_pool_busy (void);
+void shell_pool_died (pid_t pid);
+#endif
+
+/* The output cache (see outcache.c).  */
+void outcache_init (const char *dir);
+int outcache_fetch (struct child *c);
+void outcache_store (struct child *c);
 
 char **construct_command_argv (char *line, char **restp, struct file *file,
                                int cmd_flags, char** batch_file);
@@ -134,6 +175,10 @@ void child_execute_job (int stdin_fd, int stdout_fd, int stderr_fd,
                         char **argv, char **envp) __attribute__ ((noreturn));
 # endif
 #endif
+#ifdef MAKE_SPAWN
+pid_t child_spawn_job (int stdin_fd, int stdout_fd, int stderr_fd,
+                       const int *close_fds, char **argv, char **envp);
+#endif
 #ifdef _AMIGA
 void exec_command (char **argv) __attribute__ ((noreturn));
 #elif defined(__EMX__)
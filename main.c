@@ -241,6 +241,16 @@ char *jobserver_fds = 0;
 int job_fds[2] = { -1, -1 };
 int job_rfd = -1;
 
+/* How the jobserver passes tokens around (--jobserver-style).  */
+
+static char *jobserver_style = 0;
+
+/* Nonzero if job_fds were opened from a named FIFO rather than inherited.
+   If we created the FIFO, its name is in job_fifo_name.  */
+
+int job_fifo = 0;
+char *job_fifo_name = 0;
+
 /* Handle for the mutex used on Windows to synchronize output of our
    children under -O.  */
 
@@ -280,6 +290,39 @@ static struct stringlist *eval_strings = 0;
 /* List of strings passed as --format=<string>.  */
 static struct stringlist *format_strings = 0;
 
+/* File to keep the parsed makefiles in (--parse-cache).  */
+static char *parse_cache_file = 0;
+
+/* File to keep the durations of recipes in (--history), and to write a
+   trace of the recipes run to (--profile).  */
+static char *history_file = 0;
+static char *profile_file = 0;
+
+/* File to keep the content hashes of targets and prerequisites in
+   (--content-hash), and whether to compare the recipes of targets that are
+   up to date (--recipe-signatures).  Both use the same file.  */
+#define DEFAULT_HASHDB_FILE ".make-hashes"
+static char *content_hash_file = 0;
+static int recipe_signatures_flag = 0;
+
+/* Directory to keep the outputs of recipes in (--output-cache).  */
+static char *output_cache_dir = 0;
+
+/* Number of threads to look up the times of files with before the build
+   (--stat-threads).  */
+static unsigned int stat_threads = 0;
+static unsigned int default_stat_threads = 0;
+static unsigned int inf_stat_threads = 8;
+
+/* Sockets to serve requests on (--serve) or send our request to
+   (--connect).  */
+static char *serve_socket = 0;
+static char *connect_socket = 0;
+
+/* Nonzero if $(shell ...) commands in assignments may run in parallel
+   while the makefiles are read (--parallel-shell).  */
+static int parallel_shell_flag = 0;
+
 /* If nonzero, we should just print usage and exit.  */
 
 static int print_usage_flag = 0;
@@ -320,9 +363,19 @@ static const char *const usage[] =
     N_("\
   -B, --always-make           Unconditionally make all targets.\n"),
     N_("\
+  --builtin-commands          Run simple commands like mkdir and touch without\n\
+                              starting a process.\n"),
+    N_("\
   -C DIRECTORY, --directory=DIRECTORY\n\
                               Change to DIRECTORY before doing anything.\n"),
     N_("\
+  --critical-path             Start the jobs on the longest path to a goal first.\n"),
+    N_("\
+  --connect=SOCKET            Have the make server on SOCKET do the build.\n"),
+    N_("\
+  --content-hash[=FILE]       Don't remake targets whose prerequisites have\n\
+                              the same contents as last time.\n"),
+    N_("\
   -d                          Print lots of debugging information.\n"),
     N_("\
   --debug[=FLAGS]             Print various types of debugging information.\n"),
@@ -340,6 +393,8 @@ static const char *const usage[] =
     N_("\
   -h, --help                  Print this message and exit.\n"),
     N_("\
+  --history=FILE              Remember how long recipes take in FILE.\n"),
+    N_("\
   -i, --ignore-errors         Ignore errors from recipes.\n"),
     N_("\
   -I DIRECTORY, --include-dir=DIRECTORY\n\
@@ -347,6 +402,9 @@ static const char *const usage[] =
     N_("\
   -j [N], --jobs[=N]          Allow N jobs at once; infinite jobs with no arg.\n"),
     N_("\
+  --jobserver-style=STYLE     Share job slots with sub-makes by a 'pipe' or\n\
+                              a named 'fifo'.\n"),
+    N_("\
   -k, --keep-going            Keep going when some targets can't be made.\n"),
     N_("\
   -l [N], --load-average[=N], --max-load[=N]\n\
@@ -363,19 +421,37 @@ static const char *const usage[] =
   -O[TYPE], --output-sync[=TYPE]\n\
                               Synchronize output of parallel jobs by TYPE.\n"),
     N_("\
+  --output-cache=DIR          Reuse the outputs of recipes kept in DIR.\n"),
+    N_("\
+  --parse-cache=FILE          Reuse the parsed makefiles saved in FILE.\n"),
+    N_("\
+  --parallel-shell            Run $(shell ...) commands in assignments in\n\
+                              parallel while reading makefiles.\n"),
+    N_("\
+  --profile=FILE              Write a trace of the recipes run to FILE.\n"),
+    N_("\
   -p, --print-data-base       Print make's internal database.\n"),
     N_("\
   -q, --question              Run no recipe; exit status says if up to date.\n"),
     N_("\
+  --recipe-signatures         Remake targets whose recipes have changed.\n"),
+    N_("\
   -r, --no-builtin-rules      Disable the built-in implicit rules.\n"),
     N_("\
   -R, --no-builtin-variables  Disable the built-in variable settings.\n"),
     N_("\
   -s, --silent, --quiet       Don't echo recipes.\n"),
     N_("\
+  --serve=SOCKET              Serve builds from this make on SOCKET.\n"),
+    N_("\
+  --shell-pool                Run recipes in shells that are kept running.\n"),
+    N_("\
   -S, --no-keep-going, --stop\n\
                               Turns off -k.\n"),
     N_("\
+  --stat-threads[=N]          Look up the times of files with N threads\n\
+                              before building.\n"),
+    N_("\
   -t, --touch                 Touch targets instead of remaking them.\n"),
     N_("\
   --trace                     Print tracing information.\n"),
@@ -454,6 +530,27 @@ static const struct command_switch switches[] =
     { CHAR_MAX+6, strlist, &eval_strings, 1, 0, 0, 0, 0, "eval" },
     { CHAR_MAX+7, string, &sync_mutex, 1, 1, 0, 0, 0, "sync-mutex" },
     { CHAR_MAX+8, strlist, &format_strings, 1, 1, 0, 0, 0, "format" },
+    { CHAR_MAX+9, string, &parse_cache_file, 0, 0, 0, 0, 0, "parse-cache" },
+    { CHAR_MAX+10, string, &serve_socket, 0, 0, 0, 0, 0, "serve" },
+    { CHAR_MAX+11, string, &connect_socket, 0, 0, 0, 0, 0, "connect" },
+    { CHAR_MAX+12, string, &jobserver_style, 1, 0, 0, 0, 0,
+      "jobserver-style" },
+    { CHAR_MAX+13, flag, &critical_path_flag, 1, 1, 0, 0, 0,
+      "critical-path" },
+    { CHAR_MAX+14, string, &history_file, 0, 0, 0, 0, 0, "history" },
+    { CHAR_MAX+15, string, &profile_file, 0, 0, 0, 0, 0, "profile" },
+    { CHAR_MAX+16, string, &content_hash_file, 1, 1, 0, DEFAULT_HASHDB_FILE,
+      0, "content-hash" },
+    { CHAR_MAX+17, flag, &recipe_signatures_flag, 1, 1, 0, 0, 0,
+      "recipe-signatures" },
+    { CHAR_MAX+18, string, &output_cache_dir, 1, 1, 0, 0, 0, "output-cache" },
+    { CHAR_MAX+19, positive_int, &stat_threads, 1, 1, 0, &inf_stat_threads,
+      &default_stat_threads, "stat-threads" },
+    { CHAR_MAX+20, flag, &builtin_commands_flag, 1, 1, 0, 0, 0,
+      "builtin-commands" },
+    { CHAR_MAX+21, flag, &shell_pool_flag, 1, 1, 0, 0, 0, "shell-pool" },
+    { CHAR_MAX+22, flag, &parallel_shell_flag, 1, 1, 0, 0, 0,
+      "parallel-shell" },
     { 0, 0, 0, 0, 0, 0, 0, 0, 0 }
   };
 
@@ -542,6 +639,18 @@ int output_sync = OUTPUT_SYNC_NONE;
 
 int trace_flag = 0;
 
+/* Nonzero if the "--critical-path" option was given.  */
+
+int critical_path_flag = 0;
+
+/* Nonzero if the "--builtin-commands" option was given.  */
+
+int builtin_commands_flag = 0;
+
+/* Nonzero if the "--shell-pool" option was given.  */
+
+int shell_pool_flag = 0;
+
 /* Nonzero if we have seen the '.NOTPARALLEL' target.
    This turns off parallel builds for this invocation of make.  */
 
@@ -1025,6 +1134,85 @@ msdos_return_to_initial_directory (void)
 }
 #endif  /* __MSDOS__ */
 
+#ifdef MAKE_SERVE
+static void
+identity_add (char **bufp, unsigned int *lenp, unsigned int *sizep,
+              const char *str)
+{
+  unsigned int l = strlen (str) + 1;
+
+  if (*lenp + l > *sizep)
+    {
+      *sizep = (*lenp + l) * 2;
+      *bufp = xrealloc (*bufp, *sizep);
+    }
+  memcpy (*bufp + *lenp, str, l);
+  *lenp += l;
+}
+
+/* Return nonzero if ARG is --serve or --connect, and 2 if the socket name
+   is the next argument.  Like getopt, accept unambiguous abbreviations.  */
+
+static int
+serve_option_p (const char *arg)
+{
+  size_t n;
+
+  if (arg[0] != '-' || arg[1] != '-')
+    return 0;
+  arg += 2;
+  n = strcspn (arg, "=");
+  if (n < 3 || (!strneq (arg, "serve", n) && !strneq (arg, "connect", n)))
+    return 0;
+  return arg[n] == '=' ? 1 : 2;
+}
+
+/* Describe this invocation for a make server: a make only serves requests
+   from makes that would read the makefiles and build exactly the way it
+   would.  That's everything in ARGV but the --serve or --connect option,
+   the directories and the environment.  Returns a new buffer holding a
+   sequence of strings, and its length in *LENP.  */
+
+static char *
+serve_identity (char **argv, const char *cwd, unsigned int *lenp)
+{
+  unsigned int size = 1024;
+  char *buf = xmalloc (size);
+  char **p;
+
+  *lenp = 0;
+  identity_add (&buf, lenp, &size, version_string);
+  identity_add (&buf, lenp, &size,
+                directory_before_chdir ? directory_before_chdir : "");
+  identity_add (&buf, lenp, &size, cwd);
+
+  for (p = argv + 1; *p != 0; ++p)
+    switch (serve_option_p (*p))
+      {
+      case 2:
+        if (p[1] != 0)
+          ++p;
+        /* FALLTHROUGH */
+      case 1:
+        break;
+      default:
+        identity_add (&buf, lenp, &size, *p);
+      }
+  identity_add (&buf, lenp, &size, "");
+
+  /* Leave out the variables the shell keeps changing behind the user's
+     back, and the one used to reload the server.  */
+  for (p = environ; *p != 0; ++p)
+    if (!strneq (*p, "_=", 2)
+        && !strneq (*p, "SHLVL=", CSTRLEN ("SHLVL="))
+        && !strneq (*p, "OLDPWD=", CSTRLEN ("OLDPWD="))
+        && !strneq (*p, "MAKE_SERVE_FD=", CSTRLEN ("MAKE_SERVE_FD=")))
+      identity_add (&buf, lenp, &size, *p);
+
+  return buf;
+}
+#endif /* MAKE_SERVE */
+
 #ifdef _AMIGA
 int
 main (int argc, char **argv)
@@ -1255,6 +1443,9 @@ main (int argc, char **argv, char **envp)
 #ifdef MAKE_JOBSERVER
                            " jobserver"
 #endif
+#ifdef MAKE_JOBSERVER_FIFO
+                           " jobserver-fifo"
+#endif
 #ifndef NO_OUTPUT_SYNC
                            " output-sync"
 #endif
@@ -1266,6 +1457,9 @@ main (int argc, char **argv, char **envp)
 #endif
 #ifdef MAKE_LOAD
                            " load"
+#endif
+#ifdef MAKE_SERVE
+                           " serve"
 #endif
                            ;
 
@@ -1337,6 +1531,7 @@ main (int argc, char **argv, char **envp)
 #endif
             shell_var.name = "SHELL";
             shell_var.length = 5;
+            shell_var.hash = variable_name_hash ("SHELL", 5);
             shell_var.value = xstrdup (ep);
           }
 
@@ -1513,6 +1708,9 @@ main (int argc, char **argv, char **envp)
     {
       /* Make sure the jobserver option has the proper format.  */
       const char *cp = jobserver_fds;
+#ifdef MAKE_JOBSERVER_FIFO
+      int fifo_errno = 0;
+#endif
 
 #ifdef WINDOWS32
       if (! open_jobserver_semaphore (cp))
@@ -1525,12 +1723,32 @@ main (int argc, char **argv, char **envp)
         }
       DB (DB_JOBS, (_("Jobserver client (semaphore %s)\n"), cp));
 #else
-      if (sscanf (cp, "%d,%d", &job_fds[0], &job_fds[1]) != 2)
+      if (strneq (cp, "fifo:", CSTRLEN ("fifo:")))
+        {
+#ifdef MAKE_JOBSERVER_FIFO
+          /* Open our own descriptors, so the read side can be nonblocking
+             without affecting anyone else.  A writer is guaranteed to exist
+             by the time the read side is open.  */
+          cp += CSTRLEN ("fifo:");
+          job_fifo = 1;
+          EINTRLOOP (job_fds[0], open (cp, O_RDONLY | O_NONBLOCK));
+          if (job_fds[0] >= 0)
+            EINTRLOOP (job_fds[1], open (cp, O_WRONLY));
+          if (job_fds[1] < 0)
+            fifo_errno = errno;
+          DB (DB_JOBS, (_("Jobserver client (fifo %s)\n"), cp));
+#else
+          OS (fatal, NILF,
+              _("jobserver FIFOs are not supported: invalid --jobserver-fds string '%s'"),
+              cp);
+#endif
+        }
+      else if (sscanf (cp, "%d,%d", &job_fds[0], &job_fds[1]) != 2)
         OS (fatal, NILF,
             _("internal error: invalid --jobserver-fds string '%s'"), cp);
-
-      DB (DB_JOBS,
-          (_("Jobserver client (fds %d,%d)\n"), job_fds[0], job_fds[1]));
+      else
+        DB (DB_JOBS,
+            (_("Jobserver client (fds %d,%d)\n"), job_fds[0], job_fds[1]));
 #endif
 
       /* The combination of a pipe + !job_slots means we're using the
@@ -1551,6 +1769,21 @@ main (int argc, char **argv, char **envp)
 # define FD_OK(_f) ((fcntl ((_f), F_GETFD) != -1) || (errno != EBADF))
 #else
 # define FD_OK(_f) 1
+#endif
+#ifdef MAKE_JOBSERVER_FIFO
+      /* The FIFO may have gone away if our parent has exited.  */
+      else if (job_fifo && fifo_errno != 0)
+        {
+          OSS (error, NILF,
+               _("warning: jobserver FIFO '%s' unavailable: %s; using -j1."),
+               jobserver_fds + CSTRLEN ("fifo:"), strerror (fifo_errno));
+          job_slots = 1;
+        }
+      else if (job_fifo)
+        {
+          CLOSE_ON_EXEC (job_fds[0]);
+          CLOSE_ON_EXEC (job_fds[1]);
+        }
 #endif
       /* Create a duplicate pipe, that will be closed in the SIGCHLD
          handler.  If this fails with EBADF, the parent has closed the pipe
@@ -1580,6 +1813,7 @@ main (int argc, char **argv, char **envp)
             close (job_fds[1]);
 #endif
           job_fds[0] = job_fds[1] = -1;
+          job_fifo = 0;
 
           free (jobserver_fds);
           jobserver_fds = 0;
@@ -1714,6 +1948,40 @@ main (int argc, char **argv, char **envp)
 
   define_variable_cname ("CURDIR", current_directory, o_file, 0);
 
+#ifdef MAKE_SERVE
+  /* Now we know enough to tell whether a make server could do our work.
+     It can't if the makefile is standard input, and a sub-make that's
+     using the jobserver must stay in the same process tree.  */
+  if (serve_socket || connect_socket)
+    {
+      unsigned int i;
+      int stdin_makefile = 0;
+
+      for (i = 0; makefiles != 0 && i < makefiles->idx; ++i)
+        if (streq (makefiles->list[i], "-"))
+          stdin_makefile = 1;
+
+      if (serve_socket && stdin_makefile)
+        O (fatal, NILF,
+           _("A make server can't read a makefile from standard input."));
+
+      if (serve_socket || (!stdin_makefile && !jobserver_fds))
+        {
+          unsigned int len;
+          char *id = serve_identity (argv, current_directory, &len);
+
+          if (serve_socket)
+            serve_init (serve_socket, argv, id, len);
+          else
+            serve_connect (connect_socket, argc, argv, id, len);
+          free (id);
+        }
+    }
+#else
+  if (serve_socket)
+    O (fatal, NILF, _("--serve is not supported on this system."));
+#endif
+
   /* Read any stdin makefiles into temporary files.  */
 
   if (makefiles != 0)
@@ -1851,10 +2119,42 @@ main (int argc, char **argv, char **envp)
 
   default_goal_var = define_variable_cname (".DEFAULT_GOAL", "", o_file, 0);
 
+  if (history_file)
+    history_init (history_file);
+  if (profile_file)
+    profile_init (profile_file, restarts != 0);
+  if (content_hash_file || recipe_signatures_flag)
+    hashdb_init (content_hash_file ? content_hash_file : DEFAULT_HASHDB_FILE,
+                 content_hash_file != 0, recipe_signatures_flag);
+  if (output_cache_dir)
+    {
+      /* Sub-makes may run in other directories.  */
+      if (output_cache_dir[0] != '/' && current_directory[0] != '\0'
+#ifdef HAVE_DOS_PATHS
+          && output_cache_dir[0] != '\\' && output_cache_dir[1] != ':'
+#endif
+          )
+        output_cache_dir = xstrdup (concat (3, current_directory, "/",
+                                            output_cache_dir));
+      outcache_init (output_cache_dir);
+    }
+
+  /* If the parse cache is current, it replaces both the --eval strings and
+     the makefiles.  We can't tell whether standard input has changed.
+     A make server reads the makefiles itself, to learn what to watch.  */
+
+  read_files = 0;
+  if ((parse_cache_file || serve_socket) && !stdin_nm)
+    {
+      readcache_init (parse_cache_file, argv);
+      if (!serve_socket)
+        read_files = readcache_load (makefiles == 0 ? 0 : makefiles->list);
+    }
+
   /* Evaluate all strings provided with --eval.
      Also set up the $(-*-eval-flags-*-) variable.  */
 
-  if (eval_strings)
+  if (eval_strings && read_files == 0)
     {
       char *p, *value;
       unsigned int i;
@@ -1909,7 +2209,30 @@ main (int argc, char **argv, char **envp)
 
   /* Read all the makefiles.  */
 
-  read_files = read_all_makefiles (makefiles == 0 ? 0 : makefiles->list);
+  if (read_files == 0)
+    {
+#ifdef MAKE_PARALLEL_SHELL
+      /* A make that gets its job slots from a jobserver doesn't know how
+         many it may use.  */
+      if (parallel_shell_flag)
+        parallel_shells_start (job_slots ? job_slots
+                               : jobserver_fds ? 1 : UINT_MAX);
+#endif
+      read_files = read_all_makefiles (makefiles == 0 ? 0 : makefiles->list);
+#ifdef MAKE_PARALLEL_SHELL
+      parallel_shells_finish ();
+#endif
+      if ((parse_cache_file || serve_socket) && !stdin_nm)
+        readcache_save (read_files, makefiles == 0 ? 0 : makefiles->list);
+    }
+
+#ifdef MAKE_SERVE
+  /* Wait for requests.  We only get past here in a child that's serving
+     one: from now on it is the client's make, with the client's
+     arguments.  */
+  if (serve_socket)
+    argv = serve_loop (&argc);
+#endif
 
 #ifdef WINDOWS32
   /* look one last time after reading all Makefiles */
@@ -1995,6 +2318,15 @@ main (int argc, char **argv, char **envp)
 #endif
 
 #ifdef MAKE_JOBSERVER
+  if (jobserver_style != 0 && !streq (jobserver_style, "pipe"))
+    {
+      if (!streq (jobserver_style, "fifo"))
+        OS (fatal, NILF, _("unknown jobserver style '%s'"), jobserver_style);
+#ifndef MAKE_JOBSERVER_FIFO
+      O (fatal, NILF, _("jobserver FIFOs are not supported on this system"));
+#endif
+    }
+
   /* If we have >1 slot but no jobserver-fds, then we're a top-level make.
      Set up the pipe and install the fds option for our children.  */
 
@@ -2021,6 +2353,40 @@ main (int argc, char **argv, char **envp)
 #else
       char c = '+';
 
+#ifdef MAKE_JOBSERVER_FIFO
+      if (jobserver_style != 0 && streq (jobserver_style, "fifo"))
+        {
+          /* Sub-makes open the FIFO by name, instead of inheriting our
+             descriptors.  */
+          const char *tmpdir = getenv ("TMPDIR");
+          unsigned int n = 0;
+
+          if (tmpdir == 0 || *tmpdir == '\0')
+            tmpdir = DEFAULT_TMPDIR;
+
+          job_fifo_name = xmalloc (strlen (tmpdir) + CSTRLEN ("/GMfifo-")
+                                   + INTSTR_LENGTH * 2 + 1);
+          while (1)
+            {
+              sprintf (job_fifo_name, "%s/GMfifo%ld-%u",
+                       tmpdir, (long) getpid (), n++);
+              if (mkfifo (job_fifo_name, 0600) == 0)
+                break;
+              if (errno != EEXIST)
+                pfatal_with_name (job_fifo_name);
+            }
+
+          job_fifo = 1;
+          EINTRLOOP (job_fds[0], open (job_fifo_name, O_RDONLY | O_NONBLOCK));
+          if (job_fds[0] >= 0)
+            EINTRLOOP (job_fds[1], open (job_fifo_name, O_WRONLY));
+          if (job_fds[0] < 0 || job_fds[1] < 0)
+            pfatal_with_name (job_fifo_name);
+          CLOSE_ON_EXEC (job_fds[0]);
+          CLOSE_ON_EXEC (job_fds[1]);
+        }
+      else
+#endif
       if (pipe (job_fds) < 0 || (job_rfd = dup (job_fds[0])) < 0)
         pfatal_with_name (_("creating jobs pipe"));
 #endif
@@ -2052,8 +2418,13 @@ main (int argc, char **argv, char **envp)
       jobserver_fds = xmalloc (MAX_PATH + 1);
       strcpy (jobserver_fds, get_jobserver_semaphore_name ());
 #else
-      jobserver_fds = xmalloc ((INTSTR_LENGTH * 2) + 2);
-      sprintf (jobserver_fds, "%d,%d", job_fds[0], job_fds[1]);
+      if (job_fifo_name)
+        jobserver_fds = xstrdup (concat (2, "fifo:", job_fifo_name));
+      else
+        {
+          jobserver_fds = xmalloc ((INTSTR_LENGTH * 2) + 2);
+          sprintf (jobserver_fds, "%d,%d", job_fds[0], job_fds[1]);
+        }
 #endif
     }
 #endif
@@ -2075,6 +2446,11 @@ main (int argc, char **argv, char **envp)
 
   snap_deps ();
 
+  /* Now that we know all the files, look up their times all at once.  */
+
+  if (stat_threads)
+    prefetch_mtimes (stat_threads);
+
   /* Convert old-style suffix rules to pattern rules.  It is important to
      do this before installing the built-in pattern rules below, so that
      makefile-specified suffix rules take precedence over built-in pattern
@@ -2401,6 +2777,12 @@ main (int argc, char **argv, char **envp)
               putenv (b);
             }
 
+          /* The new make reads the history and the content hashes
+             again, and adds to the trace.  */
+          history_save ();
+          hashdb_save ();
+          shell_cache_save ();
+
           fflush (stdout);
           fflush (stderr);
 
@@ -3319,6 +3701,7 @@ print_data_base ()
   print_file_data_base ();
   print_vpath_data_base ();
   strcache_print_stats ("#");
+  pool_print_stats ("#");
 
   when = time ((time_t *) 0);
   printf (_("\n# Finished Make data base on %s\n"), ctime (&when));
@@ -3389,7 +3772,16 @@ clean_jobserver (int status)
       free_jobserver_semaphore ();
 #else
       close (job_fds[0]);
+
+      if (job_fifo_name)
+        {
+          unlink (job_fifo_name);
+          free (job_fifo_name);
+          job_fifo_name = 0;
+        }
 #endif
+      job_fds[0] = job_fds[1] = -1;
+      job_fifo = 0;
 
       /* Clean out jobserver_fds so we don't pass this information to any
          sub-makes.  Also reset job_slots since it will be put on the command
@@ -3424,6 +3816,12 @@ die (int status)
       while (job_slots_used > 0)
         reap_children (1, err);
 
+      history_save ();
+      hashdb_save ();
+      shell_cache_save ();
+      profile_close ();
+      print_file_verdict_stats ();
+
       /* Let the remote job module clean up its state.  */
       remote_cleanup ();
 
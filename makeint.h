@@ -467,6 +467,27 @@ void *xcalloc (unsigned int);
 void *xrealloc (void *, unsigned int);
 char *xstrdup (const char *);
 char *xstrndup (const char *, unsigned int);
+
+/* A pool of objects of one size, carved out of large blocks.  Objects
+   freed are kept for reuse; the blocks are never freed.  */
+struct objpool
+  {
+    const char *name;           /* What the objects are, for the stats.  */
+    unsigned int size;          /* The size of each object.  */
+    char *avail;                /* Free space in the current block.  */
+    char *limit;                /* The end of the current block.  */
+    void *free_list;            /* Objects freed, for reuse.  */
+    unsigned long blocks;       /* # of blocks allocated.  */
+    unsigned long in_use;       /* # of objects allocated and not freed.  */
+    unsigned long freed;        /* # of objects on the free list.  */
+    struct objpool *next;       /* The next pool, for the stats.  */
+  };
+#define OBJPOOL_INIT(_name, _type) \
+          { (_name), sizeof (_type), 0, 0, 0, 0, 0, 0, 0 }
+void *pool_alloc (struct objpool *pool);
+void pool_free (struct objpool *pool, void *obj);
+void pool_print_stats (const char *prefix);
+
 char *find_next_token (const char **, unsigned int *);
 char *next_token (const char *);
 char *end_of_token (const char *);
@@ -499,7 +520,16 @@ int dir_file_exists_p (const char *, const char *);
 int file_exists_p (const char *);
 int file_impossible_p (const char *);
 void file_impossible (const char *);
+#define FV_UNKNOWN      0
+#define FV_EXISTS       1
+#define FV_MISSING      2
+#define FV_IMPOSSIBLE   3
+int file_verdict_p (const char *filename, const char **vpath);
+void file_verdict (const char *filename, int exists, const char *vpath);
+void print_file_verdict_stats (void);
 const char *dir_name (const char *);
+void dir_load_all (void);
+void dir_note_change (const char *dirname, const char *filename, int exists);
 void hash_init_directories (void);
 
 void define_default_variables (void);
@@ -528,8 +558,39 @@ void strcache_print_stats (const char *prefix);
 int strcache_iscached (const char *str);
 const char *strcache_add (const char *str);
 const char *strcache_add_len (const char *str, unsigned int len);
+const char *strcache_find_len (const char *str, unsigned int len);
 int strcache_setbufsize (unsigned int size);
 
+/* Each string returned by the strcache is preceded by its hash and its
+   length.  The hash folds case where file names do.  */
+struct strcache_info
+  {
+    unsigned int hash;
+    unsigned int len;
+  };
+#define strcache_info(_s)   ((const struct strcache_info *) (_s) - 1)
+#define strcache_hash(_s)   (strcache_info (_s)->hash)
+#define strcache_len(_s)    (strcache_info (_s)->len)
+
+/* Parse cache support.  */
+void readcache_init (const char *file, char **argv);
+void readcache_note_file (const char *name);
+void readcache_note_glob (const char *pattern);
+void readcache_note_vpath (const char *pattern, const char *dirpath);
+void readcache_taint (const char *reason);
+int readcache_input_p (const char *name);
+int readcache_glob_match_p (const char *name);
+const char *readcache_tainted (void);
+void readcache_map_inputs (void (*func) (const char *name, void *arg),
+                           void *arg);
+
+/* Make server support.  */
+void serve_init (const char *name, char **argv,
+                 const char *id, unsigned int len);
+char **serve_loop (int *argcp);
+void serve_connect (const char *name, int argc, char **argv,
+                    const char *id, unsigned int len);
+
 /* Guile support  */
 int guile_gmake_setup (const gmk_floc *flocp);
 
@@ -598,6 +659,7 @@ extern int print_data_base_flag, question_flag, touch_flag, always_make_flag;
 extern int env_overrides, no_builtin_rules_flag, no_builtin_variables_flag;
 extern int print_version_flag, print_directory_flag, check_symlink_flag;
 extern int warn_undefined_variables_flag, trace_flag, posix_pedantic;
+extern int critical_path_flag, builtin_commands_flag, shell_pool_flag;
 extern int not_parallel, second_expansion, clock_skew_detected;
 extern int rebuilding_makefiles, one_shell, output_sync, verify_flag;
 
@@ -612,6 +674,49 @@ extern char cmd_prefix;
 extern unsigned int job_slots;
 extern int job_fds[2];
 extern int job_rfd;
+
+/* The jobserver can use a named FIFO instead of an inherited pipe.  */
+#if defined (MAKE_JOBSERVER) && defined (HAVE_MKFIFO) && defined (HAVE_POLL_H)
+# define MAKE_JOBSERVER_FIFO 1
+#endif
+
+/* On Linux, we can wait for a job token and our children together without
+   relying on SIGCHLD.  */
+#if defined (MAKE_JOBSERVER_FIFO) && defined (HAVE_SYS_EPOLL_H) \
+    && HAVE_DECL_SYS_PIDFD_OPEN
+# define MAKE_EPOLL 1
+#endif
+
+/* Start jobs with posix_spawn() when the child needs no work of ours between
+   fork() and exec().  A make that must give up privileges in its children
+   always forks, as does one built with NO_SPAWN ('makefork', for
+   'make bench-spawn').  */
+#if defined (POSIX) && defined (HAVE_SPAWN_H) && defined (HAVE_POSIX_SPAWNP) \
+    && !defined (GETLOADAVG_PRIVILEGED) && !defined (__EMX__) \
+    && !defined (NO_SPAWN)
+# define MAKE_SPAWN 1
+#endif
+
+/* Simple commands can be run by make itself (--builtin-commands).  */
+#if defined (POSIX) && !defined (VMS) && !defined (__EMX__)
+# define MAKE_BUILTINS 1
+#endif
+
+/* Recipe lines can be run by shells that are already running (--shell-pool).
+   Those shells send us SIGCHLD, so we need the handler the jobserver uses.  */
+#if defined (POSIX) && defined (MAKE_JOBSERVER) && defined (HAVE_WAITPID) \
+    && defined (HAVE_POLL_H) && !defined (VMS) && !defined (__EMX__)
+# define MAKE_SHELL_POOL 1
+#endif
+
+/* $(shell ...) commands in assignments can run while the makefiles are
+   read (--parallel-shell).  */
+#if defined (POSIX) && defined (HAVE_WAITPID) && defined (HAVE_SYS_WAIT_H) \
+    && !defined (VMS) && !defined (__EMX__)
+# define MAKE_PARALLEL_SHELL 1
+#endif
+extern int job_fifo;
+extern char *job_fifo_name;
 #ifndef NO_FLOAT
 extern double max_load_average;
 #else
@@ -620,6 +725,7 @@ extern int max_load_average;
 
 extern char *program;
 extern char *starting_directory;
+extern char *directory_before_chdir;
 extern unsigned int makelevel;
 extern char *version_string, *remote_description, *make_host;
 
@@ -105,23 +105,29 @@ collapse_continuations (char *line)
         *out++ = '\n';
 
       /* Now copy the following line to the output.
-         Stop when we find backslashes followed by a newline.  */
+         Stop when we find backslashes followed by a newline.  Copy the
+         runs of text between backslashes all at once.  */
       while (*in != '\0')
-        if (*in == '\\')
-          {
-            p = in + 1;
-            while (*p == '\\')
-              ++p;
-            if (*p == '\n')
-              {
-                in = p;
-                break;
-              }
-            while (in < p)
-              *out++ = *in++;
-          }
-        else
-          *out++ = *in++;
+        {
+          size_t len = strcspn (in, "\\");
+
+          memmove (out, in, len);
+          out += len;
+          in += len;
+          if (*in == '\0')
+            break;
+
+          p = in + 1;
+          while (*p == '\\')
+            ++p;
+          if (*p == '\n')
+            {
+              in = p;
+              break;
+            }
+          while (in < p)
+            *out++ = *in++;
+        }
     }
 
   *out = '\0';
@@ -293,6 +299,72 @@ xstrndup (const char *str, unsigned int length)
 }
 
 
+/* Pools of objects.  The structures make allocates by the million, like
+   'struct dep', come from these rather than from malloc.  */
+
+#define POOL_BLOCK_SIZE (64 * 1024)
+
+static struct objpool *all_pools = 0;
+
+struct objpool dep_pool = OBJPOOL_INIT ("dep", struct dep);
+
+/* Return a new zeroed object from POOL.  */
+
+void *
+pool_alloc (struct objpool *pool)
+{
+  void *obj = pool->free_list;
+
+  if (obj != 0)
+    {
+      pool->free_list = *(void **) obj;
+      --pool->freed;
+    }
+  else
+    {
+      if (pool->avail == 0 || pool->avail + pool->size > pool->limit)
+        {
+          if (pool->blocks == 0)
+            {
+              pool->next = all_pools;
+              all_pools = pool;
+            }
+          pool->avail = xmalloc (POOL_BLOCK_SIZE);
+          pool->limit = pool->avail + POOL_BLOCK_SIZE;
+          ++pool->blocks;
+        }
+      obj = pool->avail;
+      pool->avail += pool->size;
+    }
+
+  ++pool->in_use;
+  return memset (obj, '\0', pool->size);
+}
+
+/* Give OBJ back to POOL.  */
+
+void
+pool_free (struct objpool *pool, void *obj)
+{
+  *(void **) obj = pool->free_list;
+  pool->free_list = obj;
+  --pool->in_use;
+  ++pool->freed;
+}
+
+void
+pool_print_stats (const char *prefix)
+{
+  const struct objpool *pool;
+
+  putchar ('\n');
+  for (pool = all_pools; pool != 0; pool = pool->next)
+    printf (_("%s %s pool: %lu in use / %lu free / %lu blocks = %lu B\n"),
+            prefix, pool->name, pool->in_use, pool->freed, pool->blocks,
+            pool->blocks * POOL_BLOCK_SIZE);
+}
+
+
 /* Limited INDEX:
    Search through the string STRING, which ends at LIMIT, for the character C.
    Returns a pointer to the first occurrence, or nil if none is found.
@@ -359,7 +431,7 @@ copy_dep_chain (const struct dep *d)
 
   while (d != 0)
     {
-      struct dep *c = xmalloc (sizeof (struct dep));
+      struct dep *c = alloc_dep ();
       memcpy (c, d, sizeof (struct dep));
 
       if (c->need_2nd_expansion)
@@ -400,7 +472,7 @@ free_ns_chain (struct nameseq *ns)
     {
       struct nameseq *t = ns;
       ns = ns->next;
-      free (t);
+      free_ns (t);
     }
 }
 
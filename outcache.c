@@ -0,0 +1,513 @@
+/* Output cache for GNU Make.
+Copyright (C) 2013 Free Software Foundation, Inc.
+This file is part of GNU Make.
+
+GNU Make is free software; you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation; either version 3 of the License, or (at your option) any later
+version.
+
+GNU Make is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "makeint.h"
+#include "filedef.h"
+#include "dep.h"
+#include "variable.h"
+#include "job.h"
+#include "commands.h"
+#include "debug.h"
+#include "hash.h"
+
+/* The output cache (--output-cache) keeps the files that recipes made, so
+   that a target whose recipe would run with the same command lines, the
+   same environment and prerequisites with the same contents as a recipe
+   that ran before can be restored, instead of being made again.  It may be
+   shared by any number of makes, running at the same time or not.
+
+   The cache is a directory.  OBJECTS/XX/DIGEST holds a file with the
+   contents DIGEST; KEYS/XX/KEY lists the files that the recipe with the key
+   KEY made: a header line, then one line per file holding its digest, its
+   mode and its name.  XX are the first two digits of DIGEST or KEY.
+   Nothing is ever written in place: a new file is written under a name no
+   other make uses, and renamed to its real name, so a make either sees all
+   of it or none of it.  Objects are only created, never changed, so
+   entries never refer to an object that isn't what they expect; one that
+   has been deleted is just a miss.  */
+
+#define OUTCACHE_HEADER "# GNU make output cache 1"
+
+#define HEX_LENGTH      (sizeof (uintmax_t) * 2)
+
+#ifdef WINDOWS32
+# define make_dir(_d)   mkdir (_d)
+#else
+# define make_dir(_d)   mkdir ((_d), 0777)
+#endif
+
+/* The directory of the cache, or null if there is none.  */
+
+static char *cache_dir = 0;
+
+/* Used to make the names of our temporary files unique.  */
+
+static unsigned int temp_count = 0;
+
+/* Variables that say how make was invoked, rather than what the recipe
+   makes: a recipe that differs only in those makes the same files.
+   Recursive recipes, which do care, are never cached.  */
+
+static const char *const ignored_variables[] =
+  {
+    "MAKEFLAGS=", "MFLAGS=", "MAKELEVEL=", "MAKE_RESTARTS=",
+    "PWD=", "OLDPWD=", 0
+  };
+
+/* Write N to BUF in hexadecimal, as HEX_LENGTH digits.  */
+
+static void
+hex_string (char *buf, uintmax_t n)
+{
+  int i;
+
+  for (i = HEX_LENGTH - 1; i >= 0; --i, n >>= 4)
+    buf[i] = "0123456789abcdef"[n & 0xf];
+  buf[HEX_LENGTH] = '\0';
+}
+
+/* Parse a hexadecimal number followed by a space at *PP, and move *PP past
+   both.  Return zero if there isn't one.  */
+
+static int
+get_hex (char **pp, uintmax_t *np)
+{
+  char *p = *pp;
+  uintmax_t n = 0;
+
+  if (!isxdigit ((unsigned char) *p))
+    return 0;
+
+  for (; isxdigit ((unsigned char) *p); ++p)
+    n = (n << 4) | (isdigit ((unsigned char) *p)
+                    ? *p - '0' : tolower ((unsigned char) *p) - 'a' + 10);
+
+  if (*p != ' ')
+    return 0;
+
+  *pp = p + 1;
+  *np = n;
+  return 1;
+}
+
+/* Read one line from FP into *BUFP, growing it as needed.
+   Return zero at EOF.  */
+
+static int
+read_line (FILE *fp, char **bufp, unsigned int *sizep)
+{
+  unsigned int len = 0;
+  int c;
+
+  while ((c = getc (fp)) != EOF && c != '\n')
+    {
+      if (len + 1 >= *sizep)
+        {
+          *sizep = *sizep ? *sizep * 2 : 200;
+          *bufp = xrealloc (*bufp, *sizep);
+        }
+      (*bufp)[len++] = c;
+    }
+
+  if (c == EOF && len == 0)
+    return 0;
+
+  if (*sizep == 0)
+    {
+      *sizep = 200;
+      *bufp = xmalloc (*sizep);
+    }
+  (*bufp)[len] = '\0';
+  return 1;
+}
+
+/* Return the name of the file for N in the subdirectory KIND of the cache.
+   The result is malloc'd.  */
+
+static char *
+cache_name (const char *kind, uintmax_t n)
+{
+  char hex[HEX_LENGTH + 1];
+  char *name = xmalloc (strlen (cache_dir) + strlen (kind) + HEX_LENGTH + 6);
+
+  hex_string (hex, n);
+  sprintf (name, "%s/%s/%.2s/%s", cache_dir, kind, hex, hex);
+  return name;
+}
+
+/* Return a name for a temporary file to rename to NAME later.  It is in
+   the same directory, so that it can be renamed, and no other make (or
+   other file we write) uses it.  The result is malloc'd.  */
+
+static char *
+temp_name (const char *name)
+{
+  char *tmp = xmalloc (strlen (name) + INTSTR_LENGTH * 2 + CSTRLEN (".tmp")
+                       + 3);
+
+  sprintf (tmp, "%s.%lu.%u.tmp", name, (unsigned long) getpid (),
+           temp_count++);
+  return tmp;
+}
+
+/* Make the directory that the cache file NAME is in, if it doesn't exist.
+   Return zero if we can't.  */
+
+static int
+make_parent (const char *name)
+{
+  char *dir = xstrdup (name);
+  int ok;
+
+  *strrchr (dir, '/') = '\0';
+  ok = make_dir (dir) == 0 || errno == EEXIST;
+  if (!ok)
+    perror_with_name (_("output cache: "), dir);
+
+  free (dir);
+  return ok;
+}
+
+/* Copy the file FROM to TO, and give TO the permissions MODE.  Return zero
+   if we can't, leaving no TO behind.  */
+
+static int
+copy_file (const char *from, const char *to, unsigned int mode)
+{
+  FILE *in;
+  FILE *out;
+  char buf[65536];
+  size_t len;
+  int ok;
+
+  in = fopen (from, "rb");
+  if (in == 0)
+    return 0;
+
+  out = fopen (to, "wb");
+  if (out == 0)
+    {
+      fclose (in);
+      return 0;
+    }
+
+  while ((len = fread (buf, 1, sizeof buf, in)) > 0)
+    if (fwrite (buf, 1, len, out) != len)
+      break;
+
+  ok = !ferror (in) && !ferror (out);
+  fclose (in);
+  if (fclose (out) != 0)
+    ok = 0;
+  if (ok && chmod (to, mode) != 0)
+    ok = 0;
+
+  if (!ok)
+    unlink (to);
+  return ok;
+}
+
+/* Start keeping the outputs of recipes in the directory DIR.  */
+
+void
+outcache_init (const char *dir)
+{
+  static const char *const kinds[] = { "", "/objects", "/keys", 0 };
+  char *name = xmalloc (strlen (dir) + CSTRLEN ("/objects") + 1);
+  const char *const *k;
+
+  for (k = kinds; *k != 0; ++k)
+    {
+      sprintf (name, "%s%s", dir, *k);
+      if (make_dir (name) != 0 && errno != EEXIST)
+        {
+          perror_with_name (_("output cache: "), name);
+          free (name);
+          return;
+        }
+    }
+
+  free (name);
+  cache_dir = xstrdup (dir);
+}
+
+/* Compute the key of the recipe of the child C into *KEYP: the names of
+   the targets it makes, its expanded command lines, its environment and
+   the names and digests of its prerequisites.  Return zero if its outputs
+   can't be cached.  */
+
+static int
+cache_key (struct child *c, uintmax_t *keyp)
+{
+  struct file *file = c->file;
+  uintmax_t key;
+  uintmax_t env = 0;
+  uintmax_t digest;
+  struct dep *d;
+  char **ep;
+  unsigned int i;
+
+  /* We can't tell what a recursive make does without running it.  */
+  if (file->phony || file->cmds->any_recurse)
+    return 0;
+
+  key = fnv_add_str (FNV_OFFSET, OUTCACHE_HEADER);
+
+  key = fnv_add_str (key, file->name);
+  for (d = file->also_make; d != 0; d = d->next)
+    key = fnv_add_str (key, d->file->name);
+
+  for (i = 0; i < file->cmds->ncommand_lines; ++i)
+    key = fnv_add_str (key, c->command_lines[i]);
+
+  /* The order of the environment depends on the variable hash table, so
+     combine the entries in a way that doesn't.  start_job_command will
+     use the environment we make here.  */
+  if (c->environment == 0)
+    c->environment = target_environment (file);
+  for (ep = c->environment; *ep != 0; ++ep)
+    {
+      const char *const *v;
+
+      for (v = ignored_variables; *v != 0; ++v)
+        if (strneq (*ep, *v, strlen (*v)))
+          break;
+      if (*v == 0)
+        env += fnv_add_str (FNV_OFFSET, *ep);
+    }
+  key = fnv_add (key, &env, sizeof env);
+
+  for (d = file->deps; d != 0; d = d->next)
+    if (!d->ignore_mtime)
+      {
+        if (d->file->phony || !hashdb_digest (d->file->name, &digest))
+          return 0;
+        key = fnv_add_str (key, d->file->name);
+        key = fnv_add (key, &digest, sizeof digest);
+      }
+
+  *keyp = key;
+  return 1;
+}
+
+/* Restore the targets of the child C from the cache, if it has them.
+   Return nonzero if it did, in which case its recipe need not be run.
+   Otherwise, note whether its targets should be stored once it has.  */
+
+int
+outcache_fetch (struct child *c)
+{
+  struct file *file = c->file;
+  const char **names;
+  char **temps;
+  unsigned int n = 1;
+  unsigned int i;
+  struct dep *d;
+  char *entry;
+  char *buf = 0;
+  unsigned int size = 0;
+  FILE *fp;
+  int ok;
+
+  /* Nothing is really made with -n, -q or -t.  */
+  c->cacheable = 0;
+  if (cache_dir == 0 || just_print_flag || question_flag || touch_flag
+      || !cache_key (c, &c->cache_key))
+    return 0;
+  c->cacheable = 1;
+
+  entry = cache_name ("keys", c->cache_key);
+  fp = fopen (entry, "r");
+  free (entry);
+  if (fp == 0)
+    {
+      DB (DB_JOBS, (_("Output cache miss for '%s'.\n"), file->name));
+      return 0;
+    }
+
+  for (d = file->also_make; d != 0; d = d->next)
+    ++n;
+  names = xmalloc (n * sizeof (const char *));
+  temps = xcalloc (n * sizeof (char *));
+  names[0] = file->name;
+  for (i = 1, d = file->also_make; d != 0; ++i, d = d->next)
+    names[i] = d->file->name;
+
+  /* Copy each object next to its target.  The entry can only name our own
+     targets, whatever is in the file.  */
+  ok = read_line (fp, &buf, &size) && streq (buf, OUTCACHE_HEADER);
+  while (ok && read_line (fp, &buf, &size))
+    {
+      char *p = buf;
+      uintmax_t digest;
+      uintmax_t mode;
+      char *object;
+
+      ok = get_hex (&p, &digest) && get_hex (&p, &mode);
+      for (i = 0; ok && i < n; ++i)
+        if (temps[i] == 0 && streq (names[i], p))
+          break;
+      if (!ok || i == n)
+        {
+          ok = 0;
+          break;
+        }
+
+      object = cache_name ("objects", digest);
+      temps[i] = temp_name (names[i]);
+      if (!copy_file (object, temps[i], (unsigned int) mode & 07777))
+        {
+          free (temps[i]);
+          temps[i] = 0;
+          ok = 0;
+        }
+      free (object);
+    }
+
+  fclose (fp);
+  free (buf);
+
+  for (i = 0; i < n; ++i)
+    if (temps[i] == 0)
+      ok = 0;
+
+  /* Only put them in place once we have all of them.  */
+  for (i = 0; i < n; ++i)
+    if (temps[i] != 0)
+      {
+        if (ok && rename (temps[i], names[i]) != 0)
+          {
+            perror_with_name (_("output cache: "), names[i]);
+            ok = 0;
+          }
+        unlink (temps[i]);
+        free (temps[i]);
+      }
+
+  free (names);
+  free (temps);
+
+  if (ok)
+    DB (DB_BASIC, (_("Restored '%s' from the output cache.\n"), file->name));
+  else
+    DB (DB_JOBS, (_("Output cache miss for '%s'.\n"), file->name));
+
+  return ok;
+}
+
+/* Store the file NAME as an object, if it isn't one already, and write
+   its line of the entry to FP.  Return zero if it can't be stored.  */
+
+static int
+store_output (FILE *fp, const char *name)
+{
+  struct stat st;
+  uintmax_t digest;
+  char hex[HEX_LENGTH + 1];
+  char *object;
+  int ok = 1;
+  int e;
+
+  EINTRLOOP (e, stat (name, &st));
+  if (e != 0 || !S_ISREG (st.st_mode) || strchr (name, '\n') != 0
+      || !hashdb_digest (name, &digest))
+    {
+      DB (DB_JOBS, (_("Can't store '%s' in the output cache.\n"), name));
+      return 0;
+    }
+
+  object = cache_name ("objects", digest);
+  if (access (object, F_OK) != 0)
+    {
+      char *tmp = temp_name (object);
+
+      ok = make_parent (object);
+      if (ok && (!copy_file (name, tmp, 0444) || rename (tmp, object) != 0))
+        {
+          perror_with_name (_("output cache: "), object);
+          unlink (tmp);
+          ok = 0;
+        }
+      free (tmp);
+    }
+  free (object);
+
+  if (ok)
+    {
+      hex_string (hex, digest);
+      fprintf (fp, "%s %lx %s\n", hex, (unsigned long) st.st_mode & 07777,
+               name);
+    }
+
+  return ok;
+}
+
+/* Store the targets of the child C, whose recipe has just succeeded.  */
+
+void
+outcache_store (struct child *c)
+{
+  struct file *file = c->file;
+  struct dep *d;
+  char *entry;
+  char *tmp;
+  FILE *fp;
+  int ok;
+
+  if (!c->cacheable)
+    return;
+
+  entry = cache_name ("keys", c->cache_key);
+  if (!make_parent (entry))
+    {
+      free (entry);
+      return;
+    }
+
+  tmp = temp_name (entry);
+  fp = fopen (tmp, "w");
+  if (fp == 0)
+    {
+      perror_with_name (_("output cache: "), tmp);
+      free (tmp);
+      free (entry);
+      return;
+    }
+
+  fputs (OUTCACHE_HEADER "\n", fp);
+  ok = store_output (fp, file->name);
+  for (d = file->also_make; ok && d != 0; d = d->next)
+    ok = store_output (fp, d->file->name);
+
+  if (ferror (fp))
+    ok = 0;
+  if (fclose (fp) != 0)
+    ok = 0;
+
+  if (ok && rename (tmp, entry) != 0)
+    {
+      perror_with_name (_("output cache: "), entry);
+      ok = 0;
+    }
+
+  if (ok)
+    DB (DB_JOBS, (_("Stored '%s' in the output cache.\n"), file->name));
+  else
+    unlink (tmp);
+
+  free (tmp);
+  free (entry);
+}
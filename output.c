@@ -33,6 +33,10 @@ this program.  If not, see <http://www.gnu.org/licenses/>.  */
 # include <sys/file.h>
 #endif
 
+#ifdef HAVE_SYS_SENDFILE_H
+# include <sys/sendfile.h>
+#endif
+
 #ifdef WINDOWS32
 # include <windows.h>
 # include <io.h>
@@ -451,6 +455,19 @@ pump_from_tmp (int from, FILE *to)
   if (lseek (from, 0, SEEK_SET) == -1)
     perror ("lseek()");
 
+#ifdef HAVE_SYS_SENDFILE_H
+  /* Let the kernel copy it, if it can copy to wherever TO goes.  If it
+     can't, the loop below copies whatever is left.  */
+  fflush (to);
+  while (1)
+    {
+      ssize_t len;
+      EINTRLOOP (len, sendfile (fileno (to), from, NULL, 0x40000000));
+      if (len <= 0)
+        break;
+    }
+#endif
+
   while (1)
     {
       int len;
@@ -796,6 +813,9 @@ outputs (int is_err, const char *msg)
   if (! msg || *msg == '\0')
     return;
 
+  /* A cached read would not print this again.  */
+  readcache_taint ("output");
+
   output_start ();
 
   _outputs (output_context, is_err, msg);
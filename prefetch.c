@@ -0,0 +1,264 @@
+/* Looking up file times ahead of time for GNU Make.
+Copyright (C) 2013 Free Software Foundation, Inc.
+This file is part of GNU Make.
+
+GNU Make is free software; you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation; either version 3 of the License, or (at your option) any later
+version.
+
+GNU Make is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "makeint.h"
+
+#ifdef MAKE_THREADS
+
+#include <pthread.h>
+#include <signal.h>
+
+#include "filedef.h"
+#include "debug.h"
+#include "hash.h"
+
+/* Walking the dependency graph stats each file when it is first needed,
+   one at a time.  Where a stat takes a round trip to a server, as on NFS,
+   that is most of the time make takes to find that nothing needs to be
+   done.  With --stat-threads, make stats every file it knows about once
+   the makefiles have been read, with several threads at once, and
+   name_mtime uses the times found instead of calling stat itself.
+
+   Like the times the make server gives us, the times are only used until
+   the first command runs, as a command may change any file, not just its
+   own targets.  Before that each one is used once: after that the file's
+   time is in its struct file, and if it is asked for again, the file has
+   been remade and must be looked at again.  */
+
+struct prefetch
+  {
+    const char *name;           /* Name of the file (strcache'd).  */
+    time_t stamp;               /* Its modification time...  */
+    long ns;                    /* ... and the nanoseconds of it.  */
+    int status;                 /* 0, or the errno from stat.  */
+  };
+
+static struct hash_table prefetched;
+
+/* The files to stat, and the next one that no thread has taken.  */
+
+static struct prefetch *entries = 0;
+static unsigned int nentries = 0;
+static unsigned int next_entry = 0;
+static pthread_mutex_t next_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* How many files each thread takes at a time.  */
+
+#define PREFETCH_BATCH  16
+
+static unsigned long
+prefetch_hash_1 (const void *key)
+{
+  return_STRING_HASH_1 (((const struct prefetch *) key)->name);
+}
+
+static unsigned long
+prefetch_hash_2 (const void *key)
+{
+  return_STRING_HASH_2 (((const struct prefetch *) key)->name);
+}
+
+static int
+prefetch_hash_cmp (const void *x, const void *y)
+{
+  return_STRING_COMPARE (((const struct prefetch *) x)->name,
+                         ((const struct prefetch *) y)->name);
+}
+
+/* Add the file ITEM to ENTRIES, if we will want to know its time.  */
+
+static void
+add_file (const void *item, void *arg)
+{
+  const struct file *f = item;
+  unsigned int *maxp = arg;
+
+  if (f->phony || f->last_mtime != UNKNOWN_MTIME)
+    return;
+#ifndef NO_ARCHIVES
+  if (ar_name (f->name))
+    return;
+#endif
+
+  if (nentries == *maxp)
+    {
+      *maxp = *maxp ? *maxp * 2 : 1000;
+      entries = xrealloc (entries, *maxp * sizeof (struct prefetch));
+    }
+
+  entries[nentries].name = f->name;
+  entries[nentries].status = 0;
+  ++nentries;
+}
+
+/* Stat the files in ENTRIES that no other thread has taken, until there
+   are none left.  This runs in threads other than the main one, so it may
+   not call anything in make that isn't thread-safe, which is nearly
+   everything.  */
+
+static void *
+prefetch_worker (void *arg UNUSED)
+{
+  while (1)
+    {
+      unsigned int i;
+      unsigned int end;
+
+      pthread_mutex_lock (&next_lock);
+      i = next_entry;
+      next_entry = i + PREFETCH_BATCH < nentries ? i + PREFETCH_BATCH
+                                                 : nentries;
+      end = next_entry;
+      pthread_mutex_unlock (&next_lock);
+
+      if (i == end)
+        return 0;
+
+      for (; i < end; ++i)
+        {
+          struct prefetch *p = &entries[i];
+          struct stat st;
+          int e;
+
+          EINTRLOOP (e, stat (p->name, &st));
+          if (e != 0)
+            p->status = errno;
+          else
+            {
+              p->stamp = st.st_mtime;
+#ifdef ST_MTIM_NSEC
+              p->ns = st.ST_MTIM_NSEC;
+#else
+              p->ns = 0;
+#endif
+            }
+        }
+    }
+}
+
+/* Stat all the files we know about with THREADS threads, and remember
+   their times for name_mtime.  */
+
+void
+prefetch_mtimes (unsigned int threads)
+{
+  unsigned int max = 0;
+  pthread_t *tids;
+  sigset_t all;
+  sigset_t old;
+  unsigned int started;
+  unsigned int i;
+
+  /* We only stat the files themselves, so we can't help with -L.  */
+  if (check_symlink_flag || threads == 0)
+    return;
+
+  map_files (add_file, &max);
+  if (nentries == 0)
+    return;
+
+  if (threads > (nentries + PREFETCH_BATCH - 1) / PREFETCH_BATCH)
+    threads = (nentries + PREFETCH_BATCH - 1) / PREFETCH_BATCH;
+
+  /* Signals are for the main thread: make's handlers aren't reentrant.  */
+  sigfillset (&all);
+  pthread_sigmask (SIG_BLOCK, &all, &old);
+
+  tids = xmalloc (threads * sizeof (pthread_t));
+  for (started = 0; started < threads; ++started)
+    if (pthread_create (&tids[started], 0, prefetch_worker, 0) != 0)
+      break;
+
+  pthread_sigmask (SIG_SETMASK, &old, 0);
+
+  /* If we couldn't start any threads, do the work ourselves.  */
+  if (started == 0)
+    prefetch_worker (0);
+
+  for (i = 0; i < started; ++i)
+    pthread_join (tids[i], 0);
+  free (tids);
+
+  /* Errors other than not finding the file are left for name_mtime to
+   report, when and if the file is needed.  */
+  hash_init (&prefetched, nentries, prefetch_hash_1, prefetch_hash_2,
+             prefetch_hash_cmp);
+  for (i = 0; i < nentries; ++i)
+    if (entries[i].status == 0 || entries[i].status == ENOENT
+        || entries[i].status == ENOTDIR)
+      hash_insert (&prefetched, &entries[i]);
+
+  DB (DB_VERBOSE, (_("Looked up the times of %u files with %u threads.\n"),
+                   nentries, started));
+}
+
+/* Look up NAME's modification time, if it was looked up ahead of time,
+   that time hasn't been used yet and no command has run since.  */
+
+int
+prefetch_mtime (const char *name, FILE_TIMESTAMP *mtime)
+{
+  struct prefetch key;
+  struct prefetch **slot;
+  struct prefetch *p;
+
+  if (entries == 0 || commands_started != 0)
+    return 0;
+
+  key.name = name;
+  slot = (struct prefetch **) hash_find_slot (&prefetched, &key);
+  if (HASH_VACANT (*slot))
+    return 0;
+
+  p = *slot;
+  hash_delete_at (&prefetched, slot);
+
+  *mtime = (p->status != 0
+            ? NONEXISTENT_MTIME
+            : file_timestamp_cons (p->name, p->stamp, p->ns));
+  return 1;
+}
+
+/* Forget NAME's modification time: it's about to change.  */
+
+void
+prefetch_forget_mtime (const char *name)
+{
+  FILE_TIMESTAMP mtime;
+  prefetch_mtime (name, &mtime);
+}
+
+#else /* !MAKE_THREADS */
+
+#include "filedef.h"
+
+void
+prefetch_mtimes (unsigned int threads UNUSED)
+{
+}
+
+int
+prefetch_mtime (const char *name UNUSED, FILE_TIMESTAMP *mtime UNUSED)
+{
+  return 0;
+}
+
+void
+prefetch_forget_mtime (const char *name UNUSED)
+{
+}
+
+#endif /* MAKE_THREADS */
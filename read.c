@@ -20,6 +20,10 @@ this program.  If not, see <http://www.gnu.org/licenses/>.  */
 
 #include <glob.h>
 
+#ifdef HAVE_MMAP
+# include <sys/mman.h>
+#endif
+
 #include "filedef.h"
 #include "dep.h"
 #include "job.h"
@@ -54,6 +58,8 @@ struct ebuffer
     char *bufstart;     /* Start of the entire buffer.  */
     unsigned int size;  /* Malloc'd size of buffer. */
     FILE *fp;           /* File, or NULL if this is an internal buffer.  */
+    char *map;          /* The contents of fp mapped into memory, or NULL.  */
+    size_t maplen;      /* Length of map.  */
     gmk_floc floc;   /* Info on the file in fp (if any).  */
   };
 
@@ -136,8 +142,12 @@ static struct dep *read_files = 0;
 
 static int eval_makefile (const char *filename, int flags);
 static void eval (struct ebuffer *buffer, int flags);
+static void eval_depfile (struct ebuffer *ebuf, int set_default);
 
 static long readline (struct ebuffer *ebuf);
+#ifdef HAVE_MMAP
+static void map_makefile (struct ebuffer *ebuf);
+#endif
 static void do_undefine (char *name, enum variable_origin origin,
                          struct ebuffer *ebuf);
 static struct variable *do_define (char *name, enum variable_origin origin,
@@ -251,7 +261,11 @@ read_all_makefiles (const char **makefiles)
 #endif /* VMS */
       register char **p = default_makefiles;
       while (*p != 0 && !file_exists_p (*p))
-        ++p;
+        {
+          /* Its absence is an input to the parse cache.  */
+          readcache_note_file (*p);
+          ++p;
+        }
 
       if (*p != 0)
         {
@@ -339,6 +353,8 @@ eval_makefile (const char *filename, int flags)
         printf (_(" (don't care)"));
       if (flags & RM_NO_TILDE)
         printf (_(" (no ~ expansion)"));
+      if (flags & RM_DEPFILE)
+        printf (_(" (dependencies)"));
       puts ("...");
     }
 
@@ -358,6 +374,8 @@ eval_makefile (const char *filename, int flags)
   /* Save the error code so we print the right message later.  */
   makefile_errno = errno;
 
+  readcache_note_file (filename);
+
   /* Check for unrecoverable errors: out of mem or FILE slots.  */
   switch (makefile_errno)
     {
@@ -385,6 +403,7 @@ eval_makefile (const char *filename, int flags)
           const char *included = concat (3, include_directories[i],
                                          "/", filename);
           ebuf.fp = fopen (included, "r");
+          readcache_note_file (included);
           if (ebuf.fp)
             {
               filename = included;
@@ -437,14 +456,26 @@ eval_makefile (const char *filename, int flags)
 
   ebuf.size = 200;
   ebuf.buffer = ebuf.bufnext = ebuf.bufstart = xmalloc (ebuf.size);
+  ebuf.map = 0;
+  ebuf.maplen = 0;
+#ifdef HAVE_MMAP
+  map_makefile (&ebuf);
+#endif
 
   curfile = reading_file;
   reading_file = &ebuf.floc;
 
-  eval (&ebuf, !(flags & RM_NO_DEFAULT_GOAL));
+  if (flags & RM_DEPFILE)
+    eval_depfile (&ebuf, !(flags & RM_NO_DEFAULT_GOAL));
+  else
+    eval (&ebuf, !(flags & RM_NO_DEFAULT_GOAL));
 
   reading_file = curfile;
 
+#ifdef HAVE_MMAP
+  if (ebuf.map)
+    munmap (ebuf.map, ebuf.maplen);
+#endif
   fclose (ebuf.fp);
 
   free (ebuf.bufstart);
@@ -466,6 +497,8 @@ eval_buffer (char *buffer, const gmk_floc *floc)
   ebuf.size = strlen (buffer);
   ebuf.buffer = ebuf.bufnext = ebuf.bufstart = buffer;
   ebuf.fp = NULL;
+  ebuf.map = NULL;
+  ebuf.maplen = 0;
 
   if (floc)
     ebuf.floc = *floc;
@@ -490,6 +523,228 @@ eval_buffer (char *buffer, const gmk_floc *floc)
 
   alloca (0);
 }
+
+/* Return where the next line of EBUF starts, or -1 if we can't go back
+   there.  */
+
+static long
+ebuffer_tell (struct ebuffer *ebuf)
+{
+  if (ebuf->map)
+    return ebuf->bufnext - ebuf->map;
+  return ftell (ebuf->fp);
+}
+
+/* Go back to where ebuffer_tell said a line starts.  */
+
+static void
+ebuffer_seek (struct ebuffer *ebuf, long off)
+{
+  if (ebuf->map)
+    ebuf->bufnext = ebuf->map + off;
+  else if (fseek (ebuf->fp, off, SEEK_SET) != 0)
+    pfatal_with_name (ebuf->floc.filenm);
+}
+
+/* Words that begin a directive, rather than a rule, even if the line has a
+   colon in it.  */
+
+static const char *const directives[] =
+  {
+    "define", "endef", "undefine", "export", "unexport", "override",
+    "private", "vpath", "include", "-include", "sinclude", "include-deps",
+    "-include-deps", "load", "-load", "ifdef", "ifndef", "ifeq", "ifneq",
+    "else", "endif", 0
+  };
+
+/* Enter the targets in TARGETS, each with a copy of DEPS (or DEPS itself,
+   for the last one), as rules without recipes.  This is what record_files
+   does for the rules eval_depfile takes.  */
+
+static void
+record_deps (const char **targets, unsigned int ntargets, struct dep *deps,
+             const gmk_floc *flocp)
+{
+  unsigned int i;
+
+  for (i = 0; i < ntargets; ++i)
+    {
+      struct dep *this = i + 1 < ntargets ? copy_dep_chain (deps) : deps;
+      struct file *f = enter_file (targets[i]);
+
+      if (f->double_colon)
+        OS (fatal, flocp,
+            _("target file '%s' has both : and :: entries"), f->name);
+      f->is_target = 1;
+
+      if (this == 0)
+        continue;
+      if (f->deps == 0)
+        f->deps = this;
+      else
+        {
+          struct dep *d = f->deps;
+          while (d->next != 0)
+            d = d->next;
+          d->next = this;
+        }
+    }
+}
+
+/* Read a makefile of the kind compilers write with -MD, for include-deps:
+   rules with targets and prerequisites, and no recipes.  These files can
+   be very large, and all eval would do for each of their lines is to
+   find out that there is nothing to expand, no variable to assign and no
+   wildcard to glob before calling record_files.  So take such lines apart
+   here and enter the files directly.
+
+   At the first line that isn't a plain rule, give the rest of the file to
+   eval, starting with the rule before it in case that line is part of its
+   recipe.  eval also reads the whole file if it might set the default
+   goal.  */
+
+static void
+eval_depfile (struct ebuffer *ebuf, int set_default)
+{
+  static const char **targets = 0;
+  static unsigned int max_targets = 0;
+  unsigned int ntargets = 0;
+  struct dep *deps = 0;
+  gmk_floc fi;
+  long pos = 0;
+  long here;
+  long nlines = 0;
+  char *line;
+
+  fi.filenm = ebuf->floc.filenm;
+  fi.lineno = 0;
+
+  if (snapped_deps || ebuffer_tell (ebuf) < 0
+      || (set_default && default_goal_var->value[0] == '\0'))
+    {
+      eval (ebuf, set_default);
+      return;
+    }
+
+  while (1)
+    {
+      char *p;
+      char *colon;
+      struct dep **dp;
+      unsigned int len;
+      const char *const *dir;
+
+      ebuf->floc.lineno += nlines;
+      here = ebuffer_tell (ebuf);
+      nlines = readline (ebuf);
+      if (nlines < 0)
+        break;
+
+      line = ebuf->buffer;
+      if (line[0] == cmd_prefix || (unsigned char) line[0] == 0xEF)
+        goto punt;
+
+      collapse_continuations (line);
+      p = next_token (line);
+      if (*p == '\0' || *p == '#')
+        continue;
+
+      /* Anything that eval would treat specially is for eval to do.  */
+      colon = strchr (p, ':');
+      if (colon == 0 || colon == p || strchr (colon + 1, ':') != 0
+          || strpbrk (p, "$;=%#?*[()\\|~") != 0)
+        goto punt;
+
+      len = end_of_token (p) - p;
+      for (dir = directives; *dir != 0; ++dir)
+        if (strlen (*dir) == len && strneq (*dir, p, len))
+          goto punt;
+
+      /* This is a rule, so the one before it is complete.  */
+      if (ntargets != 0)
+        record_deps (targets, ntargets, deps, &fi);
+      ntargets = 0;
+      deps = 0;
+
+      /* The prerequisites are entered first, as record_files does.  */
+      *colon = '\0';
+      dp = &deps;
+      for (p = next_token (colon + 1); *p != '\0'; p = next_token (p))
+        {
+          char *s = p;
+          struct dep *d;
+
+          p = end_of_token (p);
+          if (*p != '\0')
+            *p++ = '\0';
+
+          /* Strip leading "./"s, as parse_file_seq does.  */
+          while (strlen (s) > 2 && s[0] == '.' && s[1] == '/')
+            {
+              s += 2;
+              while (*s == '/')
+                ++s;
+            }
+
+          d = alloc_dep ();
+          d->file = lookup_file (s);
+          if (d->file == 0)
+            d->file = enter_file (strcache_add (s));
+          *dp = d;
+          dp = &d->next;
+        }
+
+      for (p = next_token (line); *p != '\0'; p = next_token (p))
+        {
+          char *s = p;
+
+          p = end_of_token (p);
+          if (*p != '\0')
+            *p++ = '\0';
+
+          while (strlen (s) > 2 && s[0] == '.' && s[1] == '/')
+            {
+              s += 2;
+              while (*s == '/')
+                ++s;
+            }
+
+          /* Special targets mean something to record_files.  */
+          if (s[0] == '.' && strchr (s, '/') == 0)
+            {
+              free_dep_chain (deps);
+              deps = 0;
+              ntargets = 0;
+              goto punt;
+            }
+
+          if (ntargets == max_targets)
+            {
+              max_targets = max_targets ? max_targets * 2 : 8;
+              targets = xrealloc (targets, max_targets * sizeof (char *));
+            }
+          targets[ntargets++] = strcache_add (s);
+        }
+
+      pos = here;
+      fi.lineno = ebuf->floc.lineno;
+    }
+
+  if (ntargets != 0)
+    record_deps (targets, ntargets, deps, &fi);
+  return;
+
+ punt:
+  /* Start eval at the last rule we have, if any.  */
+  if (ntargets != 0)
+    {
+      free_dep_chain (deps);
+      here = pos;
+      ebuf->floc.lineno = fi.lineno;
+    }
+  ebuffer_seek (ebuf, here);
+  eval (ebuf, set_default);
+}
 
 /* Check LINE to see if it's a variable assignment or undefine.
 
@@ -855,6 +1110,7 @@ eval (struct ebuffer *ebuf, int set_default)
           else
             /* No pattern means remove all previous selective VPATH's.  */
             vpat = 0;
+          readcache_note_vpath (vpat, p);
           construct_vpath_list (vpat, p);
           if (vpat != 0)
             free (vpat);
@@ -863,7 +1119,8 @@ eval (struct ebuffer *ebuf, int set_default)
         }
 
       /* Handle include and variants.  */
-      if (word1eq ("include") || word1eq ("-include") || word1eq ("sinclude"))
+      if (word1eq ("include") || word1eq ("-include") || word1eq ("sinclude")
+          || word1eq ("include-deps") || word1eq ("-include-deps"))
         {
           /* We have found an 'include' line specifying a nested
              makefile to be read at this point.  */
@@ -873,6 +1130,8 @@ eval (struct ebuffer *ebuf, int set_default)
           /* "-include" (vs "include") says no error if the file does not
              exist.  "sinclude" is an alias for this from SGI.  */
           int noerror = (p[0] != 'i');
+          /* "include-deps" says the files were written by a compiler.  */
+          int depfile = p[wlen - 1] == 's';
 
           /* Include ends the previous rule.  */
           record_waiting_files ();
@@ -913,6 +1172,7 @@ eval (struct ebuffer *ebuf, int set_default)
               r = eval_makefile (name,
                                  (RM_INCLUDED | RM_NO_TILDE
                                   | (noerror ? RM_DONTCARE : 0)
+                                  | (depfile ? RM_DEPFILE : 0)
                                   | (set_default ? 0 : RM_NO_DEFAULT_GOAL)));
               if (!r && !noerror)
                 {
@@ -937,6 +1197,9 @@ eval (struct ebuffer *ebuf, int set_default)
           /* Load ends the previous rule.  */
           record_waiting_files ();
 
+          /* Loaded objects can do anything: we can't cache the result.  */
+          readcache_taint ("load");
+
           p = allocated_variable_expand (p2);
 
           /* If no filenames, it's a no-op.  */
@@ -2503,6 +2766,128 @@ readstring (struct ebuffer *ebuf)
   return 0;
 }
 
+#ifdef HAVE_MMAP
+
+/* Map the makefile open on EBUF->fp into memory, so readline can find
+   whole lines with memchr and copy each one at once, instead of going
+   through stdio a piece at a time.  The mapping is read-only: eval
+   writes into the lines it is given, and letting it write into the
+   mapping would make every page of the file a private copy.
+
+   Files that aren't regular files, and files with a NUL in them (about
+   which readline has to warn), are left to be read with fgets.  */
+
+static void
+map_makefile (struct ebuffer *ebuf)
+{
+  struct stat st;
+  void *map;
+
+  if (fstat (fileno (ebuf->fp), &st) != 0 || !S_ISREG (st.st_mode)
+      || st.st_size <= 0 || (off_t) (size_t) st.st_size != st.st_size)
+    return;
+
+  map = mmap (0, st.st_size, PROT_READ, MAP_PRIVATE, fileno (ebuf->fp), 0);
+  if (map == MAP_FAILED)
+    return;
+
+  if (memchr (map, '\0', st.st_size) != 0)
+    {
+      munmap (map, st.st_size);
+      return;
+    }
+
+  ebuf->map = ebuf->bufnext = map;
+  ebuf->maplen = st.st_size;
+}
+
+/* Find the next line of a mapped makefile, as readline would, and copy it
+   to the buffer.  Return the number of lines read, -1 at the end of the
+   file, or 0 if the line must be rewritten: if it ends with CRLF, or is
+   the last and has no newline.  Then EBUF is unchanged and readline reads
+   the line with mapgets.  */
+
+static long
+readmapped (struct ebuffer *ebuf)
+{
+  char *bol = ebuf->bufnext;
+  char *end = ebuf->map + ebuf->maplen;
+  char *eol;
+  char *p;
+  long nlines = 0;
+
+  if (bol == end)
+    return -1;
+
+  for (p = bol; ; p = eol + 1)
+    {
+      char *p2;
+      int backslash = 0;
+
+      eol = memchr (p, '\n', end - p);
+      if (eol == 0)
+        return 0;
+#if !defined(WINDOWS32) && !defined(__MSDOS__) && !defined(__EMX__)
+      if (eol > p && eol[-1] == '\r')
+        return 0;
+#endif
+      ++nlines;
+
+      for (p2 = eol - 1; p2 >= p && *p2 == '\\'; --p2)
+        backslash = !backslash;
+      if (!backslash)
+        break;
+
+      /* A backslash/newline at the very end is kept in the line.  */
+      if (eol + 1 == end)
+        return 0;
+    }
+
+  if ((size_t) (eol - bol) >= ebuf->size)
+    {
+      ebuf->size = (eol - bol) * 2;
+      free (ebuf->bufstart);
+      ebuf->bufstart = xmalloc (ebuf->size);
+    }
+  memcpy (ebuf->bufstart, bol, eol - bol);
+  ebuf->bufstart[eol - bol] = '\0';
+  ebuf->buffer = ebuf->bufstart;
+  ebuf->bufnext = eol + 1;
+
+  return nlines;
+}
+
+/* Read from a mapped makefile like fgets.  */
+
+static char *
+mapgets (char *buf, int n, struct ebuffer *ebuf)
+{
+  char *src = ebuf->bufnext;
+  size_t len = ebuf->map + ebuf->maplen - src;
+  char *nl;
+
+  if (len == 0)
+    return 0;
+
+  if (len > (size_t) n - 1)
+    len = n - 1;
+  nl = memchr (src, '\n', len);
+  if (nl)
+    len = nl + 1 - src;
+
+  memcpy (buf, src, len);
+  buf[len] = '\0';
+  ebuf->bufnext = src + len;
+
+  return buf;
+}
+
+# define READ_CHUNK(_b,_n,_e) \
+    ((_e)->map ? mapgets ((_b), (_n), (_e)) : fgets ((_b), (_n), (_e)->fp))
+#else
+# define READ_CHUNK(_b,_n,_e) fgets ((_b), (_n), (_e)->fp)
+#endif /* HAVE_MMAP */
+
 static long
 readline (struct ebuffer *ebuf)
 {
@@ -2517,14 +2902,23 @@ readline (struct ebuffer *ebuf)
   if (!ebuf->fp)
     return readstring (ebuf);
 
+#ifdef HAVE_MMAP
+  if (ebuf->map)
+    {
+      nlines = readmapped (ebuf);
+      if (nlines != 0)
+        return nlines;
+    }
+#endif
+
   /* When reading from a file, we always start over at the beginning of the
      buffer for each new line.  */
 
-  p = start = ebuf->bufstart;
+  p = start = ebuf->buffer = ebuf->bufstart;
   end = p + ebuf->size;
   *p = '\0';
 
-  while (fgets (p, end - p, ebuf->fp) != 0)
+  while (READ_CHUNK (p, end - p, ebuf) != 0)
     {
       char *p2;
       unsigned long len;
@@ -3021,7 +3415,7 @@ parse_file_seq (char **stringp, unsigned int size, int stopmap,
   struct nameseq **newp = &new;
 #define NEWELT(_n)  do { \
                         const char *__n = (_n); \
-                        *newp = xcalloc (size); \
+                        *newp = alloc_ns (); \
                         (*newp)->name = (cachep ? strcache_add (__n) : xstrdup (__n)); \
                         newp = &(*newp)->next; \
                     } while(0)
@@ -3035,6 +3429,7 @@ parse_file_seq (char **stringp, unsigned int size, int stopmap,
 
   if (size < sizeof (struct nameseq))
     size = sizeof (struct nameseq);
+  assert (size <= dep_pool.size);
 
   if (NONE_SET (flags, PARSEFS_NOGLOB))
     dir_setup_glob (&gl);
@@ -3305,13 +3700,19 @@ parse_file_seq (char **stringp, unsigned int size, int stopmap,
             break;
           }
 
+      /* The result of a glob depends on the directory it scanned.  */
+      if (globme)
+        readcache_note_glob (name);
+
       /* For each matched element, add it to the list.  */
       while (i-- > 0)
 #ifndef NO_ARCHIVES
         if (memname != 0)
           {
             /* Try to glob on MEMNAME within the archive.  */
-            struct nameseq *found = ar_glob (nlist[i], memname, size);
+            struct nameseq *found;
+            readcache_note_file (nlist[i]);
+            found = ar_glob (nlist[i], memname, size);
             if (! found)
               /* No matches.  Use MEMNAME as-is.  */
               NEWELT (concat (5, prefix, nlist[i], "(", memname, ")"));
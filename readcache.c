@@ -0,0 +1,1465 @@
+/* Persistent cache of the makefile data base for GNU Make.
+Copyright (C) 2013 Free Software Foundation, Inc.
+This file is part of GNU Make.
+
+GNU Make is free software; you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation; either version 3 of the License, or (at your option) any later
+version.
+
+GNU Make is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "makeint.h"
+
+#include <assert.h>
+#include <fnmatch.h>
+
+#ifdef HAVE_FCNTL_H
+# include <fcntl.h>
+#else
+# include <sys/file.h>
+#endif
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+# include <sys/mman.h>
+# define USE_MMAP 1
+#endif
+
+#ifdef  HAVE_DIRENT_H
+# include <dirent.h>
+#else
+# define dirent direct
+# ifdef HAVE_SYS_NDIR_H
+#  include <sys/ndir.h>
+# endif
+# ifdef HAVE_SYS_DIR_H
+#  include <sys/dir.h>
+# endif
+# ifdef HAVE_NDIR_H
+#  include <ndir.h>
+# endif
+#endif
+
+#include "filedef.h"
+#include "dep.h"
+#include "variable.h"
+#include "rule.h"
+#include "job.h"
+#include "commands.h"
+#include "debug.h"
+#include "hash.h"
+
+/* The parse cache holds a snapshot of everything that reading the makefiles
+   put into the data base: global, target- and pattern-specific variables,
+   the file and dependency graph, pattern rules and vpath directives.  It is
+   written at the end of read_all_makefiles() and used in place of reading
+   the makefiles when none of its inputs have changed.
+
+   The inputs are the command line, the environment, the current directory
+   and every file make looked at while reading: makefiles that were read,
+   makefiles that were searched for but not found, and directories that
+   were scanned for wildcards.  Anything else that could make the result of
+   reading differ between two runs ($(shell ...), 'load', output printed
+   while reading, ...) "taints" the read and no cache is written.
+
+   The file starts with a fixed magic string, followed by a header holding
+   the format version, the key and the list of inputs, followed by the
+   payload and its checksum.  All numbers are stored as little-endian base
+   128 varints so the format does not depend on the host word size.  */
+
+#define RC_MAGIC        "GMKRDC\r\n"
+#define RC_MAGIC_LEN    CSTRLEN (RC_MAGIC)
+#define RC_VERSION      1
+
+/* Nonzero while the read phase is being recorded.  */
+
+static int recording = 0;
+
+/* The cache file and the key computed from our invocation.  */
+
+static const char *cache_file = 0;
+static const char *cache_base;
+static uintmax_t cache_key;
+
+/* If non-null, the reason we can't write a cache for this read.  */
+
+static const char *taint_reason = 0;
+
+/* The files and directories that were consulted while reading.  */
+
+struct rc_input
+  {
+    const char *name;
+    unsigned int exists;
+    uintmax_t mtime;            /* For directories, see dir_digest().  */
+    uintmax_t mtime_ns;
+    uintmax_t size;
+    uintmax_t ino;
+  };
+
+static struct hash_table inputs;
+
+
+/* Hash table of inputs, keyed on the file name.  */
+
+static unsigned long
+input_hash_1 (const void *key)
+{
+  return_STRING_HASH_1 (((const struct rc_input *) key)->name);
+}
+
+static unsigned long
+input_hash_2 (const void *key)
+{
+  return_STRING_HASH_2 (((const struct rc_input *) key)->name);
+}
+
+static int
+input_hash_cmp (const void *x, const void *y)
+{
+  return_STRING_COMPARE (((const struct rc_input *) x)->name,
+                         ((const struct rc_input *) y)->name);
+}
+
+/* A directory's mtime changes whenever an entry is added or removed, which
+   includes writing the cache itself.  So for directories we use a digest of
+   the names they contain instead, ignoring the cache and its temporary
+   files.  The digest doesn't depend on the order readdir() returns.  */
+
+static uintmax_t
+dir_digest (const char *name)
+{
+  size_t baselen = strlen (cache_base);
+  uintmax_t digest = 0;
+  struct dirent *d;
+  DIR *dir;
+
+  ENULLLOOP (dir, opendir (name));
+  if (dir == 0)
+    return 0;
+
+  while ((d = readdir (dir)) != 0)
+    if (baselen == 0 || strncmp (d->d_name, cache_base, baselen) != 0)
+      digest += fnv_add_str (FNV_OFFSET, d->d_name);
+
+  closedir (dir);
+  return digest;
+}
+
+/* Fill in the current state of INPUT->name.  */
+
+static void
+stat_input (struct rc_input *input)
+{
+  struct stat st;
+  int e;
+
+  EINTRLOOP (e, stat (input->name, &st));
+  if (e != 0)
+    {
+      input->exists = 0;
+      input->mtime = input->mtime_ns = input->size = input->ino = 0;
+      return;
+    }
+
+  input->exists = 1;
+  input->ino = (uintmax_t) st.st_ino;
+
+  if (S_ISDIR (st.st_mode))
+    {
+      input->mtime = dir_digest (input->name);
+      input->mtime_ns = input->size = 0;
+      return;
+    }
+
+  input->mtime = (uintmax_t) st.st_mtime;
+#ifdef ST_MTIM_NSEC
+  input->mtime_ns = (uintmax_t) st.ST_MTIM_NSEC;
+#else
+  input->mtime_ns = 0;
+#endif
+  input->size = (uintmax_t) st.st_size;
+}
+
+
+/* Start recording the read phase for the cache in FILE.  The key covers
+   everything about this invocation that can change what reading the
+   makefiles produces, apart from the files themselves.  If FILE is null,
+   only the inputs are recorded (see readcache_input_p()).  */
+
+void
+readcache_init (const char *file, char **argv)
+{
+  struct variable *v;
+  char **ep;
+
+  cache_file = file;
+  cache_base = file ? strrchr (file, '/') : 0;
+  cache_base = cache_base ? cache_base + 1 : file ? file : "";
+
+  cache_key = fnv_add_str (FNV_OFFSET, version_string);
+  for (; *argv != 0; ++argv)
+    cache_key = fnv_add_str (cache_key, *argv);
+  cache_key = fnv_add (cache_key, "", 1);
+  for (ep = environ; *ep != 0; ++ep)
+    cache_key = fnv_add_str (cache_key, *ep);
+  cache_key = fnv_add (cache_key, "", 1);
+
+  v = lookup_variable (STRING_SIZE_TUPLE ("CURDIR"));
+  if (v != 0)
+    cache_key = fnv_add_str (cache_key, v->value);
+
+  hash_init (&inputs, 200, input_hash_1, input_hash_2, input_hash_cmp);
+
+  recording = 1;
+  taint_reason = 0;
+}
+
+/* Note that the read phase looked at the file or directory NAME.  */
+
+void
+readcache_note_file (const char *name)
+{
+  struct rc_input key;
+  struct rc_input **slot;
+  struct rc_input *input;
+
+  if (!recording)
+    return;
+
+  key.name = name;
+  slot = (struct rc_input **) hash_find_slot (&inputs, &key);
+  if (! HASH_VACANT (*slot))
+    return;
+
+  input = xmalloc (sizeof (struct rc_input));
+  input->name = strcache_add (name);
+  stat_input (input);
+  hash_insert_at (&inputs, input, slot);
+}
+
+/* The wildcard patterns that were expanded, for readcache_glob_match_p().  */
+
+struct rc_glob
+  {
+    struct rc_glob *next;
+    const char *pattern;
+  };
+
+static struct rc_glob *globs = 0;
+
+/* Note that the read phase expanded the glob PATTERN.  The result only
+   depends on the contents of the directory being scanned, so that is what
+   becomes an input.  Patterns with wildcards in their directory part could
+   scan any number of directories: we give up on those.  */
+
+void
+readcache_note_glob (const char *pattern)
+{
+  struct rc_glob *g;
+  const char *slash;
+  const char *p;
+
+  if (!recording)
+    return;
+
+  /* Without wildcards, glob() only checks that the file exists.  */
+  if (strpbrk (pattern, "?*[") == 0)
+    {
+      readcache_note_file (pattern);
+      return;
+    }
+
+  g = xmalloc (sizeof (struct rc_glob));
+  g->pattern = strcache_add (pattern);
+  g->next = globs;
+  globs = g;
+
+  slash = strrchr (pattern, '/');
+  if (slash == 0)
+    {
+      readcache_note_file (".");
+      return;
+    }
+
+  for (p = pattern; p < slash; ++p)
+    if (*p == '*' || *p == '?' || *p == '[')
+      {
+        readcache_taint ("wildcard directory");
+        return;
+      }
+
+  if (slash == pattern)
+    readcache_note_file ("/");
+  else
+    {
+      char *dir = xstrndup (pattern, slash - pattern);
+      readcache_note_file (dir);
+      free (dir);
+    }
+}
+
+/* Note that something happened in the read phase which we can't reproduce
+   from the cache.  REASON is shown in the debugging output.  */
+
+void
+readcache_taint (const char *reason)
+{
+  if (recording && taint_reason == 0)
+    taint_reason = reason;
+}
+
+
+/* Return nonzero if NAME was an input of the last read, and so changing it
+   could change the data base.  */
+
+int
+readcache_input_p (const char *name)
+{
+  struct rc_input key;
+
+  if (inputs.ht_vec == 0)
+    return 0;
+
+  key.name = name;
+  return hash_find_item (&inputs, &key) != 0;
+}
+
+/* Return nonzero if NAME matches one of the wildcards expanded by the last
+   read, and so creating or removing it could change the data base.  Names
+   in the current directory have no directory part.  */
+
+int
+readcache_glob_match_p (const char *name)
+{
+  const struct rc_glob *g;
+
+  for (g = globs; g != 0; g = g->next)
+    if (fnmatch (g->pattern, name, FNM_PATHNAME|FNM_PERIOD) == 0)
+      return 1;
+
+  return 0;
+}
+
+/* Return the reason the last read can't be cached, or null.  */
+
+const char *
+readcache_tainted (void)
+{
+  return taint_reason;
+}
+
+struct map_inputs_arg
+  {
+    void (*func) (const char *name, void *arg);
+    void *arg;
+  };
+
+static void
+map_input (const void *item, void *arg)
+{
+  struct map_inputs_arg *m = arg;
+  m->func (((const struct rc_input *) item)->name, m->arg);
+}
+
+/* Call FUNC with ARG for the name of every input of the last read.  */
+
+void
+readcache_map_inputs (void (*func) (const char *name, void *arg), void *arg)
+{
+  struct map_inputs_arg m;
+
+  if (inputs.ht_vec == 0)
+    return;
+
+  m.func = func;
+  m.arg = arg;
+  hash_map_arg (&inputs, map_input, &m);
+}
+
+
+/* Record the vpath directives in the order they appeared, so they can be
+   replayed: construct_vpath_list() does the work of merging them.  */
+
+struct rc_vpath
+  {
+    struct rc_vpath *next;
+    char *pattern;
+    char *dirpath;
+  };
+
+static struct rc_vpath *vpath_directives = 0;
+static struct rc_vpath **vpath_tail = &vpath_directives;
+
+void
+readcache_note_vpath (const char *pattern, const char *dirpath)
+{
+  struct rc_vpath *vp;
+
+  if (!recording)
+    return;
+
+  vp = xmalloc (sizeof (struct rc_vpath));
+  vp->next = 0;
+  vp->pattern = pattern ? xstrdup (pattern) : 0;
+  vp->dirpath = dirpath ? xstrdup (dirpath) : 0;
+  *vpath_tail = vp;
+  vpath_tail = &vp->next;
+}
+
+
+/* Writing the cache.  */
+
+static char *wbuf = 0;
+static size_t wlen = 0;
+static size_t wsize = 0;
+
+static void
+put_bytes (const void *p, size_t len)
+{
+  if (wlen + len > wsize)
+    {
+      wsize = (wlen + len) * 2;
+      wbuf = xrealloc (wbuf, wsize);
+    }
+  memcpy (wbuf + wlen, p, len);
+  wlen += len;
+}
+
+static void
+put_num (uintmax_t n)
+{
+  unsigned char buf[(sizeof (uintmax_t) * CHAR_BIT + 6) / 7];
+  unsigned int i = 0;
+
+  do
+    {
+      buf[i] = n & 0x7f;
+      n >>= 7;
+      if (n)
+        buf[i] |= 0x80;
+      ++i;
+    }
+  while (n);
+
+  put_bytes (buf, i);
+}
+
+/* Strings are stored with their terminating nul so the loader can use them
+   in place.  A null pointer is stored as length 0.  */
+
+static void
+put_str (const char *s)
+{
+  if (s == 0)
+    put_num (0);
+  else
+    {
+      size_t len = strlen (s) + 1;
+      put_num (len);
+      put_bytes (s, len);
+    }
+}
+
+static void
+put_floc (const gmk_floc *floc)
+{
+  put_str (floc->filenm);
+  put_num (floc->lineno);
+}
+
+/* Recipes are often shared between the targets of a rule, so each one is
+   written once and then referred to by its index.  0 is no recipe, 1..N is
+   a recipe already written, and N+1 means a new one follows.  */
+
+struct cmds_index
+  {
+    const struct commands *cmds;
+    unsigned long index;
+  };
+
+static struct hash_table cmds_written;
+
+static unsigned long
+cmds_hash_1 (const void *key)
+{
+  return_ADDRESS_HASH_1 (((const struct cmds_index *) key)->cmds);
+}
+
+static unsigned long
+cmds_hash_2 (const void *key)
+{
+  return_ADDRESS_HASH_2 (((const struct cmds_index *) key)->cmds);
+}
+
+static int
+cmds_hash_cmp (const void *x, const void *y)
+{
+  const struct commands *cx = ((const struct cmds_index *) x)->cmds;
+  const struct commands *cy = ((const struct cmds_index *) y)->cmds;
+  return cx == cy ? 0 : cx < cy ? -1 : 1;
+}
+
+static void
+put_cmds (const struct commands *cmds)
+{
+  struct cmds_index key;
+  struct cmds_index **slot;
+  struct cmds_index *ci;
+
+  if (cmds == 0)
+    {
+      put_num (0);
+      return;
+    }
+
+  key.cmds = cmds;
+  slot = (struct cmds_index **) hash_find_slot (&cmds_written, &key);
+  if (! HASH_VACANT (*slot))
+    {
+      put_num ((*slot)->index + 1);
+      return;
+    }
+
+  ci = xmalloc (sizeof (struct cmds_index));
+  ci->cmds = cmds;
+  ci->index = cmds_written.ht_fill;
+  hash_insert_at (&cmds_written, ci, slot);
+
+  put_num (ci->index + 1);
+  put_floc (&cmds->fileinfo);
+  put_str (cmds->commands);
+  put_num ((unsigned char) cmds->recipe_prefix);
+}
+
+#define DEP_FILE        (1 << 0)
+#define DEP_IGNORE_MTIME (1 << 1)
+#define DEP_STATICPATTERN (1 << 2)
+#define DEP_2ND_EXPANSION (1 << 3)
+#define DEP_DONTCARE    (1 << 4)
+
+static void
+put_deps (const struct dep *d)
+{
+  const struct dep *dp;
+  unsigned long n = 0;
+
+  for (dp = d; dp != 0; dp = dp->next)
+    ++n;
+  put_num (n);
+
+  for (; d != 0; d = d->next)
+    {
+      put_str (dep_name (d));
+      put_num ((d->file ? DEP_FILE : 0)
+               | (d->ignore_mtime ? DEP_IGNORE_MTIME : 0)
+               | (d->staticpattern ? DEP_STATICPATTERN : 0)
+               | (d->need_2nd_expansion ? DEP_2ND_EXPANSION : 0)
+               | (d->dontcare ? DEP_DONTCARE : 0));
+      put_num (d->changed);
+      put_str (d->stem);
+    }
+}
+
+#define VAR_RECURSIVE   (1 << 0)
+#define VAR_APPEND      (1 << 1)
+#define VAR_CONDITIONAL (1 << 2)
+#define VAR_PER_TARGET  (1 << 3)
+#define VAR_SPECIAL     (1 << 4)
+#define VAR_EXPORTABLE  (1 << 5)
+#define VAR_PRIVATE     (1 << 6)
+
+static void
+put_variable (const struct variable *v)
+{
+  put_str (v->name);
+  put_str (v->value);
+  put_floc (&v->fileinfo);
+  put_num ((v->recursive ? VAR_RECURSIVE : 0)
+           | (v->append ? VAR_APPEND : 0)
+           | (v->conditional ? VAR_CONDITIONAL : 0)
+           | (v->per_target ? VAR_PER_TARGET : 0)
+           | (v->special ? VAR_SPECIAL : 0)
+           | (v->exportable ? VAR_EXPORTABLE : 0)
+           | (v->private_var ? VAR_PRIVATE : 0));
+  put_num (v->exp_count);
+  put_num (v->flavor);
+  put_num (v->origin);
+  put_num (v->export);
+}
+
+static void
+put_variable_1 (const void *item, void *arg UNUSED)
+{
+  put_variable ((const struct variable *) item);
+}
+
+static void
+put_variable_set (struct variable_set *set)
+{
+  put_num (set->table.ht_fill);
+  hash_map_arg (&set->table, put_variable_1, 0);
+}
+
+#define FILE_IS_TARGET  (1 << 0)
+#define FILE_BUILTIN    (1 << 1)
+#define FILE_LOADED     (1 << 2)
+#define FILE_DONTCARE   (1 << 3)
+#define FILE_CMD_TARGET (1 << 4)
+#define FILE_PRECIOUS   (1 << 5)
+#define FILE_PHONY      (1 << 6)
+#define FILE_INTERMEDIATE (1 << 7)
+#define FILE_SECONDARY  (1 << 8)
+#define FILE_DOUBLE_COLON (1 << 9)
+
+static void
+put_file_entry (const struct file *f)
+{
+  put_num ((f->is_target ? FILE_IS_TARGET : 0)
+           | (f->builtin ? FILE_BUILTIN : 0)
+           | (f->loaded ? FILE_LOADED : 0)
+           | (f->dontcare ? FILE_DONTCARE : 0)
+           | (f->cmd_target ? FILE_CMD_TARGET : 0)
+           | (f->precious ? FILE_PRECIOUS : 0)
+           | (f->phony ? FILE_PHONY : 0)
+           | (f->intermediate ? FILE_INTERMEDIATE : 0)
+           | (f->secondary ? FILE_SECONDARY : 0)
+           | (f->double_colon ? FILE_DOUBLE_COLON : 0));
+  put_str (f->stem);
+  put_cmds (f->cmds);
+  put_deps (f->deps);
+
+  if (f->variables == 0)
+    put_num (0);
+  else
+    put_variable_set (f->variables->set);
+}
+
+/* Write a file and, for double-colon rules, all the other entries that
+   share its name.  */
+
+static void
+put_file (const void *item, void *arg UNUSED)
+{
+  const struct file *f = item;
+  const struct file *e;
+  unsigned long n = 0;
+
+  for (e = f; e != 0; e = e->prev)
+    ++n;
+
+  put_str (f->name);
+  put_num (n);
+  for (e = f; e != 0; e = e->prev)
+    put_file_entry (e);
+}
+
+static void
+count_file (const void *item UNUSED, void *arg)
+{
+  ++*(unsigned long *) arg;
+}
+
+static void
+put_rule (const struct rule *r)
+{
+  unsigned int i;
+
+  put_num (r->num);
+  put_num (r->terminal);
+  for (i = 0; i < r->num; ++i)
+    {
+      put_str (r->targets[i]);
+      put_num (r->suffixes[i] - r->targets[i]);
+    }
+  put_deps (r->deps);
+  put_cmds (r->cmds);
+}
+
+static void
+put_payload (struct dep *read_files, const char **makefiles)
+{
+  unsigned long n;
+  struct rule *r;
+  struct pattern_var *p;
+  struct rc_vpath *vp;
+  struct dep *d;
+  const char **mp;
+
+  /* Global state that reading can change outside of the data base.  */
+  put_num (posix_pedantic);
+  put_num (second_expansion);
+  put_num (one_shell);
+  put_num (export_all_variables);
+  put_num ((unsigned char) cmd_prefix);
+
+  /* We're called at the end of reading, so the current set is global.  */
+  assert (current_variable_set_list->next == 0);
+  put_variable_set (current_variable_set_list->set);
+
+  n = 0;
+  map_files (count_file, &n);
+  put_num (n);
+  map_files (put_file, 0);
+
+  for (n = 0, r = pattern_rules; r != 0; r = r->next)
+    ++n;
+  put_num (n);
+  for (r = pattern_rules; r != 0; r = r->next)
+    put_rule (r);
+
+  for (n = 0, p = next_pattern_var (0); p != 0; p = next_pattern_var (p))
+    ++n;
+  put_num (n);
+  for (p = next_pattern_var (0); p != 0; p = next_pattern_var (p))
+    {
+      put_str (p->target);
+      put_num (p->suffix - p->target);
+      put_variable (&p->variable);
+    }
+
+  for (n = 0, vp = vpath_directives; vp != 0; vp = vp->next)
+    ++n;
+  put_num (n);
+  for (vp = vpath_directives; vp != 0; vp = vp->next)
+    {
+      put_str (vp->pattern);
+      put_str (vp->dirpath);
+    }
+
+  for (n = 0, d = read_files; d != 0; d = d->next)
+    ++n;
+  put_num (n);
+  for (d = read_files; d != 0; d = d->next)
+    {
+      put_str (d->file->name);
+      put_num (d->changed);
+      put_num (d->dontcare);
+    }
+
+  n = 0;
+  if (makefiles != 0)
+    for (mp = makefiles; *mp != 0; ++mp)
+      ++n;
+  put_num (n);
+  if (makefiles != 0)
+    for (mp = makefiles; *mp != 0; ++mp)
+      put_str (*mp);
+}
+
+static void
+put_input (const void *item, void *arg UNUSED)
+{
+  const struct rc_input *input = item;
+
+  put_str (input->name);
+  put_num (input->exists);
+  put_num (input->mtime);
+  put_num (input->mtime_ns);
+  put_num (input->size);
+  put_num (input->ino);
+}
+
+/* Stop recording and, unless something tainted the read, write the cache.
+   READ_FILES and MAKEFILES are as returned by read_all_makefiles().  */
+
+void
+readcache_save (struct dep *read_files, const char **makefiles)
+{
+  char *payload;
+  size_t plen;
+  uintmax_t sum;
+  char *tmp;
+  FILE *fp;
+
+  if (!recording)
+    return;
+  recording = 0;
+
+  if (cache_file == 0)
+    return;
+
+  if (taint_reason != 0)
+    {
+      DB (DB_VERBOSE, (_("Not updating parse cache '%s': %s\n"),
+                       cache_file, taint_reason));
+      return;
+    }
+
+  DB (DB_BASIC, (_("Updating parse cache '%s'...\n"), cache_file));
+
+  /* Build the payload first: its length and checksum go in the header.  */
+  hash_init (&cmds_written, 1000, cmds_hash_1, cmds_hash_2, cmds_hash_cmp);
+  put_payload (read_files, makefiles);
+  hash_free (&cmds_written, 1);
+
+  payload = wbuf;
+  plen = wlen;
+  sum = fnv_add (FNV_OFFSET, payload, plen);
+  wbuf = 0;
+  wlen = wsize = 0;
+
+  put_bytes (RC_MAGIC, RC_MAGIC_LEN);
+  put_num (RC_VERSION);
+  put_str (version_string);
+  put_num (cache_key);
+  put_num (inputs.ht_fill);
+  hash_map_arg (&inputs, put_input, 0);
+  put_num (plen);
+  put_num (sum);
+
+  /* Write to a temporary file and rename it into place, so that concurrent
+     makes never see a partially written cache.  */
+  tmp = xmalloc (strlen (cache_file) + INTSTR_LENGTH + CSTRLEN (".tmp") + 2);
+  sprintf (tmp, "%s.%lu.tmp", cache_file, (unsigned long) getpid ());
+
+  fp = fopen (tmp, "wb");
+  if (fp == 0)
+    perror_with_name (_("parse cache: "), tmp);
+  else
+    {
+      int ok = fwrite (wbuf, 1, wlen, fp) == wlen
+        && fwrite (payload, 1, plen, fp) == plen;
+      if (fclose (fp) != 0)
+        ok = 0;
+      if (!ok || rename (tmp, cache_file) != 0)
+        {
+          perror_with_name (_("parse cache: "), tmp);
+          unlink (tmp);
+        }
+    }
+
+  free (tmp);
+  free (payload);
+  free (wbuf);
+  wbuf = 0;
+  wlen = wsize = 0;
+}
+
+
+/* Reading the cache.  */
+
+static const unsigned char *rp;
+static const unsigned char *rend;
+static int rbad;
+
+static uintmax_t
+get_num (void)
+{
+  uintmax_t n = 0;
+  unsigned int shift = 0;
+
+  while (rp < rend)
+    {
+      unsigned char c = *rp++;
+      if (shift < sizeof (uintmax_t) * CHAR_BIT)
+        n |= (uintmax_t) (c & 0x7f) << shift;
+      if (!(c & 0x80))
+        return n;
+      shift += 7;
+    }
+
+  rbad = 1;
+  return 0;
+}
+
+static const char *
+get_str (void)
+{
+  uintmax_t len = get_num ();
+  const char *s;
+
+  if (len == 0)
+    return 0;
+
+  if (len > (uintmax_t) (rend - rp) || rp[len - 1] != '\0')
+    {
+      rbad = 1;
+      rp = rend;
+      return "";
+    }
+
+  s = (const char *) rp;
+  rp += len;
+  return s;
+}
+
+static void
+get_floc (gmk_floc *floc)
+{
+  const char *filenm = get_str ();
+  floc->filenm = filenm ? strcache_add (filenm) : 0;
+  floc->lineno = get_num ();
+}
+
+static struct commands **cmds_read = 0;
+static unsigned long ncmds_read = 0;
+static unsigned long cmds_read_size = 0;
+
+static struct commands *
+get_cmds (void)
+{
+  uintmax_t idx = get_num ();
+  struct commands *cmds;
+
+  if (idx == 0)
+    return 0;
+  if (idx <= ncmds_read)
+    return cmds_read[idx - 1];
+  if (idx != ncmds_read + 1)
+    {
+      rbad = 1;
+      return 0;
+    }
+
+  cmds = xcalloc (sizeof (struct commands));
+  get_floc (&cmds->fileinfo);
+  cmds->commands = xstrdup (get_str ());
+  cmds->recipe_prefix = (char) get_num ();
+
+  if (ncmds_read == cmds_read_size)
+    {
+      cmds_read_size = cmds_read_size ? cmds_read_size * 2 : 256;
+      cmds_read = xrealloc (cmds_read,
+                            cmds_read_size * sizeof (struct commands *));
+    }
+  cmds_read[ncmds_read++] = cmds;
+
+  return cmds;
+}
+
+/* Find or create the data base entry for NAME, the way enter_prereqs()
+   does: an existing double-colon rule is referred to by its first entry.  */
+
+static struct file *
+get_file_ref (const char *name)
+{
+  struct file *f = lookup_file (name);
+  return f ? f : enter_file (strcache_add (name));
+}
+
+static struct dep *
+get_deps (void)
+{
+  uintmax_t n = get_num ();
+  struct dep *deps = 0;
+  struct dep **dp = &deps;
+
+  while (n-- > 0 && !rbad)
+    {
+      struct dep *d = alloc_dep ();
+      const char *name = get_str ();
+      unsigned int flags = get_num ();
+
+      if (ANY_SET (flags, DEP_FILE))
+        d->file = get_file_ref (name);
+      else if (ANY_SET (flags, DEP_2ND_EXPANSION))
+        d->name = xstrdup (name);
+      else
+        d->name = strcache_add (name);
+
+      d->ignore_mtime = ANY_SET (flags, DEP_IGNORE_MTIME);
+      d->staticpattern = ANY_SET (flags, DEP_STATICPATTERN);
+      d->need_2nd_expansion = ANY_SET (flags, DEP_2ND_EXPANSION);
+      d->dontcare = ANY_SET (flags, DEP_DONTCARE);
+      d->changed = get_num ();
+      name = get_str ();
+      d->stem = name ? strcache_add (name) : 0;
+
+      *dp = d;
+      dp = &d->next;
+    }
+
+  return deps;
+}
+
+/* Read a variable into V, which is already in the data base.  */
+
+static void
+get_variable_fields (struct variable *v)
+{
+  const char *value = get_str ();
+  unsigned int flags;
+
+  if (v->value != 0)
+    free (v->value);
+  v->value = xstrdup (value ? value : "");
+  get_floc (&v->fileinfo);
+
+  flags = get_num ();
+  v->recursive = ANY_SET (flags, VAR_RECURSIVE);
+  v->append = ANY_SET (flags, VAR_APPEND);
+  v->conditional = ANY_SET (flags, VAR_CONDITIONAL);
+  v->per_target = ANY_SET (flags, VAR_PER_TARGET);
+  v->special = ANY_SET (flags, VAR_SPECIAL);
+  v->exportable = ANY_SET (flags, VAR_EXPORTABLE);
+  v->private_var = ANY_SET (flags, VAR_PRIVATE);
+  v->expanding = 0;
+  v->exp_count = get_num ();
+  v->flavor = get_num ();
+  v->origin = get_num ();
+  v->export = get_num ();
+}
+
+/* Read N variables into SET, replacing any that are already defined.  */
+
+static void
+get_variable_set (struct variable_set *set, uintmax_t n)
+{
+  while (n-- > 0 && !rbad)
+    {
+      const char *name = get_str ();
+      unsigned int len;
+      struct variable *v;
+
+      if (name == 0)
+        {
+          rbad = 1;
+          break;
+        }
+
+      len = strlen (name);
+      v = lookup_variable_in_set (name, len, set);
+      if (v == 0)
+        v = define_variable_in_set (name, len, "", o_file, 0, set, NILF);
+      get_variable_fields (v);
+    }
+}
+
+/* Remove the global variables that reading the makefiles undefined.  */
+
+static unsigned long
+str_hash_1 (const void *key)
+{
+  return_STRING_HASH_1 ((const char *) key);
+}
+
+static unsigned long
+str_hash_2 (const void *key)
+{
+  return_STRING_HASH_2 ((const char *) key);
+}
+
+static int
+str_hash_cmp (const void *x, const void *y)
+{
+  return_STRING_COMPARE ((const char *) x, (const char *) y);
+}
+
+static void
+get_global_variables (void)
+{
+  struct variable_set *set = current_variable_set_list->set;
+  const unsigned char *start = rp;
+  struct hash_table names;
+  struct variable **vp, **end;
+  uintmax_t n;
+
+  get_variable_set (set, get_num ());
+  if (rbad)
+    return;
+
+  /* Walk the records again to collect the names we just defined.  */
+  rp = start;
+  n = get_num ();
+  hash_init (&names, n + 10, str_hash_1, str_hash_2, str_hash_cmp);
+  while (n-- > 0)
+    {
+      struct variable scratch;
+      hash_insert (&names, get_str ());
+      scratch.value = 0;
+      get_variable_fields (&scratch);
+      free (scratch.value);
+    }
+
+  vp = (struct variable **) set->table.ht_vec;
+  end = vp + set->table.ht_size;
+  for (; vp < end; ++vp)
+    if (! HASH_VACANT (*vp) && hash_find_item (&names, (*vp)->name) == 0)
+      undefine_variable_in_set ((*vp)->name, (*vp)->length, o_automatic, set);
+
+  hash_free (&names, 0);
+}
+
+static void
+get_file_entry (struct file *f)
+{
+  unsigned int flags = get_num ();
+  const char *stem = get_str ();
+  struct dep *deps;
+  uintmax_t nvars;
+
+  /* The first entry of a double-colon rule must be marked as such before
+     enter_file() will chain the others to it.  */
+  if (ANY_SET (flags, FILE_DOUBLE_COLON) && f->double_colon == 0)
+    f->double_colon = f;
+
+  f->stem = stem ? strcache_add (stem) : 0;
+  f->cmds = get_cmds ();
+
+  deps = get_deps ();
+  free_dep_chain (f->deps);
+  f->deps = deps;
+
+  nvars = get_num ();
+  if (nvars != 0)
+    {
+      initialize_file_variables (f, 1);
+      get_variable_set (f->variables->set, nvars);
+    }
+
+  f->is_target = ANY_SET (flags, FILE_IS_TARGET);
+  f->builtin = ANY_SET (flags, FILE_BUILTIN);
+  f->loaded = ANY_SET (flags, FILE_LOADED);
+  f->dontcare = ANY_SET (flags, FILE_DONTCARE);
+  f->cmd_target = ANY_SET (flags, FILE_CMD_TARGET);
+  f->precious = ANY_SET (flags, FILE_PRECIOUS);
+  f->phony = ANY_SET (flags, FILE_PHONY);
+  f->intermediate = ANY_SET (flags, FILE_INTERMEDIATE);
+  f->secondary = ANY_SET (flags, FILE_SECONDARY);
+}
+
+static void
+get_files (void)
+{
+  uintmax_t n = get_num ();
+
+  while (n-- > 0 && !rbad)
+    {
+      const char *name = get_str ();
+      uintmax_t entries = get_num ();
+      struct file *f;
+
+      if (name == 0 || entries == 0)
+        {
+          rbad = 1;
+          break;
+        }
+
+      f = get_file_ref (name);
+      name = f->name;
+      get_file_entry (f);
+
+      while (--entries > 0 && !rbad)
+        get_file_entry (enter_file (name));
+    }
+}
+
+static void
+get_rules (void)
+{
+  uintmax_t n = get_num ();
+
+  while (n-- > 0 && !rbad)
+    {
+      struct rule *r = xmalloc (sizeof (struct rule));
+      unsigned int i;
+
+      r->num = get_num ();
+      r->terminal = get_num ();
+      r->in_use = 0;
+      r->next = 0;
+      r->targets = xmalloc (r->num * sizeof (const char *));
+      r->suffixes = xmalloc (r->num * sizeof (const char *));
+      r->lens = xmalloc (r->num * sizeof (unsigned int));
+      for (i = 0; i < r->num; ++i)
+        {
+          const char *target = get_str ();
+          uintmax_t off = get_num ();
+
+          if (target == 0 || off == 0 || off > strlen (target))
+            {
+              rbad = 1;
+              target = "%";
+              off = 1;
+            }
+          r->targets[i] = strcache_add (target);
+          r->lens[i] = strlen (target);
+          r->suffixes[i] = r->targets[i] + off;
+        }
+      r->deps = get_deps ();
+      r->cmds = get_cmds ();
+
+      if (pattern_rules == 0)
+        pattern_rules = r;
+      else
+        last_pattern_rule->next = r;
+      last_pattern_rule = r;
+    }
+
+  forget_rule_index ();
+}
+
+static void
+get_pattern_vars (void)
+{
+  uintmax_t n = get_num ();
+
+  while (n-- > 0 && !rbad)
+    {
+      const char *target = get_str ();
+      uintmax_t off = get_num ();
+      const char *name;
+      struct pattern_var *p;
+
+      if (target == 0 || off == 0 || off > strlen (target))
+        {
+          rbad = 1;
+          break;
+        }
+
+      target = strcache_add (target);
+      p = create_pattern_var (target, target + off - 1);
+
+      name = get_str ();
+      p->variable.name = xstrdup (name ? name : "");
+      p->variable.length = strlen (p->variable.name);
+      p->variable.value = 0;
+      get_variable_fields (&p->variable);
+    }
+}
+
+static void
+get_vpaths (void)
+{
+  uintmax_t n = get_num ();
+
+  while (n-- > 0 && !rbad)
+    {
+      const char *pattern = get_str ();
+      const char *dirpath = get_str ();
+      char *pat = pattern ? xstrdup (pattern) : 0;
+      char *dir = dirpath ? xstrdup (dirpath) : 0;
+
+      construct_vpath_list (pat, dir);
+
+      if (pat)
+        free (pat);
+      if (dir)
+        free (dir);
+    }
+}
+
+static struct dep *
+get_read_files (void)
+{
+  uintmax_t n = get_num ();
+  struct dep *read_files = 0;
+  struct dep **dp = &read_files;
+
+  while (n-- > 0 && !rbad)
+    {
+      const char *name = get_str ();
+      struct dep *d;
+
+      if (name == 0)
+        {
+          rbad = 1;
+          break;
+        }
+
+      d = alloc_dep ();
+      d->file = get_file_ref (name);
+      d->changed = get_num ();
+      d->dontcare = get_num ();
+      *dp = d;
+      dp = &d->next;
+    }
+
+  return read_files;
+}
+
+/* Restore the data base from the payload.  */
+
+static struct dep *
+get_payload (const char **makefiles)
+{
+  struct dep *read_files;
+  uintmax_t n;
+
+  posix_pedantic = get_num ();
+  second_expansion = get_num ();
+  one_shell = get_num ();
+  export_all_variables = get_num ();
+  cmd_prefix = (char) get_num ();
+
+  get_global_variables ();
+  get_files ();
+  get_rules ();
+  get_pattern_vars ();
+  get_vpaths ();
+  read_files = get_read_files ();
+
+  n = get_num ();
+  for (; makefiles != 0 && *makefiles != 0 && n > 0; ++makefiles, --n)
+    {
+      const char *name = get_str ();
+      if (name == 0)
+        rbad = 1;
+      else
+        *makefiles = strcache_add (name);
+    }
+  if (n != 0 || (makefiles != 0 && *makefiles != 0))
+    rbad = 1;
+
+  free (cmds_read);
+  cmds_read = 0;
+  ncmds_read = cmds_read_size = 0;
+
+  return read_files;
+}
+
+/* Check the header of the cache in BUF.  Returns a description of the first
+   difference found between the cache and the current state, or null if the
+   cache is current.  On success the payload is left in RP..REND.  */
+
+static const char *
+check_header (const unsigned char *buf, size_t len)
+{
+  const char *version;
+  uintmax_t n, plen, sum;
+
+  if (len < RC_MAGIC_LEN || memcmp (buf, RC_MAGIC, RC_MAGIC_LEN) != 0)
+    return _("not a parse cache");
+
+  rp = buf + RC_MAGIC_LEN;
+  rend = buf + len;
+  rbad = 0;
+
+  if (get_num () != RC_VERSION)
+    return _("cache format");
+  version = get_str ();
+  if (rbad || version == 0 || !streq (version, version_string))
+    return _("make version");
+  if (get_num () != cache_key)
+    return _("command line, environment or directory");
+
+  n = get_num ();
+  while (n-- > 0 && !rbad)
+    {
+      struct rc_input saved;
+      struct rc_input now;
+      static char *reason = 0;
+
+      saved.name = get_str ();
+      saved.exists = get_num ();
+      saved.mtime = get_num ();
+      saved.mtime_ns = get_num ();
+      saved.size = get_num ();
+      saved.ino = get_num ();
+      if (rbad || saved.name == 0)
+        break;
+
+      now.name = saved.name;
+      stat_input (&now);
+      if (now.exists != saved.exists || now.mtime != saved.mtime
+          || now.mtime_ns != saved.mtime_ns || now.size != saved.size
+          || now.ino != saved.ino)
+        {
+          free (reason);
+          reason = xstrdup (saved.name);
+          return reason;
+        }
+    }
+
+  plen = get_num ();
+  sum = get_num ();
+  if (rbad || plen != (uintmax_t) (rend - rp))
+    return _("truncated cache");
+  if (fnv_add (FNV_OFFSET, rp, plen) != sum)
+    return _("corrupt cache");
+
+  return 0;
+}
+
+/* If the parse cache is current, restore the data base from it and return
+   the chain of makefiles that read_all_makefiles() would have returned;
+   the names in MAKEFILES are updated the same way.  Otherwise return null
+   and leave the data base alone.  */
+
+struct dep *
+readcache_load (const char **makefiles)
+{
+  struct dep *read_files = 0;
+  struct stat st;
+  unsigned char *buf;
+  const char *reason;
+  size_t len;
+  int fd, e;
+#ifdef USE_MMAP
+  int mapped = 0;
+#endif
+
+  if (!recording || cache_file == 0)
+    return 0;
+
+  EINTRLOOP (fd, open (cache_file, O_RDONLY));
+  if (fd < 0)
+    {
+      DB (DB_VERBOSE, (_("No parse cache '%s'.\n"), cache_file));
+      return 0;
+    }
+
+  EINTRLOOP (e, fstat (fd, &st));
+  if (e != 0 || st.st_size == 0)
+    {
+      close (fd);
+      return 0;
+    }
+  len = st.st_size;
+
+#ifdef USE_MMAP
+  buf = mmap (0, len, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (buf != MAP_FAILED)
+    mapped = 1;
+  else
+#endif
+    {
+      size_t got = 0;
+
+      buf = xmalloc (len);
+      while (got < len)
+        {
+          ssize_t r;
+          EINTRLOOP (r, read (fd, buf + got, len - got));
+          if (r <= 0)
+            break;
+          got += r;
+        }
+      len = got;
+    }
+  close (fd);
+
+  reason = check_header (buf, len);
+  if (reason != 0)
+    DB (DB_VERBOSE, (_("Parse cache '%s' is out of date: %s\n"),
+                     cache_file, reason));
+  else
+    {
+      DB (DB_BASIC, (_("Reading makefiles from parse cache '%s'...\n"),
+                     cache_file));
+
+      read_files = get_payload (makefiles);
+
+      /* The checksum matched, so this means a bug in the writer.  Some of
+         the data base has already been replaced: we can't recover.  */
+      if (rbad || rp != rend)
+        OS (fatal, NILF, _("parse cache '%s' is invalid; remove it"),
+            cache_file);
+
+      recording = 0;
+    }
+
+#ifdef USE_MMAP
+  if (mapped)
+    munmap (buf, st.st_size);
+  else
+#endif
+    free (buf);
+
+  return read_files;
+}
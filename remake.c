@@ -66,6 +66,7 @@ static enum update_status touch_file (struct file *file);
 static void remake_file (struct file *file);
 static FILE_TIMESTAMP name_mtime (const char *name);
 static const char *library_search (const char *lib, FILE_TIMESTAMP *mtime_ptr);
+static void raise_weight (struct file *file, unsigned long above);
 
 
 /* Remake all the goals in the 'struct dep' chain GOALS.  Return -1 if nothing
@@ -113,9 +114,11 @@ update_goal_chain (struct dep *goals)
 
       start_waiting_jobs ();
 
-      /* Wait for a child to die.  */
+      /* Wait for a child to die.  With --critical-path, getting a job slot
+         for a queued job will do as well.  */
 
-      reap_children (1, 0);
+      if (!start_ready_jobs (1))
+        reap_children (1, 0);
 
       lastgoal = 0;
       g = goals;
@@ -152,6 +155,9 @@ update_goal_chain (struct dep *goals)
                  actually run.  */
               ocommands_started = commands_started;
 
+              if (critical_path_flag)
+                raise_weight (file, 0);
+
               fail = update_file (file, rebuilding_makefiles ? 1 : 0);
               check_renamed (file);
 
@@ -238,7 +244,7 @@ update_goal_chain (struct dep *goals)
                 lastgoal->next = g->next;
 
               /* Free the storage.  */
-              free (g);
+              free_dep (g);
 
               g = lastgoal == 0 ? goals : lastgoal->next;
 
@@ -252,6 +258,10 @@ update_goal_chain (struct dep *goals)
             }
         }
 
+      /* Start the heaviest of the jobs queued on this pass.  */
+
+      start_ready_jobs (0);
+
       /* If we reached the end of the dependency graph toggle the considered
          flag for the next pass.  */
       if (g == 0)
@@ -268,6 +278,37 @@ update_goal_chain (struct dep *goals)
   return status;
 }
 
+/* Raise the weight of FILE, a prerequisite of a target whose weight is
+   ABOVE, and pass any increase on to FILE's own prerequisites.
+
+   The weight of a file is the length, in expected milliseconds of recipe
+   time, of the longest path from it up to a goal: the time the goals will
+   take to finish once its recipe starts.  The --critical-path scheduler
+   starts the heaviest jobs first.  Each target counts for at least 1, so
+   without any history this is just the depth of the target.  */
+
+static void
+raise_weight (struct file *file, unsigned long above)
+{
+  unsigned long weight = above + history_cost (file);
+  struct dep *d;
+
+  if (weight <= file->weight || file->weighing)
+    return;
+
+  file->weight = weight;
+
+  /* If we haven't looked at FILE's deps yet, we'll pass the weight on when
+     we do.  */
+  if (!file->weighed)
+    return;
+
+  file->weighing = 1;
+  for (d = file->deps; d != 0; d = d->next)
+    raise_weight (d->file, weight);
+  file->weighing = 0;
+}
+
 /* If FILE is not up to date, execute the commands for it.
    Return 0 if successful, non-0 if unsuccessful;
    but with some flag settings, just call 'exit' if unsuccessful.
@@ -563,6 +604,11 @@ update_file_1 (struct file *file, unsigned int depth)
           d->file->parent = file;
           maybe_make = must_make;
 
+          /* The first time through, pass our weight on to our deps.
+             After that raise_weight() keeps them up to date.  */
+          if (critical_path_flag && !file->weighed)
+            raise_weight (d->file, file->weight);
+
           /* Inherit dontcare flag from our parent. */
           if (rebuilding_makefiles)
             {
@@ -610,6 +656,8 @@ update_file_1 (struct file *file, unsigned int depth)
         }
     }
 
+  file->weighed = 1;
+
   /* Now we know whether this target needs updating.
      If it does, update all the intermediate files we depend on.  */
 
@@ -794,6 +842,21 @@ update_file_1 (struct file *file, unsigned int depth)
       must_make = 1;
       DBF (DB_VERBOSE, _("Making '%s' due to always-make flag.\n"));
     }
+  else if (must_make && !noexist && file->cmds != 0 && !file->phony
+           && !file->double_colon && !always_make_flag
+           && hashdb_unchanged (file))
+    {
+      must_make = 0;
+      DBF (DB_BASIC,
+           _("Prerequisites of '%s' are newer, but have the same contents.\n"));
+      hashdb_touch (file);
+    }
+  else if (!must_make && file->cmds != 0 && !file->phony
+           && !file->double_colon && hashdb_recipe_changed (file))
+    {
+      must_make = 1;
+      DBF (DB_BASIC, _("Recipe for '%s' has changed.\n"));
+    }
 
   if (!must_make)
     {
@@ -833,6 +896,8 @@ update_file_1 (struct file *file, unsigned int depth)
     }
 
   /* Now, take appropriate actions to remake the file.  */
+  if (file->cmds != 0 && !just_print_flag && !question_flag && !touch_flag)
+    hashdb_start (file);
   remake_file (file);
 
   if (file->command_state != cs_finished)
@@ -873,6 +938,18 @@ notice_finished_file (struct file *file)
   int ran = file->command_state == cs_running;
   int touched = 0;
 
+#ifdef MAKE_SERVE
+  /* Any times the make server gave us for these are out of date now.  */
+  serve_forget_mtime (file->name);
+  for (d = file->also_make; d != 0; d = d->next)
+    serve_forget_mtime (d->file->name);
+#endif
+
+  /* So are any that we looked up ahead of time.  */
+  prefetch_forget_mtime (file->name);
+  for (d = file->also_make; d != 0; d = d->next)
+    prefetch_forget_mtime (d->file->name);
+
   file->command_state = cs_finished;
   file->updated = 1;
 
@@ -1455,6 +1532,14 @@ name_mtime (const char *name)
   struct stat st;
   int e;
 
+#ifdef MAKE_SERVE
+  if (serve_mtime (name, &mtime))
+    return mtime;
+#endif
+
+  if (prefetch_mtime (name, &mtime))
+    return mtime;
+
   EINTRLOOP (e, stat (name, &st));
   if (e == 0)
     mtime = FILE_TIMESTAMP_STAT_MODTIME (name, st);
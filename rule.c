@@ -24,8 +24,10 @@ this program.  If not, see <http://www.gnu.org/licenses/>.  */
 #include "commands.h"
 #include "variable.h"
 #include "rule.h"
+#include "hash.h"
 
 static void freerule (struct rule *rule, struct rule *lastrule);
+static void index_pattern_rules (void);
 
 /* Chain of all pattern rules.  */
 
@@ -142,6 +144,211 @@ count_implicit_rule_limits (void)
 
   if (name != 0)
     free (name);
+
+  forget_rule_index ();
+  index_pattern_rules ();
+}
+
+/* An index of the targets of the pattern rules by their suffixes (the text
+   after the '%'), so that pattern_search need only look at the targets that
+   could match a file, instead of at every target of every rule.  A file can
+   only match targets whose suffix is the end of its name, so each distinct
+   suffix length gives one lookup.
+
+   The index is built once the makefiles have been read.  If the pattern
+   rules change after that, it is thrown away and built again when it is
+   next wanted.  */
+
+struct suffix_targets
+  {
+    const char *suffix;             /* The suffix of the targets.  */
+    unsigned int count;             /* How many targets have it...  */
+    unsigned int size;              /* ... and how many fit in TARGETS.  */
+    struct rule_target *targets;    /* The targets, in the rules' order.  */
+  };
+
+static struct hash_table rule_index;
+static int rule_index_valid = 0;
+
+/* The distinct lengths of the suffixes, from the shortest.  */
+
+static unsigned int *suffix_lengths = 0;
+static unsigned int num_suffix_lengths = 0;
+
+static unsigned long
+suffix_targets_hash_1 (const void *key)
+{
+  return_STRING_HASH_1 (((const struct suffix_targets *) key)->suffix);
+}
+
+static unsigned long
+suffix_targets_hash_2 (const void *key)
+{
+  return_STRING_HASH_2 (((const struct suffix_targets *) key)->suffix);
+}
+
+static int
+suffix_targets_hash_cmp (const void *x, const void *y)
+{
+  return_STRING_COMPARE (((const struct suffix_targets *) x)->suffix,
+                         ((const struct suffix_targets *) y)->suffix);
+}
+
+static void
+free_suffix_targets (const void *item)
+{
+  struct suffix_targets *st = (struct suffix_targets *) item;
+  free (st->targets);
+  free (st);
+}
+
+static int
+rule_target_compare (const void *v1, const void *v2)
+{
+  const struct rule_target *t1 = v1;
+  const struct rule_target *t2 = v2;
+  return t1->order < t2->order ? -1 : t1->order > t2->order;
+}
+
+/* Throw away the index of the pattern rules: they have changed.  */
+
+void
+forget_rule_index (void)
+{
+  if (!rule_index_valid)
+    return;
+
+  hash_map (&rule_index, free_suffix_targets);
+  hash_free (&rule_index, 0);
+  num_suffix_lengths = 0;
+  rule_index_valid = 0;
+}
+
+static void
+index_pattern_rules (void)
+{
+  struct rule *rule;
+  unsigned int max_lengths = 0;
+  unsigned int order = 0;
+
+  hash_init (&rule_index, 64, suffix_targets_hash_1, suffix_targets_hash_2,
+             suffix_targets_hash_cmp);
+  num_suffix_lengths = 0;
+
+  for (rule = pattern_rules; rule != 0; rule = rule->next)
+    {
+      unsigned int ti;
+
+      for (ti = 0; ti < rule->num; ++ti)
+        {
+          struct suffix_targets key;
+          struct suffix_targets **slot;
+          struct suffix_targets *st;
+
+          key.suffix = rule->suffixes[ti];
+          slot = (struct suffix_targets **) hash_find_slot (&rule_index, &key);
+          if (HASH_VACANT (*slot))
+            {
+              unsigned int len = strlen (key.suffix);
+              unsigned int i;
+
+              st = xmalloc (sizeof (struct suffix_targets));
+              st->suffix = key.suffix;
+              st->count = st->size = 0;
+              st->targets = 0;
+              hash_insert_at (&rule_index, st, slot);
+
+              /* Remember the length, keeping the lengths in order.  */
+              for (i = 0; i < num_suffix_lengths; ++i)
+                if (suffix_lengths[i] >= len)
+                  break;
+              if (i == num_suffix_lengths || suffix_lengths[i] != len)
+                {
+                  if (num_suffix_lengths == max_lengths)
+                    {
+                      max_lengths += 16;
+                      suffix_lengths = xrealloc (suffix_lengths,
+                                                 max_lengths
+                                                 * sizeof (unsigned int));
+                    }
+                  memmove (&suffix_lengths[i + 1], &suffix_lengths[i],
+                           (num_suffix_lengths - i) * sizeof (unsigned int));
+                  suffix_lengths[i] = len;
+                  ++num_suffix_lengths;
+                }
+            }
+          else
+            st = *slot;
+
+          if (st->count == st->size)
+            {
+              st->size = st->size ? st->size * 2 : 4;
+              st->targets = xrealloc (st->targets,
+                                      st->size * sizeof (struct rule_target));
+            }
+          st->targets[st->count].rule = rule;
+          st->targets[st->count].ti = ti;
+          st->targets[st->count].order = order++;
+          ++st->count;
+        }
+    }
+
+  rule_index_valid = 1;
+}
+
+/* Find the targets of pattern rules whose suffixes match the end of NAME,
+   which is LEN characters long, in the order they are defined: the order
+   in which pattern_search would have come to them.  Return them in a
+   malloc'd array, and their number in *COUNTP.  */
+
+struct rule_target *
+match_pattern_rules (const char *name, unsigned int len, unsigned int *countp)
+{
+  struct suffix_targets *found[16];
+  struct suffix_targets **hits = found;
+  struct rule_target *targets;
+  unsigned int nhits = 0;
+  unsigned int count = 0;
+  unsigned int i;
+
+  if (!rule_index_valid)
+    index_pattern_rules ();
+
+  if (num_suffix_lengths > sizeof (found) / sizeof (found[0]))
+    hits = xmalloc (num_suffix_lengths * sizeof (struct suffix_targets *));
+
+  for (i = 0; i < num_suffix_lengths && suffix_lengths[i] <= len; ++i)
+    {
+      struct suffix_targets key;
+      struct suffix_targets *st;
+
+      key.suffix = name + len - suffix_lengths[i];
+      st = hash_find_item (&rule_index, &key);
+      if (st != 0)
+        {
+          hits[nhits++] = st;
+          count += st->count;
+        }
+    }
+
+  targets = xmalloc (count * sizeof (struct rule_target));
+  count = 0;
+  for (i = 0; i < nhits; ++i)
+    {
+      memcpy (&targets[count], hits[i]->targets,
+              hits[i]->count * sizeof (struct rule_target));
+      count += hits[i]->count;
+    }
+
+  /* Each suffix's targets are already in order; put them all in order.  */
+  if (nhits > 1)
+    qsort (targets, count, sizeof (struct rule_target), rule_target_compare);
+
+  if (hits != found)
+    free (hits);
+
+  *countp = count;
+  return targets;
 }
 
 /* Create a pattern rule from a suffix rule.
@@ -289,6 +496,8 @@ new_pattern_rule (struct rule *rule, int override)
 
   rule->next = 0;
 
+  forget_rule_index ();
+
   /* Search for an identical rule.  */
   lastrule = 0;
   for (r = pattern_rules; r != 0; lastrule = r, r = r->next)
@@ -399,6 +608,8 @@ freerule (struct rule *rule, struct rule *lastrule)
 {
   struct rule *next = rule->next;
 
+  forget_rule_index ();
+
   free_dep_chain (rule->deps);
 
   /* MSVC erroneously warns without a cast here.  */
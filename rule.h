@@ -30,6 +30,14 @@ struct rule
     char in_use;                /* If in use by a parent pattern_search.  */
   };
 
+/* A target of a pattern rule, as found by match_pattern_rules.  */
+struct rule_target
+  {
+    struct rule *rule;
+    unsigned int ti;            /* Index of the target in the rule.  */
+    unsigned int order;         /* Position among all the rules' targets.  */
+  };
+
 /* For calling install_pattern_rule.  */
 struct pspec
   {
@@ -50,6 +58,9 @@ extern unsigned int maxsuffix;
 
 
 void count_implicit_rule_limits (void);
+struct rule_target *match_pattern_rules (const char *name, unsigned int len,
+                                         unsigned int *countp);
+void forget_rule_index (void);
 void convert_to_pattern (void);
 void install_pattern_rule (struct pspec *p, int terminal);
 void create_pattern_rule (const char **targets, const char **target_percents,
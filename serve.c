@@ -0,0 +1,1033 @@
+/* Resident make server for GNU Make.
+Copyright (C) 2013 Free Software Foundation, Inc.
+This file is part of GNU Make.
+
+GNU Make is free software; you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation; either version 3 of the License, or (at your option) any later
+version.
+
+GNU Make is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "makeint.h"
+
+#ifdef MAKE_SERVE
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#ifdef HAVE_FCNTL_H
+# include <fcntl.h>
+#else
+# include <sys/file.h>
+#endif
+
+#include "filedef.h"
+#include "variable.h"
+#include "job.h"
+#include "debug.h"
+#include "hash.h"
+
+/* A make started with --serve reads its makefiles once and then waits on a
+   Unix domain socket.  A make started with --connect hands the server its
+   standard input, output and error, its command line and an "identity"
+   (see serve_identity() in main.c) and waits for the answer.  If the
+   identities match, the server forks: the child carries on exactly as if
+   it had just read the makefiles itself, with the client's descriptors,
+   and the client relays its exit status.  Otherwise the client is told to
+   build by itself.  Forking means the server's own data base is never
+   touched by a build.
+
+   While waiting, the server watches the directories holding the files it
+   knows about with inotify.  It keeps the modification time of each file
+   so a child doesn't need to stat it, and the directory cache in dir.c up
+   to date.  When one of the inputs of the read phase (as recorded by
+   readcache.c) changes the server re-executes itself to read the makefiles
+   again, keeping the listening socket.
+
+   The cached times are only good until the child runs a command, which
+   may change any file, not just its own targets; from then on the child
+   stats files like it always would.  Before that each time is handed out
+   once, as a second look at a file means it has been remade.  */
+
+/* The protocol uses host byte order: both ends are the same make.  */
+
+#define SERVE_REQUEST   'Q'
+#define SERVE_REFUSED   'R'
+#define SERVE_ACCEPTED  'A'
+#define SERVE_STATUS    'S'
+
+/* Upper bound on any string we're sent.  */
+#define SERVE_MAX_LEN   (16 * 1024 * 1024)
+
+#define SERVE_FD_ENV    "MAKE_SERVE_FD"
+
+#define WATCH_MASK      (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO \
+                         | IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB \
+                         | IN_DELETE_SELF | IN_MOVE_SELF)
+
+static const char *socket_name;
+static char **server_argv;
+static char *identity;
+static unsigned int identity_len;
+
+static int listen_fd = -1;
+static int inotify_fd = -1;
+static int sigchld_pipe[2] = { -1, -1 };
+
+/* Nonzero in a child that is serving a request.  */
+
+static int serving_child = 0;
+
+/* If non-null, the makefiles must be read again.  */
+
+static const char *reload_reason = 0;
+
+/* The clients whose build is running.  */
+
+struct serve_client
+  {
+    struct serve_client *next;
+    pid_t pid;
+    int fd;
+  };
+
+static struct serve_client *clients = 0;
+
+
+/* Watched directories, by watch descriptor and by name.  */
+
+struct watch
+  {
+    int wd;
+    const char *dir;
+  };
+
+static struct hash_table watches_by_wd;
+static struct hash_table watches_by_dir;
+
+static unsigned long
+watch_wd_hash_1 (const void *key)
+{
+  return (unsigned long) ((const struct watch *) key)->wd;
+}
+
+static unsigned long
+watch_wd_hash_2 (const void *key)
+{
+  return (unsigned long) ((const struct watch *) key)->wd * 7;
+}
+
+static int
+watch_wd_hash_cmp (const void *x, const void *y)
+{
+  return ((const struct watch *) x)->wd - ((const struct watch *) y)->wd;
+}
+
+static unsigned long
+watch_dir_hash_1 (const void *key)
+{
+  return_STRING_HASH_1 (((const struct watch *) key)->dir);
+}
+
+static unsigned long
+watch_dir_hash_2 (const void *key)
+{
+  return_STRING_HASH_2 (((const struct watch *) key)->dir);
+}
+
+static int
+watch_dir_hash_cmp (const void *x, const void *y)
+{
+  return_STRING_COMPARE (((const struct watch *) x)->dir,
+                         ((const struct watch *) y)->dir);
+}
+
+/* The modification times we know, by file name.  */
+
+struct mtime_entry
+  {
+    const char *name;
+    FILE_TIMESTAMP mtime;
+  };
+
+static struct hash_table mtimes;
+
+static unsigned long
+mtime_hash_1 (const void *key)
+{
+  return_STRING_HASH_1 (((const struct mtime_entry *) key)->name);
+}
+
+static unsigned long
+mtime_hash_2 (const void *key)
+{
+  return_STRING_HASH_2 (((const struct mtime_entry *) key)->name);
+}
+
+static int
+mtime_hash_cmp (const void *x, const void *y)
+{
+  return_STRING_COMPARE (((const struct mtime_entry *) x)->name,
+                         ((const struct mtime_entry *) y)->name);
+}
+
+
+static int
+write_all (int fd, const void *buf, size_t len)
+{
+  const char *p = buf;
+
+  while (len > 0)
+    {
+      ssize_t n;
+      EINTRLOOP (n, write (fd, p, len));
+      if (n <= 0)
+        return -1;
+      p += n;
+      len -= n;
+    }
+
+  return 0;
+}
+
+static int
+read_all (int fd, void *buf, size_t len)
+{
+  char *p = buf;
+
+  while (len > 0)
+    {
+      ssize_t n;
+      EINTRLOOP (n, read (fd, p, len));
+      if (n <= 0)
+        return -1;
+      p += n;
+      len -= n;
+    }
+
+  return 0;
+}
+
+static int
+write_string (int fd, const char *str, unsigned int len)
+{
+  if (write_all (fd, &len, sizeof (len)) < 0)
+    return -1;
+  return write_all (fd, str, len);
+}
+
+/* Read a string into a new buffer, which is nul-terminated.  */
+
+static char *
+read_string (int fd, unsigned int *lenp)
+{
+  unsigned int len;
+  char *str;
+
+  if (read_all (fd, &len, sizeof (len)) < 0 || len > SERVE_MAX_LEN)
+    return 0;
+
+  str = xmalloc (len + 1);
+  if (read_all (fd, str, len) < 0)
+    {
+      free (str);
+      return 0;
+    }
+  str[len] = '\0';
+
+  if (lenp)
+    *lenp = len;
+  return str;
+}
+
+static void
+set_cloexec (int fd, int on)
+{
+#ifdef FD_CLOEXEC
+  int flags = fcntl (fd, F_GETFD);
+  if (flags >= 0)
+    fcntl (fd, F_SETFD, on ? flags | FD_CLOEXEC : flags & ~FD_CLOEXEC);
+#endif
+}
+
+
+/* Client side.  */
+
+static pid_t server_child = 0;
+
+static RETSIGTYPE
+forward_signal (int sig)
+{
+  /* The child leads its own process group, like a foreground job.  */
+  if (server_child > 0 && kill (-server_child, sig) < 0)
+    kill (server_child, sig);
+}
+
+/* Ask the server listening on NAME to run this make, whose ARGV and
+   identity ID (of length LEN) are given.  If the server accepts, this
+   doesn't return: we exit with the status of the build.  */
+
+void
+serve_connect (const char *name, int argc, char **argv,
+               const char *id, unsigned int len)
+{
+  struct sockaddr_un addr;
+  struct msghdr msg;
+  struct cmsghdr *cmsg;
+  struct iovec iov;
+  union
+    {
+      struct cmsghdr align;
+      char buf[CMSG_SPACE (3 * sizeof (int))];
+    } control;
+  char c = SERVE_REQUEST;
+  int fds[3] = { 0, 1, 2 };
+  int status;
+  char *reason;
+  int fd;
+  int i;
+
+  if (strlen (name) >= sizeof (addr.sun_path))
+    {
+      OS (error, NILF, _("socket name too long: %s"), name);
+      return;
+    }
+
+  fd = socket (AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    {
+      perror_with_name ("socket: ", name);
+      return;
+    }
+
+  memset (&addr, '\0', sizeof (addr));
+  addr.sun_family = AF_UNIX;
+  strcpy (addr.sun_path, name);
+  if (connect (fd, (struct sockaddr *) &addr, sizeof (addr)) < 0)
+    {
+      DB (DB_BASIC, (_("No make server on '%s': %s\n"),
+                     name, strerror (errno)));
+      close (fd);
+      return;
+    }
+
+  /* Send our standard descriptors along with the first byte.  */
+  memset (&msg, '\0', sizeof (msg));
+  memset (&control, '\0', sizeof (control));
+  iov.iov_base = &c;
+  iov.iov_len = 1;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof (control.buf);
+  cmsg = CMSG_FIRSTHDR (&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN (sizeof (fds));
+  memcpy (CMSG_DATA (cmsg), fds, sizeof (fds));
+
+  fflush (stdout);
+  fflush (stderr);
+
+  EINTRLOOP (i, sendmsg (fd, &msg, 0));
+  if (i != 1
+      || write_string (fd, id, len) < 0
+      || write_all (fd, &argc, sizeof (argc)) < 0)
+    goto lost;
+  for (i = 0; i < argc; ++i)
+    if (write_string (fd, argv[i], strlen (argv[i])) < 0)
+      goto lost;
+
+  if (read_all (fd, &c, 1) < 0)
+    goto lost;
+
+  if (c == SERVE_REFUSED)
+    {
+      reason = read_string (fd, 0);
+      if (reason == 0)
+        goto lost;
+      DB (DB_BASIC, (_("Make server on '%s' refused: %s\n"), name, reason));
+      free (reason);
+      close (fd);
+      return;
+    }
+
+  if (c != SERVE_ACCEPTED || read_all (fd, &server_child, sizeof (pid_t)) < 0)
+    goto lost;
+
+  DB (DB_BASIC, (_("Make server on '%s' is building in process %ld\n"),
+                 name, (long) server_child));
+
+  signal (SIGINT, forward_signal);
+  signal (SIGTERM, forward_signal);
+#ifdef SIGHUP
+  signal (SIGHUP, forward_signal);
+#endif
+#ifdef SIGQUIT
+  signal (SIGQUIT, forward_signal);
+#endif
+
+  if (read_all (fd, &c, 1) < 0 || c != SERVE_STATUS
+      || read_all (fd, &status, sizeof (status)) < 0)
+    goto lost;
+
+  /* Die the way the build did.  */
+  if (WIFSIGNALED (status))
+    {
+      signal (WTERMSIG (status), SIG_DFL);
+      kill (getpid (), WTERMSIG (status));
+    }
+  exit (WIFEXITED (status) ? WEXITSTATUS (status) : MAKE_FAILURE);
+
+ lost:
+  OS (error, NILF, _("Lost connection to make server on '%s'"), name);
+  exit (MAKE_FAILURE);
+}
+
+
+/* Server side: watching the file system.  */
+
+static const char *
+dir_of (const char *name)
+{
+  const char *slash = strrchr (name, '/');
+
+  if (slash == 0)
+    return ".";
+  if (slash == name)
+    return "/";
+  return strcache_add_len (name, slash - name);
+}
+
+/* Make sure DIR is watched.  Return zero if it can't be.  */
+
+static int
+watch_dir (const char *dir)
+{
+  struct watch key;
+  struct watch **slot;
+  struct watch *w;
+  int wd;
+
+  key.dir = dir;
+  slot = (struct watch **) hash_find_slot (&watches_by_dir, &key);
+  if (! HASH_VACANT (*slot))
+    return (*slot)->wd >= 0;
+
+  wd = inotify_add_watch (inotify_fd, dir, WATCH_MASK);
+  if (wd < 0 && errno != ENOENT && errno != ENOTDIR && errno != EACCES)
+    {
+      /* Probably out of watches.  Serving without them would be wrong.  */
+      perror_with_name ("inotify_add_watch: ", dir);
+      O (fatal, NILF, _("Can't watch the directories of the makefiles"));
+    }
+
+  w = xmalloc (sizeof (struct watch));
+  w->wd = wd;
+  w->dir = strcache_add (dir);
+  hash_insert_at (&watches_by_dir, w, slot);
+
+  /* Two names for the same directory share a watch: events come with the
+     first one.  */
+  if (wd >= 0 && hash_find_item (&watches_by_wd, w) == 0)
+    hash_insert (&watches_by_wd, w);
+
+  return wd >= 0;
+}
+
+/* Record the current modification time of NAME, if we can keep track of
+   it.  Symbolic links are left alone: the target could change without us
+   seeing any event.  */
+
+static void
+note_mtime (const char *name)
+{
+  struct mtime_entry key;
+  struct mtime_entry **slot;
+  struct mtime_entry *m;
+  FILE_TIMESTAMP mtime;
+  struct stat st;
+  int e;
+
+#ifndef NO_ARCHIVES
+  if (ar_name (name))
+    return;
+#endif
+  if (!watch_dir (dir_of (name)))
+    return;
+
+  EINTRLOOP (e, lstat (name, &st));
+  if (e == 0 && !S_ISLNK (st.st_mode))
+    mtime = FILE_TIMESTAMP_STAT_MODTIME (name, st);
+  else if (e != 0 && (errno == ENOENT || errno == ENOTDIR))
+    mtime = NONEXISTENT_MTIME;
+  else
+    mtime = UNKNOWN_MTIME;
+
+  key.name = name;
+  slot = (struct mtime_entry **) hash_find_slot (&mtimes, &key);
+  if (HASH_VACANT (*slot))
+    {
+      if (mtime == UNKNOWN_MTIME)
+        return;
+      m = xmalloc (sizeof (struct mtime_entry));
+      m->name = strcache_add (name);
+      hash_insert_at (&mtimes, m, slot);
+    }
+  else if (mtime == UNKNOWN_MTIME)
+    {
+      m = *slot;
+      hash_delete_at (&mtimes, slot);
+      free (m);
+      return;
+    }
+  else
+    m = *slot;
+
+  m->mtime = mtime;
+}
+
+static void
+note_file_mtime (const void *item, void *arg UNUSED)
+{
+  note_mtime (((const struct file *) item)->name);
+}
+
+static void
+watch_input (const char *name, void *arg UNUSED)
+{
+  struct stat st;
+
+  watch_dir (dir_of (name));
+  if (stat (name, &st) == 0 && S_ISDIR (st.st_mode))
+    watch_dir (name);
+}
+
+static void
+request_reload (const char *why)
+{
+  if (reload_reason == 0)
+    {
+      DB (DB_BASIC, (_("Make server: '%s' changed, reloading\n"), why));
+      reload_reason = strcache_add (why);
+    }
+}
+
+static void
+handle_event (const struct inotify_event *ev)
+{
+  struct watch key;
+  struct watch *w;
+  struct mtime_entry mkey;
+  char *path;
+
+  if (ev->mask & IN_Q_OVERFLOW)
+    {
+      request_reload (_("(event queue overflow)"));
+      return;
+    }
+
+  key.wd = ev->wd;
+  w = hash_find_item (&watches_by_wd, &key);
+  if (w == 0)
+    return;
+
+  if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))
+    {
+      request_reload (w->dir);
+      return;
+    }
+
+  if (ev->len == 0)
+    return;
+
+  path = streq (w->dir, ".") ? xstrdup (ev->name)
+                             : xstrdup (concat (3, w->dir, "/", ev->name));
+
+  if (readcache_input_p (path))
+    request_reload (path);
+  else if ((ev->mask & (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO))
+           && readcache_glob_match_p (path))
+    request_reload (path);
+
+  if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+    dir_note_change (w->dir, ev->name, 1);
+  else if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+    dir_note_change (w->dir, ev->name, 0);
+
+  mkey.name = path;
+  if (hash_find_item (&mtimes, &mkey) != 0)
+    note_mtime (path);
+
+  free (path);
+}
+
+static void
+read_events (void)
+{
+  union
+    {
+      struct inotify_event ev;
+      char buf[4096];
+    } u;
+
+  while (1)
+    {
+      ssize_t n;
+      char *p;
+
+      EINTRLOOP (n, read (inotify_fd, u.buf, sizeof (u.buf)));
+      if (n <= 0)
+        break;
+
+      for (p = u.buf; p < u.buf + n; )
+        {
+          const struct inotify_event *ev = (const struct inotify_event *) p;
+          handle_event (ev);
+          p += sizeof (struct inotify_event) + ev->len;
+        }
+    }
+}
+
+
+/* Server side: requests.  */
+
+/* Start serving on the socket NAME.  ARGV is how we were invoked, for reloading, and
+   ID (of length LEN) is our identity.  If we've been re-executed to reload
+   the makefiles the socket is already open.  */
+
+void
+serve_init (const char *name, char **argv, const char *id, unsigned int len)
+{
+  const char *fdstr = getenv (SERVE_FD_ENV);
+
+  socket_name = name;
+  server_argv = argv;
+  identity = xmalloc (len);
+  memcpy (identity, id, len);
+  identity_len = len;
+
+  if (fdstr != 0)
+    {
+      listen_fd = atoi (fdstr);
+      undefine_variable_global (SERVE_FD_ENV, CSTRLEN (SERVE_FD_ENV), o_env);
+    }
+  else
+    {
+      struct sockaddr_un addr;
+      mode_t mask;
+      int e;
+
+      if (strlen (name) >= sizeof (addr.sun_path))
+        OS (fatal, NILF, _("socket name too long: %s"), name);
+
+      listen_fd = socket (AF_UNIX, SOCK_STREAM, 0);
+      if (listen_fd < 0)
+        pfatal_with_name ("socket");
+
+      memset (&addr, '\0', sizeof (addr));
+      addr.sun_family = AF_UNIX;
+      strcpy (addr.sun_path, name);
+
+      /* Clean up after a server that went away, but not one that's still
+         running.  */
+      if (connect (listen_fd, (struct sockaddr *) &addr, sizeof (addr)) == 0)
+        OS (fatal, NILF, _("A make server is already running on '%s'"),
+            name);
+      close (listen_fd);
+      unlink (name);
+
+      listen_fd = socket (AF_UNIX, SOCK_STREAM, 0);
+      if (listen_fd < 0)
+        pfatal_with_name ("socket");
+
+      /* Whoever can connect can run commands as us.  */
+      mask = umask (077);
+      e = bind (listen_fd, (struct sockaddr *) &addr, sizeof (addr));
+      umask (mask);
+      if (e < 0 || listen (listen_fd, 16) < 0)
+        pfatal_with_name (name);
+    }
+
+  set_cloexec (listen_fd, 1);
+}
+
+static void
+refuse (int fd, const char *reason)
+{
+  char c = SERVE_REFUSED;
+
+  DB (DB_VERBOSE, (_("Make server: refusing request: %s\n"), reason));
+  if (write_all (fd, &c, 1) == 0)
+    write_string (fd, reason, strlen (reason));
+  close (fd);
+}
+
+static RETSIGTYPE
+note_sigchld (int sig UNUSED)
+{
+  int e = errno;
+  char c = 0;
+  write (sigchld_pipe[1], &c, 1);
+  errno = e;
+}
+
+static void
+close_fds (const int *fds, int n)
+{
+  int i;
+  for (i = 0; i < n; ++i)
+    close (fds[i]);
+}
+
+/* Handle a connection on FD.  Returns the client's argument vector in the
+   child that is to serve it, or null.  */
+
+static char **
+handle_request (int fd, int *argcp)
+{
+  struct msghdr msg;
+  struct cmsghdr *cmsg;
+  struct iovec iov;
+  struct timeval tv;
+  union
+    {
+      struct cmsghdr align;
+      char buf[CMSG_SPACE (3 * sizeof (int))];
+    } control;
+  struct serve_client *client;
+  char **argv = 0;
+  char *id = 0;
+  unsigned int len;
+  int fds[3];
+  int nfds = 0;
+  int argc;
+  pid_t pid;
+  char c;
+  int i;
+
+  /* Don't let a client that goes quiet hold up the server.  */
+  tv.tv_sec = 10;
+  tv.tv_usec = 0;
+  setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+
+#ifdef SO_PEERCRED
+  {
+    struct ucred cred;
+    socklen_t credlen = sizeof (cred);
+    if (getsockopt (fd, SOL_SOCKET, SO_PEERCRED, &cred, &credlen) < 0
+        || cred.uid != getuid ())
+      {
+        close (fd);
+        return 0;
+      }
+  }
+#endif
+
+  memset (&msg, '\0', sizeof (msg));
+  iov.iov_base = &c;
+  iov.iov_len = 1;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof (control.buf);
+
+  EINTRLOOP (i, recvmsg (fd, &msg, 0));
+  for (cmsg = CMSG_FIRSTHDR (&msg); cmsg != 0; cmsg = CMSG_NXTHDR (&msg, cmsg))
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+      {
+        nfds = (cmsg->cmsg_len - CMSG_LEN (0)) / sizeof (int);
+        if (nfds > 3)
+          nfds = 3;
+        memcpy (fds, CMSG_DATA (cmsg), nfds * sizeof (int));
+      }
+
+  if (i != 1 || c != SERVE_REQUEST || nfds != 3
+      || (id = read_string (fd, &len)) == 0
+      || read_all (fd, &argc, sizeof (argc)) < 0
+      || argc < 1 || argc > SERVE_MAX_LEN / (int) sizeof (char *))
+    goto bad;
+
+  argv = xcalloc ((argc + 1) * sizeof (char *));
+  for (i = 0; i < argc; ++i)
+    if ((argv[i] = read_string (fd, 0)) == 0)
+      goto bad;
+
+  /* Catch up with anything that happened before the request was sent.  */
+  read_events ();
+
+  if (len != identity_len || memcmp (id, identity, len) != 0)
+    {
+      refuse (fd, _("different command line or environment"));
+      goto done;
+    }
+  if (reload_reason)
+    {
+      refuse (fd, _("reloading the makefiles"));
+      goto done;
+    }
+
+  free (id);
+
+  fflush (stdout);
+  fflush (stderr);
+
+  pid = fork ();
+  if (pid < 0)
+    {
+      refuse (fd, strerror (errno));
+      goto done;
+    }
+
+  if (pid == 0)
+    {
+      /* Become the make the client would have been.  */
+      close (listen_fd);
+      close (inotify_fd);
+      close (sigchld_pipe[0]);
+      close (sigchld_pipe[1]);
+      while (clients != 0)
+        {
+          close (clients->fd);
+          clients = clients->next;
+        }
+      close (fd);
+
+      signal (SIGCHLD, SIG_DFL);
+      setpgid (0, 0);
+
+      for (i = 0; i < 3; ++i)
+        if (fds[i] != i)
+          {
+            dup2 (fds[i], i);
+            close (fds[i]);
+          }
+
+      serving_child = 1;
+      *argcp = argc;
+      return argv;
+    }
+
+  setpgid (pid, pid);
+  DB (DB_VERBOSE, (_("Make server: serving request in process %ld\n"),
+                   (long) pid));
+
+  client = xmalloc (sizeof (struct serve_client));
+  client->pid = pid;
+  client->fd = fd;
+  client->next = clients;
+  clients = client;
+
+  c = SERVE_ACCEPTED;
+  if (write_all (fd, &c, 1) < 0 || write_all (fd, &pid, sizeof (pid)) < 0)
+    /* The client went away: so should its build.  */
+    kill (-pid, SIGTERM);
+
+  close_fds (fds, nfds);
+  for (i = 0; i < argc; ++i)
+    free (argv[i]);
+  free (argv);
+  return 0;
+
+ bad:
+  close (fd);
+ done:
+  close_fds (fds, nfds);
+  if (argv)
+    for (i = 0; i < argc; ++i)
+      free (argv[i]);
+  free (argv);
+  free (id);
+  return 0;
+}
+
+static void
+reap_clients (void)
+{
+  pid_t pid;
+  int status;
+
+  while ((pid = waitpid (-1, &status, WNOHANG)) > 0)
+    {
+      struct serve_client **cp;
+
+      for (cp = &clients; *cp != 0; cp = &(*cp)->next)
+        if ((*cp)->pid == pid)
+          {
+            struct serve_client *client = *cp;
+            char c = SERVE_STATUS;
+
+            if (write_all (client->fd, &c, 1) == 0)
+              write_all (client->fd, &status, sizeof (status));
+            close (client->fd);
+            *cp = client->next;
+            free (client);
+            break;
+          }
+    }
+}
+
+static void
+reload (void)
+{
+  char *env;
+
+  DB (DB_BASIC, (_("Make server: re-executing to read the makefiles\n")));
+
+  if (directory_before_chdir != 0 && chdir (directory_before_chdir) < 0)
+    perror_with_name ("chdir", "");
+
+  env = xmalloc (CSTRLEN (SERVE_FD_ENV) + 1 + INTSTR_LENGTH + 1);
+  sprintf (env, "%s=%d", SERVE_FD_ENV, listen_fd);
+  putenv (env);
+  set_cloexec (listen_fd, 0);
+
+  fflush (stdout);
+  fflush (stderr);
+
+  exec_command (server_argv, environ);
+
+  /* NOTREACHED */
+  die (MAKE_FAILURE);
+}
+
+/* Serve requests.  This only returns in a child that is to carry on with
+   a client's build: the client's arguments are returned and *ARGCP is set
+   to their number.  */
+
+char **
+serve_loop (int *argcp)
+{
+  struct sigaction sa;
+
+  inotify_fd = inotify_init ();
+  if (inotify_fd < 0)
+    pfatal_with_name ("inotify_init");
+  set_cloexec (inotify_fd, 1);
+  fcntl (inotify_fd, F_SETFL, O_NONBLOCK);
+
+  if (pipe (sigchld_pipe) < 0)
+    pfatal_with_name ("pipe");
+  set_cloexec (sigchld_pipe[0], 1);
+  set_cloexec (sigchld_pipe[1], 1);
+  fcntl (sigchld_pipe[0], F_SETFL, O_NONBLOCK);
+  fcntl (sigchld_pipe[1], F_SETFL, O_NONBLOCK);
+
+  memset (&sa, '\0', sizeof (sa));
+  sa.sa_handler = note_sigchld;
+  sa.sa_flags = SA_RESTART;
+  sigaction (SIGCHLD, &sa, 0);
+
+  hash_init (&watches_by_wd, 100, watch_wd_hash_1, watch_wd_hash_2,
+             watch_wd_hash_cmp);
+  hash_init (&watches_by_dir, 100, watch_dir_hash_1, watch_dir_hash_2,
+             watch_dir_hash_cmp);
+  hash_init (&mtimes, 1000, mtime_hash_1, mtime_hash_2, mtime_hash_cmp);
+
+  /* We can't follow symbolic links, so there's nothing we can remember if
+     they matter.  */
+  if (!check_symlink_flag)
+    map_files (note_file_mtime, 0);
+  readcache_map_inputs (watch_input, 0);
+  dir_load_all ();
+
+  if (readcache_tainted ())
+    DB (DB_VERBOSE, (_("Make server: changes to '%s' will not be noticed\n"),
+                     readcache_tainted ()));
+
+  DB (DB_BASIC, (_("Make server listening on '%s'\n"), socket_name));
+
+  while (1)
+    {
+      struct pollfd pfd[3];
+      char buf[64];
+      int n;
+
+      reap_clients ();
+
+      if (reload_reason && clients == 0)
+        reload ();
+
+      pfd[0].fd = listen_fd;
+      pfd[0].events = reload_reason ? 0 : POLLIN;
+      pfd[1].fd = inotify_fd;
+      pfd[1].events = POLLIN;
+      pfd[2].fd = sigchld_pipe[0];
+      pfd[2].events = POLLIN;
+
+      n = poll (pfd, 3, -1);
+      if (n < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          pfatal_with_name ("poll");
+        }
+
+      if (pfd[2].revents)
+        while (read (sigchld_pipe[0], buf, sizeof (buf)) > 0)
+          ;
+
+      if (pfd[1].revents)
+        read_events ();
+
+      if (pfd[0].revents & POLLIN)
+        {
+          int fd;
+          char **argv;
+
+          EINTRLOOP (fd, accept (listen_fd, 0, 0));
+          if (fd < 0)
+            continue;
+
+          argv = handle_request (fd, argcp);
+          if (argv != 0)
+            return argv;
+        }
+    }
+}
+
+/* Look up NAME's modification time, as of when this child was forked, if
+   no command has run since.  */
+
+int
+serve_mtime (const char *name, FILE_TIMESTAMP *mtime)
+{
+  struct mtime_entry key;
+  struct mtime_entry **slot;
+  struct mtime_entry *m;
+
+  if (!serving_child || commands_started != 0)
+    return 0;
+
+  key.name = name;
+  slot = (struct mtime_entry **) hash_find_slot (&mtimes, &key);
+  if (HASH_VACANT (*slot))
+    return 0;
+
+  m = *slot;
+  *mtime = m->mtime;
+  hash_delete_at (&mtimes, slot);
+  free (m);
+  return 1;
+}
+
+/* Forget NAME's modification time: it's about to change.  */
+
+void
+serve_forget_mtime (const char *name)
+{
+  FILE_TIMESTAMP mtime;
+  serve_mtime (name, &mtime);
+}
+
+#endif /* MAKE_SERVE */
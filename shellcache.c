@@ -0,0 +1,421 @@
+/* Results of $(shell-cached ...) for GNU Make.
+Copyright (C) 2013 Free Software Foundation, Inc.
+This file is part of GNU Make.
+
+GNU Make is free software; you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation; either version 3 of the License, or (at your option) any later
+version.
+
+GNU Make is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "makeint.h"
+#include "filedef.h"
+#include "variable.h"
+#include "debug.h"
+#include "hash.h"
+
+/* $(shell-cached COMMAND,FILES) expands to what $(shell COMMAND) would,
+   but remembers the result in a file in the current directory, so that
+   the next make can use it without running the command, as long as
+   nothing it depends on has changed.  Makefiles often run the same slow
+   commands every time they are read (pkg-config, git describe, compiler
+   probes), and their results rarely change.
+
+   A result is found by the command, the shell and its flags, and the names
+   of FILES.  It is used if the environment and the contents of FILES are
+   the same as when the command ran: a regular file is known by a digest
+   of its contents, anything else by its modification time, so naming a
+   directory catches files being added to it or removed.  Results of
+   commands that failed are not kept.
+
+   The file is a header line, then for each result a line holding the two
+   digests above in hexadecimal and the length of the output in decimal,
+   then the output itself and a newline.  It is rewritten as a whole under
+   a temporary name and renamed into place, so makes running at the same
+   time at worst lose each other's new results.  */
+
+#define SHELLCACHE_FILE         ".make-shell-cache"
+#define SHELLCACHE_HEADER       "# GNU make shell cache 1"
+
+#define HEX_LENGTH      (sizeof (uintmax_t) * 2)
+
+struct shell_result
+  {
+    uintmax_t command;          /* Digest of what command this is.  */
+    uintmax_t inputs;           /* Digest of what it depends on.  */
+    char *output;               /* What it expanded to.  */
+    unsigned int length;        /* The length of OUTPUT.  */
+  };
+
+static struct hash_table shell_results;
+
+/* Nonzero once the file has been read.  */
+
+static int shell_cache_read = 0;
+
+/* Nonzero if anything was added since the file was read.  */
+
+static int shell_cache_changed = 0;
+
+/* Variables that say how make was invoked, rather than anything a command
+   run while reading the makefiles depends on.  */
+
+static const char *const ignored_variables[] =
+  {
+    "MAKEFLAGS=", "MFLAGS=", "MAKELEVEL=", "MAKE_RESTARTS=",
+    "PWD=", "OLDPWD=", 0
+  };
+
+/* Set by reap_children when a $(shell ...) command finishes.  */
+
+extern int shell_function_completed, shell_function_status;
+
+static unsigned long
+result_hash_1 (const void *key)
+{
+  return (unsigned long) ((struct shell_result const *) key)->command;
+}
+
+static unsigned long
+result_hash_2 (const void *key)
+{
+  return (unsigned long) (((struct shell_result const *) key)->command >> 16);
+}
+
+static int
+result_hash_cmp (const void *x, const void *y)
+{
+  uintmax_t a = ((struct shell_result const *) x)->command;
+  uintmax_t b = ((struct shell_result const *) y)->command;
+
+  return a < b ? -1 : a > b;
+}
+
+/* Write N to BUF in hexadecimal, as HEX_LENGTH digits.  */
+
+static void
+hex_string (char *buf, uintmax_t n)
+{
+  int i;
+
+  for (i = HEX_LENGTH - 1; i >= 0; --i, n >>= 4)
+    buf[i] = "0123456789abcdef"[n & 0xf];
+  buf[HEX_LENGTH] = '\0';
+}
+
+/* Parse a hexadecimal number followed by a space at *PP, and move *PP past
+   both.  Return zero if there isn't one.  */
+
+static int
+get_hex (char **pp, uintmax_t *np)
+{
+  char *p = *pp;
+  uintmax_t n = 0;
+
+  if (!isxdigit ((unsigned char) *p))
+    return 0;
+
+  for (; isxdigit ((unsigned char) *p); ++p)
+    n = (n << 4) | (isdigit ((unsigned char) *p)
+                    ? *p - '0' : tolower ((unsigned char) *p) - 'a' + 10);
+
+  if (*p != ' ')
+    return 0;
+
+  *pp = p + 1;
+  *np = n;
+  return 1;
+}
+
+/* Read one line from FP into *BUFP, growing it as needed.
+   Return zero at EOF.  */
+
+static int
+read_line (FILE *fp, char **bufp, unsigned int *sizep)
+{
+  unsigned int len = 0;
+  int c;
+
+  while ((c = getc (fp)) != EOF && c != '\n')
+    {
+      if (len + 1 >= *sizep)
+        {
+          *sizep = *sizep ? *sizep * 2 : 200;
+          *bufp = xrealloc (*bufp, *sizep);
+        }
+      (*bufp)[len++] = c;
+    }
+
+  if (c == EOF && len == 0)
+    return 0;
+
+  if (*sizep == 0)
+    {
+      *sizep = 200;
+      *bufp = xmalloc (*sizep);
+    }
+  (*bufp)[len] = '\0';
+  return 1;
+}
+
+/* Remember that the command COMMAND, depending on INPUTS, expanded to the
+   LENGTH characters at OUTPUT, forgetting what it expanded to before.  */
+
+static void
+set_result (uintmax_t command, uintmax_t inputs, const char *output,
+            unsigned int length)
+{
+  struct shell_result key;
+  struct shell_result **slot;
+  struct shell_result *r;
+
+  key.command = command;
+  slot = (struct shell_result **) hash_find_slot (&shell_results, &key);
+  r = *slot;
+  if (HASH_VACANT (r))
+    {
+      r = xmalloc (sizeof (struct shell_result));
+      r->command = command;
+      hash_insert_at (&shell_results, r, slot);
+    }
+  else
+    free (r->output);
+
+  r->inputs = inputs;
+  r->output = xmalloc (length + 1);
+  memcpy (r->output, output, length);
+  r->output[length] = '\0';
+  r->length = length;
+}
+
+/* Read the results that earlier makes left, if we haven't yet.  */
+
+static void
+read_results (void)
+{
+  FILE *fp;
+  char *buf = 0;
+  unsigned int size = 0;
+  char *output = 0;
+
+  if (shell_cache_read)
+    return;
+  shell_cache_read = 1;
+
+  hash_init (&shell_results, 100, result_hash_1, result_hash_2,
+             result_hash_cmp);
+
+  fp = fopen (SHELLCACHE_FILE, "rb");
+  if (fp == 0)
+    {
+      if (errno != ENOENT)
+        perror_with_name (_("shell cache: "), SHELLCACHE_FILE);
+      return;
+    }
+
+  if (read_line (fp, &buf, &size) && streq (buf, SHELLCACHE_HEADER))
+    while (read_line (fp, &buf, &size))
+      {
+        char *p = buf;
+        char *end;
+        uintmax_t command, inputs;
+        unsigned long len;
+
+        /* Nothing after a damaged entry can be trusted.  */
+        if (!get_hex (&p, &command) || !get_hex (&p, &inputs)
+            || !isdigit ((unsigned char) *p))
+          break;
+        errno = 0;
+        len = strtoul (p, &end, 10);
+        if (*end != '\0' || errno != 0 || len >= UINT_MAX)
+          break;
+
+        output = xrealloc (output, len + 1);
+        if (fread (output, 1, len + 1, fp) != len + 1 || output[len] != '\n')
+          break;
+
+        set_result (command, inputs, output, (unsigned int) len);
+      }
+  else
+    DB (DB_BASIC, (_("Ignoring shell cache file '%s' in an unknown format\n"),
+                   SHELLCACHE_FILE));
+
+  fclose (fp);
+  free (buf);
+  free (output);
+
+  DB (DB_VERBOSE, (_("Read %lu shell command results from '%s'\n"),
+                   shell_results.ht_fill, SHELLCACHE_FILE));
+}
+
+/* Add the contents of the variable NAME, as $(shell ...) would use it,
+   to the digest H.  */
+
+static uintmax_t
+add_variable (uintmax_t h, const char *name)
+{
+  char *ref = xmalloc (strlen (name) + 4);
+  char *value;
+
+  sprintf (ref, "$(%s)", name);
+  value = allocated_variable_expand (ref);
+  h = fnv_add_str (h, value);
+  h = fnv_add (h, "", 1);
+
+  free (value);
+  free (ref);
+  return h;
+}
+
+/* Add the state of the file NAME to the digest H.  */
+
+static uintmax_t
+add_input (uintmax_t h, const char *name)
+{
+  uintmax_t digest;
+  struct stat st;
+  int e;
+
+  h = fnv_add_str (h, name);
+  if (hashdb_digest (name, &digest))
+    {
+      h = fnv_add (h, "f", 1);
+      return fnv_add (h, &digest, sizeof digest);
+    }
+
+  EINTRLOOP (e, stat (name, &st));
+  if (e != 0)
+    return fnv_add (h, "-", 1);
+
+  digest = (uintmax_t) st.st_mtime;
+  h = fnv_add (h, "d", 1);
+  return fnv_add (h, &digest, sizeof digest);
+}
+
+/* Expand $(shell-cached ...) with the arguments ARGV into O.  */
+
+char *
+shell_cache_expand (char *o, char **argv)
+{
+  struct shell_result key;
+  struct shell_result *r;
+  uintmax_t env = 0;
+  unsigned int len;
+  unsigned long offset;
+  char **ep;
+  const char *files;
+  const char *p;
+
+  read_results ();
+
+  /* Which command this is, and what it depends on.  The order of the
+     environment doesn't matter.  */
+  key.command = fnv_add_str (FNV_OFFSET, SHELLCACHE_HEADER);
+  key.command = fnv_add_str (key.command, argv[0]);
+  key.command = fnv_add (key.command, "", 1);
+  key.command = add_variable (key.command, "SHELL");
+  key.command = add_variable (key.command, ".SHELLFLAGS");
+
+  for (ep = environ; *ep != 0; ++ep)
+    {
+      const char *const *v;
+
+      for (v = ignored_variables; *v != 0; ++v)
+        if (strneq (*ep, *v, strlen (*v)))
+          break;
+      if (*v == 0)
+        env += fnv_add_str (FNV_OFFSET, *ep);
+    }
+  key.inputs = fnv_add (FNV_OFFSET, &env, sizeof env);
+
+  files = argv[1] ? argv[1] : "";
+  while ((p = find_next_token (&files, &len)) != 0)
+    {
+      char *name = xstrndup (p, len);
+
+      key.command = fnv_add (key.command, name, len + 1);
+      key.inputs = add_input (key.inputs, name);
+      free (name);
+    }
+
+  r = hash_find_item (&shell_results, &key);
+  if (r != 0 && r->inputs == key.inputs)
+    {
+      DB (DB_VERBOSE, (_("Using the cached result of '%s'.\n"), argv[0]));
+      return variable_buffer_output (o, r->output, r->length);
+    }
+
+  /* The output buffer may move while the command runs.  */
+  offset = o - variable_buffer;
+  o = func_shell_base (o, argv, 1);
+
+  if (shell_function_completed == 1 && shell_function_status == 0)
+    {
+      set_result (key.command, key.inputs, variable_buffer + offset,
+                  (unsigned int) (o - variable_buffer - offset));
+      shell_cache_changed = 1;
+    }
+
+  return o;
+}
+
+static void
+write_result (const void *item, void *arg)
+{
+  const struct shell_result *r = item;
+  FILE *fp = arg;
+  char command[HEX_LENGTH + 1];
+  char inputs[HEX_LENGTH + 1];
+
+  hex_string (command, r->command);
+  hex_string (inputs, r->inputs);
+  fprintf (fp, "%s %s %u\n", command, inputs, r->length);
+  fwrite (r->output, 1, r->length, fp);
+  putc ('\n', fp);
+}
+
+/* Write the results back to the file, if any were added.  */
+
+void
+shell_cache_save (void)
+{
+  char *tmp;
+  FILE *fp;
+
+  if (!shell_cache_changed)
+    return;
+  shell_cache_changed = 0;
+
+  /* Write to a temporary file and rename it into place, so that concurrent
+     makes never see a partially written file.  */
+  tmp = xmalloc (CSTRLEN (SHELLCACHE_FILE) + INTSTR_LENGTH
+                 + CSTRLEN (".tmp") + 2);
+  sprintf (tmp, "%s.%lu.tmp", SHELLCACHE_FILE, (unsigned long) getpid ());
+
+  fp = fopen (tmp, "wb");
+  if (fp == 0)
+    perror_with_name (_("shell cache: "), tmp);
+  else
+    {
+      int ok;
+
+      fputs (SHELLCACHE_HEADER "\n", fp);
+      hash_map_arg (&shell_results, write_result, fp);
+      ok = !ferror (fp);
+      if (fclose (fp) != 0)
+        ok = 0;
+      if (!ok || rename (tmp, SHELLCACHE_FILE) != 0)
+        {
+          perror_with_name (_("shell cache: "), tmp);
+          unlink (tmp);
+        }
+    }
+
+  free (tmp);
+}
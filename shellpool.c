@@ -0,0 +1,581 @@
+/* Running recipes in long-lived shells for GNU Make.
+Copyright (C) 2013 Free Software Foundation, Inc.
+This file is part of GNU Make.
+
+GNU Make is free software; you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation; either version 3 of the License, or (at your option) any later
+version.
+
+GNU Make is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "makeint.h"
+
+#ifdef MAKE_SHELL_POOL
+
+#ifdef HAVE_FCNTL_H
+# include <fcntl.h>
+#else
+# include <sys/file.h>
+#endif
+#include <poll.h>
+
+#include "filedef.h"
+#include "job.h"
+#include "debug.h"
+
+/* Starting a shell for every recipe line costs an exec, dynamic linking and
+   the shell's own start-up, which is most of the time taken by a small
+   recipe.  With --shell-pool, make keeps shells running and writes each
+   command that would have been run with 'SHELL -c' to one that is idle.
+   The shell runs it in a subshell, so that nothing the command does (to
+   variables, the directory, traps...) is seen by the next one, and then
+   writes the exit status to a pipe and sends us SIGCHLD, so that we notice
+   just as if a child had died.
+
+   The shells are started with an empty environment, and each command's
+   subshell exports the child's environment first.  A command whose
+   environment can't be set that way is run as usual.
+
+   Each shell has these descriptors:
+
+     0  the pipe we write commands to
+     1  our standard output
+     2  our standard error
+     3  the pipe it writes exit statuses to
+     4  our standard input, for the child with the good stdin
+     5  a temporary file for standard output, with --output-sync
+     6  a temporary file for standard error, with --output-sync
+
+   With --output-sync, the child's output goes to its own temporary files,
+   which the shell can't be given; so the output goes to the shell's, and
+   is appended to the child's when the command is done.  */
+
+struct shell
+  {
+    struct shell *next;
+    char *path;                 /* The shell program.  */
+    pid_t pid;
+    int cmd_fd;                 /* Write end of its command pipe.  */
+    int status_fd;              /* Read end of its status pipe.  */
+    int out_fd;                 /* Its temporary files, or -1.  */
+    int err_fd;
+    struct child *child;        /* Whose command it is running, or 0.  */
+    int child_out;              /* Where that child's output goes.  */
+    int child_err;
+    char status[16];            /* The status line read so far.  */
+    unsigned int status_len;
+  };
+
+static struct shell *shells = 0;
+
+/* The number of shells that are running a command.  */
+
+static unsigned int shells_busy = 0;
+
+/* Variables that shells set themselves, or won't let us set.  */
+
+static const char *const shell_variables[] =
+  {
+    "ENV", "IFS", "LINENO", "OPTIND", "PPID", "PS1", "PS2", "PS4",
+    "BASHOPTS", "BASH_VERSINFO", "EUID", "SHELLOPTS", "UID",
+    0
+  };
+
+/* Return nonzero if NAME, which ends at END, can be exported from the
+   shell.  */
+
+static int
+exportable (const char *name, const char *end)
+{
+  const char *const *v;
+  const char *p;
+
+  if (name == end || (!isalpha ((unsigned char)*name) && *name != '_'))
+    return 0;
+  for (p = name; p < end; ++p)
+    if (!isalnum ((unsigned char)*p) && *p != '_')
+      return 0;
+
+  for (v = shell_variables; *v != 0; ++v)
+    if (strlen (*v) == (size_t) (end - name)
+        && strncmp (*v, name, end - name) == 0)
+      return 0;
+
+  return 1;
+}
+
+/* Return nonzero if DIR is the current directory.  */
+
+static int
+names_cwd (const char *dir)
+{
+  struct stat st, cwd;
+  int e;
+
+  EINTRLOOP (e, stat (dir, &st));
+  if (e != 0)
+    return 0;
+  EINTRLOOP (e, stat (".", &cwd));
+  return e == 0 && st.st_dev == cwd.st_dev && st.st_ino == cwd.st_ino;
+}
+
+/* A growing buffer for the script we write to a shell.  */
+
+struct script
+  {
+    char *buf;
+    size_t len;
+    size_t size;
+  };
+
+static void
+script_add (struct script *s, const char *str, size_t len)
+{
+  if (s->len + len + 1 > s->size)
+    {
+      s->size = (s->len + len + 1) * 2;
+      s->buf = xrealloc (s->buf, s->size);
+    }
+  memcpy (s->buf + s->len, str, len);
+  s->len += len;
+  s->buf[s->len] = '\0';
+}
+
+#define script_str(_s, _str)   script_add ((_s), (_str), strlen (_str))
+
+/* Add STR to S as one single-quoted word.  */
+
+static void
+script_quote (struct script *s, const char *str)
+{
+  script_add (s, "'", 1);
+  while (1)
+    {
+      const char *q = strchr (str, '\'');
+
+      if (q == 0)
+        break;
+      script_add (s, str, q - str);
+      script_add (s, "'\\''", 4);
+      str = q + 1;
+    }
+  script_str (s, str);
+  script_add (s, "'", 1);
+}
+
+/* Write LEN bytes at BUF to FD.  Return 0, or -1 if it failed.  */
+
+static int
+write_all (int fd, const char *buf, size_t len)
+{
+  while (len > 0)
+    {
+      ssize_t n;
+
+      EINTRLOOP (n, write (fd, buf, len));
+      if (n < 0)
+        return -1;
+      buf += n;
+      len -= n;
+    }
+
+  return 0;
+}
+
+/* Append the contents of the temporary file FROM to TO, and empty FROM.  */
+
+static void
+move_output (int from, int to)
+{
+  char buf[8192];
+  int e;
+
+  if (lseek (from, 0, SEEK_SET) < 0)
+    return;
+
+  while (1)
+    {
+      ssize_t n;
+
+      EINTRLOOP (n, read (from, buf, sizeof buf));
+      if (n <= 0)
+        break;
+      if (write_all (to, buf, n) < 0)
+        break;
+    }
+
+  lseek (from, 0, SEEK_SET);
+  EINTRLOOP (e, ftruncate (from, 0));
+}
+
+/* Start a new shell running PATH.  Return 0 if it can't be started.  Like
+   other children, it is started with the fatal signals blocked.  */
+
+static struct shell *
+start_shell (const char *path)
+{
+  static char *no_environment[] = { 0 };
+  struct shell *sh;
+  int cmd[2], status[2];
+  int fds[7];
+  char *argv[2];
+  pid_t pid;
+  int i;
+
+  if (pipe (cmd) < 0)
+    return 0;
+  if (pipe (status) < 0)
+    {
+      close (cmd[0]);
+      close (cmd[1]);
+      return 0;
+    }
+
+  sh = xcalloc (sizeof (struct shell));
+  sh->path = xstrdup (path);
+  sh->cmd_fd = cmd[1];
+  sh->status_fd = status[0];
+  sh->out_fd = sh->err_fd = -1;
+  CLOSE_ON_EXEC (cmd[0]);
+  CLOSE_ON_EXEC (cmd[1]);
+  CLOSE_ON_EXEC (status[0]);
+  CLOSE_ON_EXEC (status[1]);
+  fcntl (status[0], F_SETFL, O_NONBLOCK);
+
+#ifndef NO_OUTPUT_SYNC
+  if (output_sync)
+    {
+      sh->out_fd = output_tmpfd ();
+      sh->err_fd = output_tmpfd ();
+      CLOSE_ON_EXEC (sh->out_fd);
+      CLOSE_ON_EXEC (sh->err_fd);
+    }
+#endif
+
+  fds[0] = cmd[0];
+  fds[1] = FD_STDOUT;
+  fds[2] = FD_STDERR;
+  fds[3] = status[1];
+  fds[4] = FD_STDIN;
+  fds[5] = sh->out_fd;
+  fds[6] = sh->err_fd;
+
+  argv[0] = sh->path;
+  argv[1] = 0;
+
+  pid = fork ();
+  if (pid == 0)
+    {
+      /* We are the child side.  Move the descriptors out of the way of
+         each other and of the jobserver's first, then into place.  */
+      unblock_sigs ();
+
+      for (i = 0; i < 7; ++i)
+        if (fds[i] >= 0)
+          fds[i] = fcntl (fds[i], F_DUPFD, 10);
+
+      if (job_fds[0] >= 0)
+        {
+          close (job_fds[0]);
+          close (job_fds[1]);
+        }
+      if (job_rfd >= 0)
+        close (job_rfd);
+
+      for (i = 0; i < 7; ++i)
+        if (fds[i] >= 0)
+          {
+            dup2 (fds[i], i);
+            close (fds[i]);
+          }
+        else
+          close (i);
+
+#ifdef SET_STACK_SIZE
+      if (stack_limit.rlim_cur)
+        setrlimit (RLIMIT_STACK, &stack_limit);
+#endif
+
+      execve (argv[0], argv, no_environment);
+      _exit (127);
+    }
+
+  close (cmd[0]);
+  close (status[1]);
+
+  if (pid < 0)
+    {
+      close (cmd[1]);
+      close (status[0]);
+      if (sh->out_fd >= 0)
+        close (sh->out_fd);
+      if (sh->err_fd >= 0)
+        close (sh->err_fd);
+      free (sh->path);
+      free (sh);
+      return 0;
+    }
+
+  DB (DB_JOBS, (_("Started pooled shell %s PID %ld\n"),
+                sh->path, (long) pid));
+
+  sh->pid = pid;
+  sh->next = shells;
+  shells = sh;
+  return sh;
+}
+
+/* Forget the shell SH: it has died, or it can't be used.  */
+
+static void
+drop_shell (struct shell *sh)
+{
+  struct shell **shp;
+
+  for (shp = &shells; *shp != sh; shp = &(*shp)->next)
+    ;
+  *shp = sh->next;
+
+  if (sh->child)
+    {
+      sh->child->pooled = 0;
+      --shells_busy;
+    }
+
+  close (sh->cmd_fd);
+  close (sh->status_fd);
+  if (sh->out_fd >= 0)
+    close (sh->out_fd);
+  if (sh->err_fd >= 0)
+    close (sh->err_fd);
+  free (sh->path);
+  free (sh);
+}
+
+/* Give the command in ARGV, as made by construct_command_argv for child C,
+   to a shell that isn't busy.  Its output goes to OUTFD and ERRFD.  Return 0
+   if a shell is running it, or -1 if it must be run as usual.  */
+
+int
+shell_pool_start (struct child *c, char **argv, int outfd, int errfd)
+{
+  static char *kill_line = 0;
+  struct script s;
+  struct shell *sh;
+  char **ep;
+  int set_e;
+  RETSIGTYPE (*pipe_handler) (int);
+  int r;
+
+  /* Only 'SHELL -c COMMAND', with a shell we know how to talk to.  */
+  if (argv[0] == 0 || !is_bourne_compatible_shell (argv[0])
+      || argv[1] == 0 || argv[2] == 0 || argv[3] != 0)
+    return -1;
+  if (streq (argv[1], "-c"))
+    set_e = 0;
+  else if (streq (argv[1], "-ec"))
+    set_e = 1;
+  else
+    return -1;
+
+  for (ep = c->environment; *ep != 0; ++ep)
+    {
+      const char *eq = strchr (*ep, '=');
+
+      if (eq == 0 || !exportable (*ep, eq))
+        return -1;
+    }
+
+  for (sh = shells; sh != 0; sh = sh->next)
+    if (sh->child == 0 && streq (sh->path, argv[0]))
+      break;
+  if (sh == 0)
+    sh = start_shell (argv[0]);
+  if (sh == 0)
+    return -1;
+
+  if ((outfd != FD_STDOUT || errfd != FD_STDERR) && sh->out_fd < 0)
+    return -1;
+
+  if (kill_line == 0)
+    {
+      kill_line = xmalloc (64);
+      sprintf (kill_line, "echo $? >&3; kill -s CHLD %ld\n",
+               (long) getpid ());
+    }
+
+  memset (&s, '\0', sizeof s);
+  script_str (&s, "(");
+  for (ep = c->environment; *ep != 0; ++ep)
+    {
+      const char *eq = strchr (*ep, '=');
+
+      /* A new shell sets PWD itself if the one it is given isn't the
+         current directory, as it isn't after -C.  The shell we talk to
+         did that when it started, in the directory we run commands in.  */
+      if (strneq (*ep, "PWD=", 4) && !names_cwd (eq + 1))
+        {
+          script_str (&s, "export PWD\n");
+          continue;
+        }
+
+      script_str (&s, "export ");
+      script_add (&s, *ep, eq - *ep + 1);
+      script_quote (&s, eq + 1);
+      script_str (&s, "\n");
+    }
+  if (set_e)
+    script_str (&s, "set -e\n");
+  script_str (&s, "eval ");
+  script_quote (&s, argv[2]);
+  script_str (&s, c->good_stdin ? "\n) <&4" : "\n) </dev/null");
+  if (outfd != FD_STDOUT)
+    script_str (&s, " >&5");
+  if (errfd != FD_STDERR)
+    script_str (&s, errfd == outfd ? " 2>&5" : " 2>&6");
+  script_str (&s, " 3>&- 4<&- 5>&- 6>&-\n");
+  script_str (&s, kill_line);
+
+  /* If the shell has died, we'll find out when we reap it.  */
+  pipe_handler = signal (SIGPIPE, SIG_IGN);
+  r = write_all (sh->cmd_fd, s.buf, s.len);
+  signal (SIGPIPE, pipe_handler);
+  free (s.buf);
+
+  if (r < 0)
+    {
+      DB (DB_JOBS, (_("Can't write to pooled shell PID %ld: %s\n"),
+                    (long) sh->pid, strerror (errno)));
+      drop_shell (sh);
+      return -1;
+    }
+
+  sh->child = c;
+  sh->child_out = outfd;
+  sh->child_err = errfd;
+  sh->status_len = 0;
+  ++shells_busy;
+
+  c->pooled = 1;
+  c->pid = sh->pid;
+
+  DB (DB_JOBS, (_("Pooled shell PID %ld runs a command for %p (%s)\n"),
+                (long) sh->pid, c, c->file->name));
+
+  return 0;
+}
+
+/* Give the child of SH its output.  */
+
+static void
+finish_output (struct shell *sh)
+{
+  if (sh->child_out != FD_STDOUT)
+    move_output (sh->out_fd, sh->child_out);
+  if (sh->child_err != FD_STDERR && sh->child_err != sh->child_out)
+    move_output (sh->err_fd, sh->child_err);
+}
+
+/* If a pooled shell has finished a command, return its child and store the
+   exit status in *STATUS.  Otherwise return 0.  Never blocks.  */
+
+struct child *
+shell_pool_reap (int *status)
+{
+  struct shell *sh;
+
+  if (shells_busy == 0)
+    return 0;
+
+  for (sh = shells; sh != 0; sh = sh->next)
+    {
+      struct child *c = sh->child;
+      char *nl;
+      ssize_t n;
+
+      if (c == 0)
+        continue;
+
+      EINTRLOOP (n, read (sh->status_fd, sh->status + sh->status_len,
+                          sizeof (sh->status) - 1 - sh->status_len));
+      if (n <= 0)
+        /* Not yet, or it has died and we'll hear about it from wait().  */
+        continue;
+      sh->status_len += n;
+      sh->status[sh->status_len] = '\0';
+
+      nl = strchr (sh->status, '\n');
+      if (nl == 0)
+        continue;
+
+      *status = atoi (sh->status);
+      finish_output (sh);
+
+      sh->child = 0;
+      --shells_busy;
+      c->pooled = 0;
+      return c;
+    }
+
+  return 0;
+}
+
+/* Return nonzero if a pooled shell has finished a command that we haven't
+   reaped yet.  */
+
+int
+shell_pool_ready (void)
+{
+  struct shell *sh;
+
+  if (shells_busy == 0)
+    return 0;
+
+  for (sh = shells; sh != 0; sh = sh->next)
+    if (sh->child)
+      {
+        struct pollfd pfd;
+
+        pfd.fd = sh->status_fd;
+        pfd.events = POLLIN;
+        if (poll (&pfd, 1, 0) > 0 && (pfd.revents & POLLIN))
+          return 1;
+      }
+
+  return 0;
+}
+
+/* Return the number of commands the pooled shells are running.  */
+
+unsigned int
+shell_pool_busy (void)
+{
+  return shells_busy;
+}
+
+/* The process PID has been reaped.  If it was a pooled shell, forget it; the
+   caller deals with the child it was running a command for, if any.  */
+
+void
+shell_pool_died (pid_t pid)
+{
+  struct shell *sh;
+
+  for (sh = shells; sh != 0; sh = sh->next)
+    if (sh->pid == pid)
+      {
+        DB (DB_JOBS, (_("Pooled shell PID %ld died\n"), (long) pid));
+        if (sh->child)
+          finish_output (sh);
+        drop_shell (sh);
+        return;
+      }
+}
+
+#endif /* MAKE_SHELL_POOL */
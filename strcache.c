@@ -23,7 +23,11 @@ this program.  If not, see <http://www.gnu.org/licenses/>.  */
 
 /* A string cached here will never be freed, so we don't need to worry about
    reference counting.  We just store the string, and then remember it in a
-   hash so it can be looked up again. */
+   hash so it can be looked up again.
+
+   Each string is stored after a 'struct strcache_info' giving its hash and
+   its length (see makeint.h), so that the tables keyed on cached strings
+   can use them rather than compute them again.  */
 
 typedef unsigned short int sc_buflen_t;
 
@@ -32,6 +36,7 @@ struct strcache {
   sc_buflen_t end;          /* Offset to the beginning of free space.  */
   sc_buflen_t bytesfree;    /* Free space left in this buffer.  */
   sc_buflen_t count;        /* # of strings in this buffer (for stats).  */
+  sc_buflen_t unused;       /* Keeps the buffer aligned for the headers.  */
   char buffer[1];           /* The buffer comes after this.  */
 };
 
@@ -43,6 +48,13 @@ struct strcache {
 #define CACHE_BUFFER_OFFSET     (offsetof (struct strcache, buffer))
 #define CACHE_BUFFER_SIZE(_s)   (CACHE_BUFFER_ALLOC(_s) - CACHE_BUFFER_OFFSET)
 
+/* The space taken in a buffer by a string of length _L, with its header and
+   its nul, rounded up so the next header is aligned.  */
+#define CACHE_ENTRY_ALIGN       (sizeof (unsigned int))
+#define CACHE_ENTRY_SIZE(_l)    ((sizeof (struct strcache_info) + (_l) + 1 \
+                                  + CACHE_ENTRY_ALIGN - 1) \
+                                 & ~(CACHE_ENTRY_ALIGN - 1))
+
 static sc_buflen_t bufsize = CACHE_BUFFER_SIZE (CACHE_BUFFER_BASE);
 static struct strcache *strcache = NULL;
 static struct strcache *fullcache = NULL;
@@ -51,6 +63,67 @@ static unsigned long total_buffers = 0;
 static unsigned long total_strings = 0;
 static unsigned long total_size = 0;
 
+
+/* To tell whether a pointer is into a buffer without walking the lists of
+   buffers, each buffer is entered in a hash table under the number of every
+   CHUNK_SIZE block of memory it touches.  A buffer is always larger than a
+   block, so no block can touch more than two buffers.  */
+
+#define CHUNK_SHIFT     12
+#define CHUNK_OF(_p)    (((unsigned long) (_p)) >> CHUNK_SHIFT)
+
+struct chunk {
+  unsigned long number;         /* The address of the block >> CHUNK_SHIFT.  */
+  struct strcache *buffers[2];  /* The buffers it touches.  */
+};
+
+static unsigned long
+chunk_hash_1 (const void *key)
+{
+  return_INTEGER_HASH_1 (((const struct chunk *) key)->number);
+}
+
+static unsigned long
+chunk_hash_2 (const void *key)
+{
+  return_INTEGER_HASH_2 (((const struct chunk *) key)->number);
+}
+
+static int
+chunk_hash_cmp (const void *x, const void *y)
+{
+  unsigned long xn = ((const struct chunk *) x)->number;
+  unsigned long yn = ((const struct chunk *) y)->number;
+  return xn == yn ? 0 : xn < yn ? -1 : 1;
+}
+
+static struct hash_table chunks;
+
+static void
+add_chunks (struct strcache *sp)
+{
+  unsigned long n = CHUNK_OF (sp->buffer);
+  unsigned long last = CHUNK_OF (sp->buffer + bufsize - 1);
+
+  for (; n <= last; ++n)
+    {
+      struct chunk key;
+      struct chunk **slot;
+      struct chunk *c;
+
+      key.number = n;
+      slot = (struct chunk **) hash_find_slot (&chunks, &key);
+      c = *slot;
+      if (HASH_VACANT (c))
+        {
+          c = xcalloc (sizeof (struct chunk));
+          c->number = n;
+          hash_insert_at (&chunks, c, slot);
+        }
+      c->buffers[c->buffers[0] != 0] = sp;
+    }
+}
+
 /* Add a new buffer to the cache.  Add it at the front to reduce search time.
    This can also increase the overhead, since it's less likely that older
    buffers will be filled in.  However, GNU make has so many smaller strings
@@ -68,18 +141,21 @@ new_cache ()
   new->next = strcache;
   strcache = new;
 
+  add_chunks (new);
+
   ++total_buffers;
   return new;
 }
 
 static const char *
-add_string (const char *str, unsigned int len)
+add_string (const char *str, unsigned int len, unsigned int hash)
 {
+  struct strcache_info *info;
   char *res;
   struct strcache *sp;
   struct strcache **spp = &strcache;
-  /* We need space for the nul char.  */
-  unsigned int sz = len + 1;
+  /* We need space for the header and the nul char.  */
+  unsigned int sz = CACHE_ENTRY_SIZE (len);
 
   /* If the string we want is too large to fit into a single buffer, then
      no existing cache is large enough.  Change the maximum size.  */
@@ -101,7 +177,10 @@ add_string (const char *str, unsigned int len)
     }
 
   /* Add the string to this cache.  */
-  res = &sp->buffer[sp->end];
+  info = (struct strcache_info *) &sp->buffer[sp->end];
+  info->hash = hash;
+  info->len = len;
+  res = (char *) (info + 1);
   memmove (res, str, len);
   res[len] = '\0';
   sp->end += sz;
@@ -124,34 +203,90 @@ add_string (const char *str, unsigned int len)
 }
 
 
-/* Hash table of strings in the cache.  */
+/* Hash table of strings in the cache.  The items are the cached strings.
+   A string being looked up needn't be nul-terminated, so it is described
+   by LOOKUP_KEY instead, and the hash functions tell it apart by its
+   address.  */
+
+static struct
+  {
+    const char *str;
+    unsigned int len;
+    unsigned int hash;
+  } lookup_key;
+
+#define KEY_STR(_k)  ((_k) == &lookup_key ? lookup_key.str : (const char *) (_k))
+#define KEY_LEN(_k)  ((_k) == &lookup_key ? lookup_key.len : strcache_len (_k))
+
+/* Compute the hash of the LEN chars at STR as ISTRING_HASH_1 does, but
+   without needing a nul after them.  */
+
+#ifdef HAVE_CASE_INSENSITIVE_FS
+# define FOLD(_c) (isupper (_c) ? tolower (_c) : (_c))
+#else
+# define FOLD(_c) (_c)
+#endif
+
+static unsigned int
+str_hash (const char *str, unsigned int len)
+{
+  const unsigned char *p = (const unsigned char *) str;
+  unsigned long h = 0;
+
+  for (; len > 1; ++p, --len)
+    h += FOLD (p[0]) << (FOLD (p[1]) & 0xf);
+  if (len)
+    h += FOLD (p[0]);
+
+  return h;
+}
 
 static unsigned long
 str_hash_1 (const void *key)
 {
-  return_ISTRING_HASH_1 ((const char *) key);
+  return key == &lookup_key ? lookup_key.hash : strcache_hash (key);
 }
 
 static unsigned long
 str_hash_2 (const void *key)
 {
-  return_ISTRING_HASH_2 ((const char *) key);
+  return str_hash_1 (key) >> 7;
 }
 
 static int
 str_hash_cmp (const void *x, const void *y)
 {
-  return_ISTRING_COMPARE ((const char *) x, (const char *) y);
+  unsigned int xlen = KEY_LEN (x);
+  unsigned int ylen = KEY_LEN (y);
+
+  if (xlen != ylen)
+    return xlen < ylen ? -1 : 1;
+#ifdef HAVE_CASE_INSENSITIVE_FS
+  return strncasecmp (KEY_STR (x), KEY_STR (y), xlen);
+#else
+  return memcmp (KEY_STR (x), KEY_STR (y), xlen);
+#endif
 }
 
 static struct hash_table strings;
 static unsigned long total_adds = 0;
 
+/* Return the slot of the LEN chars at STR in the strings.  */
+
+static const char **
+find_string (const char *str, unsigned int len)
+{
+  lookup_key.str = str;
+  lookup_key.len = len;
+  lookup_key.hash = str_hash (str, len);
+  return (const char **) hash_find_slot (&strings, &lookup_key);
+}
+
 static const char *
-add_hash (const char *str, int len)
+add_hash (const char *str, unsigned int len)
 {
   /* Look up the string in the hash.  If it's there, return it.  */
-  char *const *slot = (char *const *) hash_find_slot (&strings, str);
+  const char **slot = find_string (str, len);
   const char *key = *slot;
 
   /* Count the total number of add operations we performed.  */
@@ -161,7 +296,7 @@ add_hash (const char *str, int len)
     return key;
 
   /* Not there yet so add it to a buffer, then into the hash table.  */
-  key = add_string (str, len);
+  key = add_string (str, len, lookup_key.hash);
   hash_insert_at (&strings, key, slot);
   return key;
 }
@@ -170,14 +305,17 @@ add_hash (const char *str, int len)
 int
 strcache_iscached (const char *str)
 {
-  struct strcache *sp;
-
-  for (sp = strcache; sp != 0; sp = sp->next)
-    if (str >= sp->buffer && str < sp->buffer + sp->end)
-      return 1;
-  for (sp = fullcache; sp != 0; sp = sp->next)
-    if (str >= sp->buffer && str < sp->buffer + sp->end)
-      return 1;
+  struct chunk key;
+  const struct chunk *c;
+  int i;
+
+  key.number = CHUNK_OF (str);
+  c = hash_find_item (&chunks, &key);
+  if (c != 0)
+    for (i = 0; i < 2 && c->buffers[i] != 0; ++i)
+      if (str >= c->buffers[i]->buffer
+          && str < c->buffers[i]->buffer + c->buffers[i]->end)
+        return 1;
 
   return 0;
 }
@@ -191,22 +329,23 @@ strcache_add (const char *str)
   return add_hash (str, strlen (str));
 }
 
+/* Likewise for the LEN chars at STR, which needn't be nul-terminated.  */
 const char *
 strcache_add_len (const char *str, unsigned int len)
 {
-  /* If we're not given a nul-terminated string we have to create one, because
-     the hashing functions expect it.  */
-  if (str[len] != '\0')
-    {
-      char *key = alloca (len + 1);
-      memcpy (key, str, len);
-      key[len] = '\0';
-      str = key;
-    }
-
   return add_hash (str, len);
 }
 
+/* If the LEN chars at STR are in the cache, return the cached version.
+   If not, return NULL without adding them.  */
+const char *
+strcache_find_len (const char *str, unsigned int len)
+{
+  const char *key = *find_string (str, len);
+
+  return HASH_VACANT (key) ? NULL : key;
+}
+
 int
 strcache_setbufsize (unsigned int size)
 {
@@ -219,6 +358,7 @@ void
 strcache_init (void)
 {
   hash_init (&strings, 8000, str_hash_1, str_hash_2, str_hash_cmp);
+  hash_init (&chunks, 256, chunk_hash_1, chunk_hash_2, chunk_hash_cmp);
 }
 
 
@@ -37,6 +37,8 @@ static struct pattern_var *pattern_vars;
 
 static struct pattern_var *last_pattern_vars[256];
 
+static void forget_pattern_var_index (void);
+
 /* Create a new pattern-specific variable struct. The new variable is
    inserted into the PATTERN_VARS list in the shortest patterns first
    order to support the shortest stem matching (the variables are
@@ -50,6 +52,8 @@ create_pattern_var (const char *target, const char *suffix)
   register unsigned int len = strlen (target);
   register struct pattern_var *p = xmalloc (sizeof (struct pattern_var));
 
+  forget_pattern_var_index ();
+
   if (pattern_vars != 0)
     {
       if (len < 256 && last_pattern_vars[len] != 0)
@@ -92,52 +96,274 @@ create_pattern_var (const char *target, const char *suffix)
   return p;
 }
 
-/* Look up a target in the pattern-specific variable list.  */
+/* Return the pattern-specific variable following START, or the first one
+   if START is null.  */
 
-static struct pattern_var *
-lookup_pattern_var (struct pattern_var *start, const char *target)
+struct pattern_var *
+next_pattern_var (struct pattern_var *start)
+{
+  return start ? start->next : pattern_vars;
+}
+
+/* An index of the pattern-specific variables by their suffixes (the text
+   after the '%'), so that finding the variables for a target only looks at
+   the patterns that could match it.  It is built when it is first wanted,
+   and thrown away when another pattern-specific variable is defined.  */
+
+struct pattern_var_ref
+  {
+    struct pattern_var *p;
+    unsigned int order;         /* Position in PATTERN_VARS.  */
+  };
+
+struct pattern_var_suffix
+  {
+    const char *suffix;
+    unsigned int count;
+    unsigned int size;
+    struct pattern_var_ref *refs;  /* In the order of PATTERN_VARS.  */
+  };
+
+static struct hash_table pattern_var_index;
+static int pattern_var_index_valid = 0;
+
+/* The distinct lengths of the suffixes, from the shortest.  */
+
+static unsigned int *pattern_var_suffix_lengths = 0;
+static unsigned int num_pattern_var_suffix_lengths = 0;
+
+static unsigned long
+pattern_var_suffix_hash_1 (const void *key)
+{
+  return_STRING_HASH_1 (((const struct pattern_var_suffix *) key)->suffix);
+}
+
+static unsigned long
+pattern_var_suffix_hash_2 (const void *key)
+{
+  return_STRING_HASH_2 (((const struct pattern_var_suffix *) key)->suffix);
+}
+
+static int
+pattern_var_suffix_hash_cmp (const void *x, const void *y)
+{
+  return_STRING_COMPARE (((const struct pattern_var_suffix *) x)->suffix,
+                         ((const struct pattern_var_suffix *) y)->suffix);
+}
+
+static void
+free_pattern_var_suffix (const void *item)
+{
+  struct pattern_var_suffix *ps = (struct pattern_var_suffix *) item;
+  free (ps->refs);
+  free (ps);
+}
+
+static int
+pattern_var_ref_compare (const void *v1, const void *v2)
+{
+  const struct pattern_var_ref *r1 = v1;
+  const struct pattern_var_ref *r2 = v2;
+  return r1->order < r2->order ? -1 : r1->order > r2->order;
+}
+
+static void
+forget_pattern_var_index (void)
+{
+  if (!pattern_var_index_valid)
+    return;
+
+  hash_map (&pattern_var_index, free_pattern_var_suffix);
+  hash_free (&pattern_var_index, 0);
+  num_pattern_var_suffix_lengths = 0;
+  pattern_var_index_valid = 0;
+}
+
+static void
+index_pattern_vars (void)
 {
   struct pattern_var *p;
-  unsigned int targlen = strlen (target);
+  unsigned int max_lengths = 0;
+  unsigned int order = 0;
 
-  for (p = start ? start->next : pattern_vars; p != 0; p = p->next)
+  hash_init (&pattern_var_index, 64, pattern_var_suffix_hash_1,
+             pattern_var_suffix_hash_2, pattern_var_suffix_hash_cmp);
+  num_pattern_var_suffix_lengths = 0;
+
+  for (p = pattern_vars; p != 0; p = p->next)
     {
-      const char *stem;
-      unsigned int stemlen;
+      struct pattern_var_suffix key;
+      struct pattern_var_suffix **slot;
+      struct pattern_var_suffix *ps;
+
+      key.suffix = p->suffix;
+      slot = (struct pattern_var_suffix **)
+        hash_find_slot (&pattern_var_index, &key);
+      if (HASH_VACANT (*slot))
+        {
+          unsigned int len = strlen (p->suffix);
+          unsigned int i;
+
+          ps = xmalloc (sizeof (struct pattern_var_suffix));
+          ps->suffix = p->suffix;
+          ps->count = ps->size = 0;
+          ps->refs = 0;
+          hash_insert_at (&pattern_var_index, ps, slot);
+
+          /* Remember the length, keeping the lengths in order.  */
+          for (i = 0; i < num_pattern_var_suffix_lengths; ++i)
+            if (pattern_var_suffix_lengths[i] >= len)
+              break;
+          if (i == num_pattern_var_suffix_lengths
+              || pattern_var_suffix_lengths[i] != len)
+            {
+              if (num_pattern_var_suffix_lengths == max_lengths)
+                {
+                  max_lengths += 16;
+                  pattern_var_suffix_lengths =
+                    xrealloc (pattern_var_suffix_lengths,
+                              max_lengths * sizeof (unsigned int));
+                }
+              memmove (&pattern_var_suffix_lengths[i + 1],
+                       &pattern_var_suffix_lengths[i],
+                       (num_pattern_var_suffix_lengths - i)
+                       * sizeof (unsigned int));
+              pattern_var_suffix_lengths[i] = len;
+              ++num_pattern_var_suffix_lengths;
+            }
+        }
+      else
+        ps = *slot;
 
-      if (p->len > targlen)
-        /* It can't possibly match.  */
-        continue;
+      if (ps->count == ps->size)
+        {
+          ps->size = ps->size ? ps->size * 2 : 4;
+          ps->refs = xrealloc (ps->refs,
+                               ps->size * sizeof (struct pattern_var_ref));
+        }
+      ps->refs[ps->count].p = p;
+      ps->refs[ps->count].order = order++;
+      ++ps->count;
+    }
+
+  pattern_var_index_valid = 1;
+}
 
-      /* From the lengths of the filename and the pattern parts,
-         find the stem: the part of the filename that matches the %.  */
-      stem = target + (p->suffix - p->target - 1);
-      stemlen = targlen - p->len + 1;
+/* Return nonzero if the pattern of P matches TARGET, of length TARGLEN.  */
 
-      /* Compare the text in the pattern before the stem, if any.  */
-      if (stem > target && !strneq (p->target, target, stem - target))
+static int
+pattern_var_matches (const struct pattern_var *p, const char *target,
+                     unsigned int targlen)
+{
+  const char *stem;
+  unsigned int stemlen;
+
+  if (p->len > targlen)
+    /* It can't possibly match.  */
+    return 0;
+
+  /* From the lengths of the filename and the pattern parts,
+     find the stem: the part of the filename that matches the %.  */
+  stem = target + (p->suffix - p->target - 1);
+  stemlen = targlen - p->len + 1;
+
+  /* Compare the text in the pattern before the stem, if any.  */
+  if (stem > target && !strneq (p->target, target, stem - target))
+    return 0;
+
+  /* Compare the text in the pattern after the stem, if any.
+     We could test simply using streq, but this way we compare the
+     first two characters immediately.  This saves time in the very
+     common case where the first character matches because it is a
+     period.  */
+  return (*p->suffix == stem[stemlen]
+          && (*p->suffix == '\0' || streq (&p->suffix[1], &stem[stemlen+1])));
+}
+
+/* Find the pattern-specific variables whose patterns match TARGET, in the
+   order they are to be applied: the one with the longest stem first.
+   Return them in a malloc'd array, and their number in *COUNTP; or return
+   null if there are none.  */
+
+static struct pattern_var **
+lookup_pattern_vars (const char *target, unsigned int *countp)
+{
+  struct pattern_var_ref *found = 0;
+  struct pattern_var **vars;
+  unsigned int targlen = strlen (target);
+  unsigned int size = 0;
+  unsigned int count = 0;
+  unsigned int buckets = 0;
+  unsigned int i;
+
+  if (pattern_vars == 0)
+    return 0;
+
+  if (!pattern_var_index_valid)
+    index_pattern_vars ();
+
+  for (i = 0; i < num_pattern_var_suffix_lengths
+              && pattern_var_suffix_lengths[i] <= targlen; ++i)
+    {
+      struct pattern_var_suffix key;
+      struct pattern_var_suffix *ps;
+      unsigned int j;
+      unsigned int before = count;
+
+      key.suffix = target + targlen - pattern_var_suffix_lengths[i];
+      ps = hash_find_item (&pattern_var_index, &key);
+      if (ps == 0)
         continue;
 
-      /* Compare the text in the pattern after the stem, if any.
-         We could test simply using streq, but this way we compare the
-         first two characters immediately.  This saves time in the very
-         common case where the first character matches because it is a
-         period.  */
-      if (*p->suffix == stem[stemlen]
-          && (*p->suffix == '\0' || streq (&p->suffix[1], &stem[stemlen+1])))
-        break;
+      for (j = 0; j < ps->count; ++j)
+        if (pattern_var_matches (ps->refs[j].p, target, targlen))
+          {
+            if (count == size)
+              {
+                size = size ? size * 2 : 8;
+                found = xrealloc (found,
+                                  size * sizeof (struct pattern_var_ref));
+              }
+            found[count++] = ps->refs[j];
+          }
+
+      if (count > before)
+        ++buckets;
     }
 
-  return p;
+  if (count == 0)
+    return 0;
+
+  /* Each suffix's variables are already in order; put them all in order.  */
+  if (buckets > 1)
+    qsort (found, count, sizeof (struct pattern_var_ref),
+           pattern_var_ref_compare);
+
+  vars = xmalloc (count * sizeof (struct pattern_var *));
+  for (i = 0; i < count; ++i)
+    vars[i] = found[i].p;
+  free (found);
+
+  *countp = count;
+  return vars;
 }
 
-/* Hash table of all global variable definitions.  */
+/* Hash table of all global variable definitions.  Each variable, and each
+   key looked up, holds the hash of its name, so that looking a name up in
+   each set of a list hashes it only once.  */
+
+unsigned int
+variable_name_hash (const char *name, unsigned int length)
+{
+  unsigned long result = 0;
+  STRING_N_HASH_1 (name, length, result);
+  return result;
+}
 
 static unsigned long
 variable_hash_1 (const void *keyv)
 {
-  struct variable const *key = (struct variable const *) keyv;
-  return_STRING_N_HASH_1 (key->name, key->length);
+  return ((struct variable const *) keyv)->hash;
 }
 
 static unsigned long
@@ -169,6 +395,10 @@ variable_hash_cmp (const void *xv, const void *yv)
 #endif
 
 static struct variable_set global_variable_set;
+
+/* Where the variable records come from.  */
+static struct objpool variable_pool
+  = OBJPOOL_INIT ("variable", struct variable);
 static struct variable_set_list global_setlist
   = { 0, &global_variable_set, 0 };
 struct variable_set_list *current_variable_set_list = &global_setlist;
@@ -204,6 +434,7 @@ define_variable_in_set (const char *name, unsigned int length,
 
   var_key.name = (char *) name;
   var_key.length = length;
+  var_key.hash = variable_name_hash (name, length);
   var_slot = (struct variable **) hash_find_slot (&set->table, &var_key);
 
   if (env_overrides && origin == o_env)
@@ -212,6 +443,11 @@ define_variable_in_set (const char *name, unsigned int length,
   v = *var_slot;
   if (! HASH_VACANT (v))
     {
+#ifdef MAKE_PARALLEL_SHELL
+      if (v->pending)
+        shell_finish_pending (v);
+#endif
+
       if (env_overrides && v->origin == o_env)
         /* V came from in the environment.  Since it was defined
            before the switches were parsed, it wasn't affected by -e.  */
@@ -237,9 +473,10 @@ define_variable_in_set (const char *name, unsigned int length,
 
   /* Create a new variable definition and add it to the hash table.  */
 
-  v = xmalloc (sizeof (struct variable));
+  v = pool_alloc (&variable_pool);
   v->name = xstrndup (name, length);
   v->length = length;
+  v->hash = var_key.hash;
   hash_insert_at (&set->table, v, var_slot);
   v->value = xstrdup (value);
   if (flocp != 0)
@@ -254,6 +491,7 @@ define_variable_in_set (const char *name, unsigned int length,
   v->per_target = 0;
   v->append = 0;
   v->private_var = 0;
+  v->pending = 0;
   v->export = v_default;
 
   v->exportable = 1;
@@ -287,11 +525,18 @@ free_variable_name_and_value (const void *item)
   free (v->value);
 }
 
+static void
+free_variable (const void *item)
+{
+  free_variable_name_and_value (item);
+  pool_free (&variable_pool, (void *) item);
+}
+
 void
 free_variable_set (struct variable_set_list *list)
 {
-  hash_map (&list->set->table, free_variable_name_and_value);
-  hash_free (&list->set->table, 1);
+  hash_map (&list->set->table, free_variable);
+  hash_free (&list->set->table, 0);
   free (list->set);
   free (list);
 }
@@ -310,6 +555,7 @@ undefine_variable_in_set (const char *name, unsigned int length,
 
   var_key.name = (char *) name;
   var_key.length = length;
+  var_key.hash = variable_name_hash (name, length);
   var_slot = (struct variable **) hash_find_slot (&set->table, &var_key);
 
   if (env_overrides && origin == o_env)
@@ -318,6 +564,11 @@ undefine_variable_in_set (const char *name, unsigned int length,
   v = *var_slot;
   if (! HASH_VACANT (v))
     {
+#ifdef MAKE_PARALLEL_SHELL
+      if (v->pending)
+        shell_finish_pending (v);
+#endif
+
       if (env_overrides && v->origin == o_env)
         /* V came from in the environment.  Since it was defined
            before the switches were parsed, it wasn't affected by -e.  */
@@ -436,6 +687,7 @@ lookup_variable (const char *name, unsigned int length)
 
   var_key.name = (char *) name;
   var_key.length = length;
+  var_key.hash = variable_name_hash (name, length);
 
   for (setlist = current_variable_set_list;
        setlist != 0; setlist = setlist->next)
@@ -445,7 +697,13 @@ lookup_variable (const char *name, unsigned int length)
 
       v = (struct variable *) hash_find_item ((struct hash_table *) &set->table, &var_key);
       if (v && (!is_parent || !v->private_var))
-        return v->special ? lookup_special_var (v) : v;
+        {
+#ifdef MAKE_PARALLEL_SHELL
+          if (v->pending)
+            shell_finish_pending (v);
+#endif
+          return v->special ? lookup_special_var (v) : v;
+        }
 
       is_parent |= setlist->next_is_parent;
     }
@@ -519,11 +777,18 @@ lookup_variable_in_set (const char *name, unsigned int length,
                         const struct variable_set *set)
 {
   struct variable var_key;
+  struct variable *v;
 
   var_key.name = (char *) name;
   var_key.length = length;
+  var_key.hash = variable_name_hash (name, length);
 
-  return (struct variable *) hash_find_item ((struct hash_table *) &set->table, &var_key);
+  v = (struct variable *) hash_find_item ((struct hash_table *) &set->table, &var_key);
+#ifdef MAKE_PARALLEL_SHELL
+  if (v && v->pending)
+    shell_finish_pending (v);
+#endif
+  return v;
 }
 
 /* Initialize FILE's variable set list.  If FILE already has a variable set
@@ -576,12 +841,14 @@ initialize_file_variables (struct file *file, int reading)
 
   if (!reading && !file->pat_searched)
     {
-      struct pattern_var *p;
+      struct pattern_var **vars;
+      unsigned int nvars;
 
-      p = lookup_pattern_var (0, file->name);
-      if (p != 0)
+      vars = lookup_pattern_vars (file->name, &nvars);
+      if (vars != 0)
         {
           struct variable_set_list *global = current_variable_set_list;
+          unsigned int i;
 
           /* We found at least one.  Set up a new variable set to accumulate
              all the pattern variables that match this target.  */
@@ -589,10 +856,11 @@ initialize_file_variables (struct file *file, int reading)
           file->pat_variables = create_new_variable_set ();
           current_variable_set_list = file->pat_variables;
 
-          do
+          for (i = 0; i < nvars; ++i)
             {
               /* We found one, so insert it into the set.  */
 
+              struct pattern_var *p = vars[i];
               struct variable *v;
 
               if (p->variable.flavor == f_simple)
@@ -617,8 +885,8 @@ initialize_file_variables (struct file *file, int reading)
               v->export = p->variable.export;
               v->private_var = p->variable.private_var;
             }
-          while ((p = lookup_pattern_var (p, file->name)) != 0);
 
+          free (vars);
           current_variable_set_list = global;
         }
       file->pat_searched = 1;
@@ -712,8 +980,8 @@ pop_variable_scope (void)
 
   /* Free the one we no longer need.  */
   free (setlist);
-  hash_map (&set->table, free_variable_name_and_value);
-  hash_free (&set->table, 1);
+  hash_map (&set->table, free_variable);
+  hash_free (&set->table, 0);
   free (set);
 }
 
@@ -738,7 +1006,7 @@ merge_variable_sets (struct variable_set *to_set,
           {
             /* GKM FIXME: delete in from_set->table */
             free (from_var->value);
-            free (from_var);
+            pool_free (&variable_pool, from_var);
           }
       }
 }
@@ -1047,6 +1315,7 @@ target_environment (struct file *file)
 
   makelevel_key.name = MAKELEVEL_NAME;
   makelevel_key.length = MAKELEVEL_LENGTH;
+  makelevel_key.hash = variable_name_hash (MAKELEVEL_NAME, MAKELEVEL_LENGTH);
   hash_delete (&table, &makelevel_key);
 
   result = result_0 = xmalloc ((table.ht_fill + 2) * sizeof (char *));
@@ -1119,6 +1388,8 @@ shell_result (const char *p)
   char *args[2];
   char *result;
 
+  readcache_taint ("!=");
+
   install_variable_buffer (&buf, &len);
 
   args[0] = (char *) p;
@@ -1143,6 +1414,9 @@ do_variable_definition (const gmk_floc *flocp, const char *varname,
   struct variable *v;
   int append = 0;
   int conditional = 0;
+#ifdef MAKE_PARALLEL_SHELL
+  struct pending_shell *pending = 0;
+#endif
 
   /* Calculate the variable's new value in VALUE.  */
 
@@ -1157,6 +1431,16 @@ do_variable_definition (const gmk_floc *flocp, const char *varname,
          We have to allocate memory since otherwise it'll clobber the
          variable buffer, and we may still need that if we're looking at a
          target-specific variable.  */
+#ifdef MAKE_PARALLEL_SHELL
+      /* "var := $(shell ...)" may just start the command for now; see
+         shell_defer.  Make's own variables are read directly.  */
+      if (!target_var && varname[0] != '.'
+          && (pending = shell_defer (value)) != 0)
+        {
+          p = "";
+          break;
+        }
+#endif
       p = alloc_value = allocated_variable_expand (value);
       break;
     case f_shell:
@@ -1384,6 +1668,13 @@ do_variable_definition (const gmk_floc *flocp, const char *varname,
   v->append = append;
   v->conditional = conditional;
 
+#ifdef MAKE_PARALLEL_SHELL
+  /* If a stronger definition kept this one from happening, the output of
+     the command is of no use.  */
+  if (pending)
+    shell_defer_to (pending, v->origin == origin ? v : 0);
+#endif
+
   if (alloc_value)
     free (alloc_value);
 
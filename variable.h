@@ -53,6 +53,7 @@ struct variable
     char *value;                /* Variable value.  */
     gmk_floc fileinfo;          /* Where the variable was defined.  */
     int length;                 /* strlen (name) */
+    unsigned int hash;          /* variable_name_hash (name, length) */
     unsigned int recursive:1;   /* Gets recursively re-evaluated.  */
     unsigned int append:1;      /* Nonzero if an appending target-specific
                                    variable.  */
@@ -64,6 +65,8 @@ struct variable
     unsigned int expanding:1;   /* Nonzero if currently being expanded.  */
     unsigned int private_var:1; /* Nonzero avoids inheritance of this
                                    target-specific variable.  */
+    unsigned int pending:1;     /* Nonzero if the value is the output of a
+                                   command still running.  */
     unsigned int exp_count:EXP_COUNT_BITS;
                                 /* If >1, allow this many self-referential
                                    expansions.  */
@@ -135,6 +138,19 @@ char *patsubst_expand_pat (char *o, const char *text, const char *pattern,
 char *patsubst_expand (char *o, const char *text, char *pattern, char *replace);
 char *func_shell_base (char *o, char **argv, int trim_newlines);
 
+#ifdef MAKE_PARALLEL_SHELL
+struct pending_shell;
+struct pending_shell *shell_defer (const char *value);
+void shell_defer_to (struct pending_shell *p, struct variable *v);
+void shell_finish_pending (struct variable *v);
+void parallel_shells_start (unsigned int max);
+void parallel_shells_finish (void);
+#endif
+
+/* shellcache.c */
+char *shell_cache_expand (char *o, char **argv);
+void shell_cache_save (void);
+
 
 /* expand.c */
 char *recursively_expand_for_file (struct variable *v, struct file *file);
@@ -168,6 +184,7 @@ void hash_init_function_table (void);
 void define_new_function(const gmk_floc *flocp, const char *name,
                          unsigned int min, unsigned int max, unsigned int flags,
                          gmk_func_ptr func);
+unsigned int variable_name_hash (const char *name, unsigned int length);
 struct variable *lookup_variable (const char *name, unsigned int length);
 struct variable *lookup_variable_in_set (const char *name, unsigned int length,
                                          const struct variable_set *set);
@@ -229,6 +246,7 @@ char **target_environment (struct file *file);
 
 struct pattern_var *create_pattern_var (const char *target,
                                         const char *suffix);
+struct pattern_var *next_pattern_var (struct pattern_var *start);
 
 extern int export_all_variables;
 